@@ -204,11 +204,16 @@ public:
 		for (unsigned int i = 0; i < numP; i++) {
 			unsigned int num_vs;
 			file >> num_vs;
-			ASSERT(num_vs == 3 && "We can only read triangular mesh.");
-			
+			ASSERT(num_vs >= 3 && "A face needs at least three vertices.");
+
+			// polygons are split into a fan of triangles around their first vertex
 			Triangle t;
-			file >> t.idx0 >> t.idx1 >> t.idx2;
-			m_triangles.push_back(t);
+			file >> t.idx0 >> t.idx1;
+			for (unsigned int corner = 2; corner < num_vs; ++corner) {
+				file >> t.idx2;
+				m_triangles.push_back(t);
+				t.idx1 = t.idx2;
+			}
 		}
 
 		return true;
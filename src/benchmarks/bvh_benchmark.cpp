@@ -0,0 +1,82 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <random>
+#include "cpu_version/scene.h"
+
+// Compares rays/sec of the linear Scene::hitLinear against the BVH backed Scene::hit for
+// scenes of growing object count.
+
+static Scene makeScene(unsigned int objectCount, std::mt19937& random) {
+    std::uniform_real_distribution<float> position{ -50, 50 };
+    std::uniform_real_distribution<float> radius{ 0.2f, 1.f };
+    Scene scene;
+    scene.reserve(objectCount - objectCount / 4, objectCount / 4 + 1);
+    const MaterialId material = scene.addMaterial(Lambertian({ 0.5, 0.5, 0.5 }));
+    for (unsigned int index = 0; index < objectCount; ++index) {
+        const Vector3f center{ position(random), position(random), position(random) - 60 };
+        if (index % 4 == 0) {
+            scene.addCube(center, material);
+        } else {
+            scene.addSphere(center, radius(random), material);
+        }
+    }
+    return scene;
+}
+
+template<typename HitFunction>
+static double raysPerSecond(const std::vector<Ray>& rays, HitFunction&& hit, unsigned int& hits) {
+    HitRecord hitRecord;
+    hits = 0;
+    const auto start = std::chrono::high_resolution_clock::now();
+    for (const Ray& ray : rays) {
+        hits += hit(ray, hitRecord);
+    }
+    const auto end = std::chrono::high_resolution_clock::now();
+    return rays.size() / std::chrono::duration<double>(end - start).count();
+}
+
+int main() {
+    constexpr unsigned int rayCount = 100000;
+    constexpr unsigned int maxLinearObjects = 16384;
+    std::mt19937 random{ 42 };
+    std::uniform_real_distribution<float> direction{ -0.5f, 0.5f };
+
+    std::vector<Ray> rays;
+    rays.reserve(rayCount);
+    for (unsigned int index = 0; index < rayCount; ++index) {
+        rays.emplace_back(Vector3f{ 0, 0, 0 }, Vector3f{ direction(random), direction(random), -1 });
+    }
+
+    std::cout << std::setw(10) << "objects" << std::setw(16) << "linear rays/s" << std::setw(16) << "bvh rays/s"
+        << std::setw(10) << "speedup" << std::setw(10) << "nodes" << std::setw(14) << "bytes/object" << std::endl;
+
+    for (unsigned int objectCount = 16; objectCount <= 262144; objectCount *= 4) {
+        Scene scene = makeScene(objectCount, random);
+        scene.build();
+
+        unsigned int bvhHits;
+        const double bvh = raysPerSecond(rays, [&](const Ray& ray, HitRecord& hitRecord) {
+            return scene.hit(ray, 0.001, std::numeric_limits<float>::max(), hitRecord);
+        }, bvhHits);
+
+        double linear = 0;
+        if (objectCount <= maxLinearObjects) {
+            unsigned int linearHits;
+            linear = raysPerSecond(rays, [&](const Ray& ray, HitRecord& hitRecord) {
+                return scene.hitLinear(ray, 0.001, std::numeric_limits<float>::max(), hitRecord);
+            }, linearHits);
+            if (linearHits != bvhHits) {
+                std::cerr << "hit count mismatch: linear " << linearHits << " bvh " << bvhHits << std::endl;
+                return 1;
+            }
+        }
+
+        std::cout << std::setw(10) << objectCount << std::setw(16) << std::fixed << std::setprecision(0) << linear
+            << std::setw(16) << bvh << std::setw(10) << std::setprecision(1) << (linear > 0 ? bvh / linear : 0)
+            << std::setw(10) << scene.bvh.nodes.size()
+            << std::setw(14) << std::setprecision(1) << double(scene.memoryFootprint().total()) / objectCount << std::endl;
+    }
+    return 0;
+}
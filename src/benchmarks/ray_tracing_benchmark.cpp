@@ -0,0 +1,470 @@
+#include <stdio.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <random>
+#include <thread>
+#include <functional>
+#include "cpu_version/rayTracer.h"
+#include "cpu_version/meshCache.h"
+#include "SimpleMesh.h"
+
+// Micro benchmarks of the CPU ray tracing kernels and full frame renders of the built in scene,
+// written as JSON so two versions can be compared run against run. Every full frame is rendered
+// once per thread count to give the scaling curve.
+
+#ifndef BENCHMARK_MESH_DIRECTORY
+#define BENCHMARK_MESH_DIRECTORY "../src/meshes"
+#endif
+
+struct BenchmarkResult {
+    std::string name;
+    unsigned int threads;
+    uint64_t iterations;
+    double seconds;
+    // rays per iteration, 0 for kernels that do not trace rays
+    double raysPerIteration;
+    uint64_t rays;
+    // memory footprint of the scene of frame benchmarks
+    size_t sceneBytes = 0;
+
+    double nsPerOp() const { return seconds * 1e9 / iterations; }
+    double mraysPerSecond() const { return seconds > 0 ? rays / seconds / 1e6 : 0; }
+};
+
+struct BenchmarkOptions {
+    double minTime = 0.25;
+    std::string filter;
+    std::vector<unsigned int> threadCounts;
+    unsigned int frameWidth = 320;
+    unsigned int frameHeight = 240;
+    unsigned int frameSamplesPerAxis = 2;
+    std::string meshDirectory = BENCHMARK_MESH_DIRECTORY;
+};
+
+static volatile float sink;
+
+class BenchmarkSuite {
+public:
+    explicit BenchmarkSuite(const BenchmarkOptions& options) : options(options) {}
+
+    bool enabled(const std::string& name) const {
+        return options.filter.empty() || name.find(options.filter) != std::string::npos;
+    }
+
+    // Runs body(iterations) with a growing iteration count until one run takes minTime.
+    void measure(const std::string& name, double raysPerIteration, const std::function<void(uint64_t)>& body) {
+        if (!enabled(name)) {
+            return;
+        }
+        uint64_t iterations = 1;
+        double seconds = 0;
+        while (true) {
+            const auto start = std::chrono::high_resolution_clock::now();
+            body(iterations);
+            seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+            if (seconds >= options.minTime || iterations >= (uint64_t(1) << 40)) {
+                break;
+            }
+            const double scale = seconds > 0 ? options.minTime * 1.2 / seconds : 100;
+            iterations = std::max(iterations + 1, uint64_t(iterations * std::min(scale, 100.)));
+        }
+        add({ name, 1, iterations, seconds, raysPerIteration, uint64_t(raysPerIteration * iterations) });
+    }
+
+    void add(const BenchmarkResult& result) {
+        fprintf(stderr, "%-32s %3u threads %14.1f ns/op %10.3f Mrays/s\n", result.name.c_str(), result.threads,
+            result.nsPerOp(), result.mraysPerSecond());
+        results.push_back(result);
+    }
+
+    std::string json() const {
+        std::ostringstream out;
+        out << std::setprecision(9);
+        out << "{\n  \"hardwareThreads\": " << std::thread::hardware_concurrency() << ",\n  \"simdWidth\": " << SimdFloat::width
+            << ",\n  \"minTime\": " << options.minTime << ",\n  \"benchmarks\": [";
+        for (size_t index = 0; index < results.size(); ++index) {
+            const BenchmarkResult& result = results[index];
+            out << (index ? "," : "") << "\n    { \"name\": \"" << result.name << "\", \"threads\": " << result.threads
+                << ", \"iterations\": " << result.iterations << ", \"seconds\": " << result.seconds
+                << ", \"nsPerOp\": " << result.nsPerOp() << ", \"rays\": " << result.rays
+                << ", \"mraysPerSecond\": " << result.mraysPerSecond() << ", \"speedup\": " << speedup(result);
+            if (result.sceneBytes > 0) {
+                out << ", \"sceneBytes\": " << result.sceneBytes;
+            }
+            out << " }";
+        }
+        out << "\n  ]\n}\n";
+        return out.str();
+    }
+
+    const BenchmarkOptions& options;
+
+private:
+    // time of the single threaded run of the same benchmark divided by the time of this run
+    double speedup(const BenchmarkResult& result) const {
+        for (const BenchmarkResult& other : results) {
+            if (other.name == result.name && other.threads == 1) {
+                return other.nsPerOp() / result.nsPerOp();
+            }
+        }
+        return 1;
+    }
+
+    std::vector<BenchmarkResult> results;
+};
+
+static std::vector<Ray> makeRays(unsigned int count, const Vector3f& origin, const Vector3f& target, float spread, std::mt19937& random) {
+    std::uniform_real_distribution<float> offset{ -spread, spread };
+    std::vector<Ray> rays;
+    rays.reserve(count);
+    for (unsigned int index = 0; index < count; ++index) {
+        const Vector3f direction = target + Vector3f{ offset(random), offset(random), offset(random) } - origin;
+        rays.emplace_back(origin, direction);
+    }
+    return rays;
+}
+
+static void kernelBenchmarks(BenchmarkSuite& suite) {
+    std::mt19937 random{ 42 };
+    // the kernels only pass the material through
+    const MaterialId material = 0;
+    constexpr unsigned int rayCount = 4096;
+
+    // about half of the rays miss, so both branches of the kernels are timed
+    const Sphere sphere{ { 0, 0, -4 }, 0.5f, material };
+    const std::vector<Ray> sphereRays = makeRays(rayCount, { 0, 0, 0 }, { 0, 0, -4 }, 0.7f, random);
+    suite.measure("Sphere::hit", 1, [&](uint64_t iterations) {
+        HitRecord record;
+        unsigned int hits = 0;
+        for (uint64_t index = 0; index < iterations; ++index) {
+            hits += sphere.hit(sphereRays[index % rayCount], record);
+        }
+        sink = float(hits);
+    });
+
+    Cube cube{ { 0, 0, -4 }, material };
+    cube.rotate(0.3f);
+    const std::vector<Ray> cubeRays = makeRays(rayCount, { 0, 0, 0 }, { 0, 0, -4 }, 0.9f, random);
+    suite.measure("Cube::hit", 1, [&](uint64_t iterations) {
+        HitRecord record;
+        unsigned int hits = 0;
+        for (uint64_t index = 0; index < iterations; ++index) {
+            hits += cube.hit(cubeRays[index % rayCount], record);
+        }
+        sink = float(hits);
+    });
+
+    suite.measure("randomUnitVector", 0, [&](uint64_t iterations) {
+        threadRandom = RandomStream(1, 0, 0);
+        Vector3f sum = Vector3f::Zero();
+        for (uint64_t index = 0; index < iterations; ++index) {
+            sum += randomUnitVector();
+        }
+        sink = sum.x();
+    });
+
+    std::vector<Color> pixels(64 * 64);
+    RayTracer rayTracer{ pixels.data(), 64, 64, 0, 1 };
+    const Scene& scene = rayTracer.getScene();
+    const std::vector<Ray> cameraRays = makeRays(rayCount, { 1, 0, 6 }, { 1, 0, -3 }, 4.f, random);
+    suite.measure("Scene::hit", 1, [&](uint64_t iterations) {
+        HitRecord record;
+        unsigned int hits = 0;
+        for (uint64_t index = 0; index < iterations; ++index) {
+            hits += scene.hit(cameraRays[index % rayCount], 0.001, std::numeric_limits<float>::max(), record);
+        }
+        sink = float(hits);
+    });
+
+    const auto renderPixel = [&](auto n) {
+        constexpr unsigned int N = decltype(n)::value;
+        uint64_t rays = rayTracer.getTracedRays();
+        // one calibration call gives the average rays per pixel, the timed loop sweeps the whole image
+        for (unsigned int pixel = 0; pixel < 64 * 64; ++pixel) {
+            Vector3f position = Vector3f{ -0.5f + (pixel % 64) / 64.f, 0.5f - (pixel / 64) / 64.f, -1 } + Vector3f{ 1, 0, 6 };
+            rayTracer.renderPixel<N>(position, pixel);
+        }
+        const double raysPerPixel = double(rayTracer.getTracedRays() - rays) / (64 * 64);
+        suite.measure("RayTracer::renderPixel<" + std::to_string(N) + ">", raysPerPixel, [&](uint64_t iterations) {
+            for (uint64_t index = 0; index < iterations; ++index) {
+                const unsigned int pixel = index % (64 * 64);
+                Vector3f position = Vector3f{ -0.5f + (pixel % 64) / 64.f, 0.5f - (pixel / 64) / 64.f, -1 } + Vector3f{ 1, 0, 6 };
+                rayTracer.renderPixel<N>(position, pixel);
+            }
+        });
+    };
+    renderPixel(std::integral_constant<unsigned int, 1>());
+    renderPixel(std::integral_constant<unsigned int, 2>());
+    renderPixel(std::integral_constant<unsigned int, 4>());
+}
+
+// meshes that are not found are skipped, SimpleMesh::loadMesh would report the failure on stdout
+static std::vector<std::string> meshFiles(const BenchmarkSuite& suite) {
+    std::vector<std::string> files;
+    for (const char* name : { "/Bunny-LowPoly.off", "/bunny.off" }) {
+        if (std::ifstream(suite.options.meshDirectory + name).good()) {
+            files.push_back(suite.options.meshDirectory + name);
+        }
+    }
+    return files;
+}
+
+// Full BVH build of 100k objects against the update after 1% of them moved.
+static void dynamicBenchmarks(BenchmarkSuite& suite) {
+    if (!suite.enabled("Scene::build") && !suite.enabled("Scene::update")) {
+        return;
+    }
+    constexpr unsigned int objectCount = 100000;
+    constexpr unsigned int movedCount = objectCount / 100;
+    std::mt19937 random{ 7 };
+    std::uniform_real_distribution<float> position{ -50, 50 };
+    std::uniform_real_distribution<float> offset{ -0.2f, 0.2f };
+    Scene scene;
+    const MaterialId material = scene.addMaterial(Lambertian({ 0.5f, 0.5f, 0.5f }));
+    for (unsigned int index = 0; index < objectCount; ++index) {
+        scene.addSphere({ position(random), position(random), position(random) - 60 }, 0.5f, material);
+    }
+
+    suite.measure("Scene::build/100k", 0, [&](uint64_t iterations) {
+        for (uint64_t index = 0; index < iterations; ++index) {
+            scene.build();
+        }
+    });
+    ThreadPool threadPool;
+    suite.measure("Scene::update/100k, 1k moved", 0, [&](uint64_t iterations) {
+        for (uint64_t index = 0; index < iterations; ++index) {
+            for (unsigned int moved = 0; moved < movedCount; ++moved) {
+                const uint32_t sphere = random() % objectCount;
+                scene.moveSphere(sphere, scene.spheres.center(sphere) + Vector3f{ offset(random), offset(random), offset(random) });
+            }
+            scene.update(&threadPool);
+        }
+    });
+}
+
+// Denoising a 640x360 frame of the default scene rendered with 4 samples per pixel.
+static void denoiserBenchmark(BenchmarkSuite& suite) {
+    if (!suite.enabled("Denoiser::denoise")) {
+        return;
+    }
+    constexpr unsigned int width = 640, height = 360;
+    std::vector<Color> pixels(size_t(width) * height);
+    RayTracer rayTracer{ pixels.data(), width, height };
+    for (unsigned int pass = 0; pass < 4; ++pass) {
+        rayTracer.renderPass();
+    }
+    rayTracer.resolve();
+    std::vector<float> noisy(pixels.size() * 3), linear(noisy.size());
+    for (size_t value = 0; value < noisy.size(); ++value) {
+        noisy[value] = (&pixels[0].r)[value] * (&pixels[0].r)[value];
+    }
+
+    Denoiser denoiser;
+    ThreadPool threadPool;
+    suite.measure("Denoiser::denoise/640x360", 0, [&](uint64_t iterations) {
+        for (uint64_t index = 0; index < iterations; ++index) {
+            linear = noisy;
+            denoiser.denoise(linear.data(), rayTracer.getFeatures(), &threadPool);
+        }
+        sink = linear[0];
+    });
+}
+
+static std::string fileName(const std::string& path) {
+    return path.substr(path.find_last_of("/\\") + 1);
+}
+
+static void meshBenchmarks(BenchmarkSuite& suite) {
+    for (const std::string& path : meshFiles(suite)) {
+        SimpleMesh mesh;
+        if (!suite.enabled("SimpleMesh::loadMesh") || !mesh.loadMesh(path)) {
+            continue;
+        }
+        suite.measure("SimpleMesh::loadMesh/" + fileName(path), 0, [&](uint64_t iterations) {
+            for (uint64_t index = 0; index < iterations; ++index) {
+                mesh.loadMesh(path);
+            }
+            sink = float(mesh.getTriangles().size());
+        });
+    }
+    ThreadPool threadPool;
+    for (const std::string& path : meshFiles(suite)) {
+        if (!suite.enabled("MeshLoader::load")) {
+            continue;
+        }
+        suite.measure("MeshLoader::load/" + fileName(path), 0, [&](uint64_t iterations) {
+            SimpleMesh mesh;
+            for (uint64_t index = 0; index < iterations; ++index) {
+                MeshLoader::load(path, mesh, &threadPool);
+            }
+            sink = float(mesh.getTriangles().size());
+        });
+    }
+    for (const std::string& path : meshFiles(suite)) {
+        SimpleMesh loaded;
+        if (!suite.enabled("MeshProcessor::preprocess") || !MeshLoader::load(path, loaded)) {
+            continue;
+        }
+        suite.measure("MeshProcessor::preprocess/" + fileName(path), 0, [&](uint64_t iterations) {
+            for (uint64_t index = 0; index < iterations; ++index) {
+                SimpleMesh mesh = loaded;
+                MeshProcessor::preprocess(mesh, &threadPool);
+                sink = float(mesh.getVertices().size());
+            }
+        });
+    }
+    // the cache is written once to the temporary directory, opening it maps and checks the file
+    for (const std::string& path : meshFiles(suite)) {
+        SimpleMesh mesh;
+        const std::string cachePath = (std::filesystem::temp_directory_path() / (fileName(path) + ".rtmesh")).string();
+        if (!suite.enabled("MeshCache::open") || !mesh.loadMesh(path) || !writeMeshCache(cachePath, mesh)) {
+            continue;
+        }
+        suite.measure("MeshCache::open/" + fileName(path), 0, [&](uint64_t iterations) {
+            for (uint64_t index = 0; index < iterations; ++index) {
+                MeshCache cache;
+                cache.open(cachePath);
+                sink = float(cache.triangleMesh(0).triangleCount());
+            }
+        });
+        std::remove(cachePath.c_str());
+    }
+}
+
+// Renders one frame per thread count, the first frame of each renderer is not timed. setup adds
+// objects to the built in scene and returns false if it could not.
+static void frameBenchmark(BenchmarkSuite& suite, const std::string& name, const std::function<bool(Scene&)>& setup) {
+    if (!suite.enabled(name)) {
+        return;
+    }
+    const BenchmarkOptions& options = suite.options;
+    std::vector<Color> pixels(size_t(options.frameWidth) * options.frameHeight);
+    for (unsigned int threads : options.threadCounts) {
+        RayTracer rayTracer{ pixels.data(), options.frameWidth, options.frameHeight, 0, threads };
+        rayTracer.samplesPerAxis = options.frameSamplesPerAxis;
+        if (!setup(rayTracer.getScene())) {
+            return;
+        }
+        rayTracer.getScene().build();
+        rayTracer.render();
+
+        uint64_t frames = 0;
+        const uint64_t firstRays = rayTracer.getTracedRays();
+        const auto start = std::chrono::high_resolution_clock::now();
+        double seconds = 0;
+        do {
+            rayTracer.render();
+            ++frames;
+            seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        } while (seconds < options.minTime);
+        const uint64_t rays = rayTracer.getTracedRays() - firstRays;
+        BenchmarkResult result{ name, rayTracer.getThreadCount(), frames, seconds, double(rays) / frames, rays };
+        result.sceneBytes = rayTracer.getScene().memoryFootprint().total();
+        suite.add(result);
+    }
+}
+
+static bool loadNormalizedMesh(const std::string& path, SimpleMesh& mesh) {
+    if (!mesh.loadMesh(path)) {
+        return false;
+    }
+    mesh.normalize();
+    return true;
+}
+
+static void printUsage(const char* program) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  --json FILE            write the results to FILE instead of stdout\n"
+        "  --filter TEXT          only run benchmarks whose name contains TEXT\n"
+        "  --min-time SECONDS     minimum time of every measurement (default 0.25)\n"
+        "  --threads N,N,...      thread counts of the frame benchmarks (default 1, 2, 4, ... up to every core)\n"
+        "  --frame WxH            size of the frame benchmarks (default 320x240)\n"
+        "  --meshes DIRECTORY     directory holding bunny.off and Bunny-LowPoly.off\n",
+        program);
+}
+
+int main(int argc, char** argv) {
+    BenchmarkOptions options;
+    std::string jsonPath;
+    for (int index = 1; index < argc; ++index) {
+        const std::string argument = argv[index];
+        const bool hasValue = index + 1 < argc;
+        if (argument == "--json" && hasValue) jsonPath = argv[++index];
+        else if (argument == "--filter" && hasValue) options.filter = argv[++index];
+        else if (argument == "--min-time" && hasValue) options.minTime = std::stod(argv[++index]);
+        else if (argument == "--meshes" && hasValue) options.meshDirectory = argv[++index];
+        else if (argument == "--frame" && hasValue) {
+            if (sscanf(argv[++index], "%ux%u", &options.frameWidth, &options.frameHeight) != 2) {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (argument == "--threads" && hasValue) {
+            std::stringstream list{ argv[++index] };
+            for (std::string count; std::getline(list, count, ',');) {
+                options.threadCounts.push_back(std::stoul(count));
+            }
+        } else {
+            printUsage(argv[0]);
+            return argument == "--help" ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (options.threadCounts.empty()) {
+        const unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned int threads = 1; threads < cores; threads *= 2) {
+            options.threadCounts.push_back(threads);
+        }
+        options.threadCounts.push_back(cores);
+    }
+
+    BenchmarkSuite suite{ options };
+    kernelBenchmarks(suite);
+    meshBenchmarks(suite);
+    dynamicBenchmarks(suite);
+    denoiserBenchmark(suite);
+    frameBenchmark(suite, "frame/default", [](Scene&) { return true; });
+    for (const std::string& path : meshFiles(suite)) {
+        frameBenchmark(suite, "frame/" + fileName(path), [&](Scene& scene) {
+            SimpleMesh mesh;
+            if (!loadNormalizedMesh(path, mesh)) {
+                return false;
+            }
+            mesh.transform(AngleAxisf(-pi / 2, Vector3f::UnitX()).toRotationMatrix(), { -3, 0.5, -3 });
+            scene.addMesh(mesh, scene.addMaterial(Lambertian({ 0.8f, 0.3f, 0.3f })));
+            return true;
+        });
+    }
+    // a 100 x 100 grid of copies of the same bunny above the scene, the geometry is stored once
+    for (const std::string& path : meshFiles(suite)) {
+        frameBenchmark(suite, "frame/instances/" + fileName(path), [&](Scene& scene) {
+            SimpleMesh mesh;
+            if (!loadNormalizedMesh(path, mesh)) {
+                return false;
+            }
+            const uint32_t geometry = scene.addGeometry(mesh);
+            const MaterialId material = scene.addMaterial(Lambertian({ 0.8f, 0.3f, 0.3f }));
+            for (unsigned int index = 0; index < 10000; ++index) {
+                const Vector3f position{ (index % 100) * 1.5f - 75.f, 6.5f, -6.f - (index / 100) * 1.5f };
+                scene.addInstance(geometry, Translation3f(position) * AngleAxisf(-pi / 2 + index * 0.1f, Vector3f::UnitX()) * Scaling(0.5f), material);
+            }
+            return true;
+        });
+    }
+
+    if (jsonPath.empty()) {
+        std::cout << suite.json();
+    } else {
+        std::ofstream file(jsonPath);
+        file << suite.json();
+        if (!file.good()) {
+            fprintf(stderr, "Could not write %s\n", jsonPath.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
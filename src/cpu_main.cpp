@@ -0,0 +1,442 @@
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stdlib.h>
+#include <stdio.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <filesystem>
+#include "cpu_version/rayTracer.h"
+#include "cpu_version/meshCache.h"
+#include "cpu_version/sceneLoader.h"
+#include "cpu_version/renderFarm.h"
+#include "imageWriter.h"
+#include "frameWriter.h"
+
+// Renders the CPU scene without a window and writes it to an image file.
+
+static void printUsage(const char* program) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  --width N              image width (default 1080)\n"
+        "  --height N             image height (default 720)\n"
+        "  --spp N                samples per pixel, rounded to a square grid (default 25)\n"
+        "  --depth N              maximum bounces (default 10)\n"
+        "  --threads N            worker threads, 0 uses every core (default 0)\n"
+        "  --pin                  pin every worker thread to its own core\n"
+        "  --seed N               random seed (default 0)\n"
+        "  --integrator NAME      recursive or wavefront (default recursive)\n"
+        "  --no-nee               find lights only by scattered rays, without light sampling\n"
+        "  --passes N             accumulate N progressive passes of one sample per pixel instead\n"
+        "  --adaptive ERROR       sample every tile until its noise estimate drops below ERROR instead\n"
+        "  --time SECONDS         time budget of --adaptive (default none)\n"
+        "  --max-spp N            sample limit per pixel of --adaptive (default 1024)\n"
+        "  --scene FILE           render a scene file or compiled .rtscene, its settings are the defaults of the other options\n"
+        "  --mesh FILE            add an .off or .obj mesh, cached as FILE.rtmesh, or an .rtmesh cache to the scene\n"
+        "  --denoise              filter the image with the denoiser guided by albedo, normal and depth\n"
+        "  --aov PREFIX           also write PREFIX_albedo, PREFIX_normal and PREFIX_depth in the format of --output\n"
+        "  --stats FILE           write per frame counters and timings, .csv or JSON otherwise\n"
+        "  --output FILE          .png, .pfm or .exr (default render.png, render.exr if built without stb_image_write.h)\n"
+        "  --frames N             render N frames of the animation, a %%04d in --output is replaced by the frame number,\n"
+        "                         without one the number is put in front of the extension\n"
+        "  --workers N            render --passes, or --spp, jittered samples per pixel with N local worker processes\n"
+        "  --worker-command CMD   also start a worker with the shell command CMD, for example \"ssh node /path/cpuRender\",\n"
+        "                         repeat for more, the scene and mesh paths have to be valid for every worker\n"
+        "  --job-samples N        samples per pixel of every job of the workers (default all of them)\n"
+        "  --checkpoint FILE      save the finished jobs of the workers to FILE and resume from it, also on SIGINT and SIGTERM\n"
+        "  --checkpoint-interval SECONDS\n"
+        "                         seconds between the saves of --checkpoint, 0 saves after every job (default 10)\n",
+        program);
+}
+
+// Writes the feature buffers as images, the normals mapped from [-1, 1] to [0, 1] and the depth as
+// gray in scene units.
+static bool writeFeatures(const std::string& prefix, const std::string& extension, const FeatureBuffers& features) {
+    const unsigned int width = features.getWidth();
+    const unsigned int height = features.getHeight();
+    std::vector<float> albedo(size_t(width) * height * 3), normal(albedo.size()), depth(albedo.size());
+    for (unsigned int pixel = 0; pixel < width * height; ++pixel) {
+        const Vector3f pixelAlbedo = features.albedo(pixel);
+        const Vector3f pixelNormal = features.normal(pixel) * 0.5f + Vector3f::Constant(0.5f);
+        for (unsigned int channel = 0; channel < 3; ++channel) {
+            // the writers expect square root encoded values
+            albedo[pixel * 3 + channel] = std::sqrt(pixelAlbedo[channel]);
+            normal[pixel * 3 + channel] = std::sqrt(std::max(0.f, pixelNormal[channel]));
+            depth[pixel * 3 + channel] = std::sqrt(features.depth(pixel));
+        }
+    }
+    return writeImage(prefix + "_albedo" + extension, albedo.data(), width, height)
+        && writeImage(prefix + "_normal" + extension, normal.data(), width, height)
+        && writeImage(prefix + "_depth" + extension, depth.data(), width, height);
+}
+
+// Renders frames 0..frameCount - 1 of the animation. Each frame is rendered straight into a buffer
+// of the FrameWriter, whose threads encode and write it while the next frames render, the tracer
+// only waits for them once every buffer is queued. The scene update of the next frame refits the
+// BVH between the frames.
+static int renderAnimation(RayTracer& rayTracer, unsigned int frameCount, unsigned int passes, bool denoise,
+    const std::string& output, const std::string& statsPath) {
+    const unsigned int width = rayTracer.getWidth();
+    const unsigned int height = rayTracer.getHeight();
+    Stats& stats = Stats::global();
+    stats.reset();
+    FrameWriter writer{ width, height };
+    const auto start = std::chrono::high_resolution_clock::now();
+    for (unsigned int frame = 0; frame < frameCount; ++frame) {
+        stats.beginFrame();
+        float* pixels = writer.acquire();
+        rayTracer.setBuffer(pixels);
+        if (passes > 0) {
+            for (unsigned int pass = 0; pass < passes; ++pass) {
+                rayTracer.renderPass();
+            }
+            rayTracer.resolve();
+        } else {
+            rayTracer.render();
+        }
+        if (denoise) {
+            rayTracer.denoise();
+        }
+        // render() already moved on to the next frame
+        if (passes > 0) {
+            rayTracer.advanceFrame();
+        }
+        writer.submit(pixels, framePath(output, frame));
+        stats.endFrame();
+    }
+    const double renderSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    const bool written = writer.finish();
+    const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+    if (passes > 0) {
+        printf("%ux%u, %u frames of %u progressive passes\n", width, height, frameCount, passes);
+    } else {
+        printf("%ux%u, %u frames of %u spp\n", width, height, frameCount, rayTracer.samplesPerAxis * rayTracer.samplesPerAxis);
+    }
+    printf("wall time    %.3f s, %.3f frames/s\n", seconds, frameCount / seconds);
+    printf("time/frame   %.3f ms\n", renderSeconds / frameCount * 1e3);
+    printf("rays/sec     %.3f M\n", rayTracer.getTracedRays() / seconds / 1e6);
+    printf("writing      %.3f ms/frame on the writer threads, the renderer waited %.3f ms for them\n",
+        writer.writeSeconds() / frameCount * 1e3, writer.waitSeconds() * 1e3);
+    printf("last write   %.3f ms after the last frame\n", (seconds - renderSeconds) * 1e3);
+
+    if (!statsPath.empty() && !stats.write(statsPath)) {
+        fprintf(stderr, "Could not write %s\n", statsPath.c_str());
+        return EXIT_FAILURE;
+    }
+    for (const std::string& path : writer.failedFrames()) {
+        fprintf(stderr, "Could not write %s\n", path.c_str());
+    }
+    return written ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Renders with worker processes instead of in this process, see FarmCoordinator.
+static int renderOnFarm(const FarmCoordinator::Settings& settings, unsigned int width, unsigned int height, const std::string& output) {
+    FarmCoordinator coordinator{ width, height, settings };
+    Film film{ width, height };
+    std::string error;
+    const auto start = std::chrono::high_resolution_clock::now();
+    const bool rendered = coordinator.render(film, error);
+    const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    if (!rendered) {
+        fprintf(stderr, "%s\n", error.c_str());
+        if (!settings.checkpointPath.empty()) {
+            fprintf(stderr, "the finished jobs are saved in %s\n", settings.checkpointPath.c_str());
+        }
+        return EXIT_FAILURE;
+    }
+
+    printf("%ux%u, %u spp in %u jobs on %u workers\n", width, height, settings.samples, coordinator.jobCount(), coordinator.workerCount());
+    if (coordinator.resumedJobs() > 0) {
+        printf("resumed      %u jobs from %s\n", coordinator.resumedJobs(), settings.checkpointPath.c_str());
+    }
+    printf("wall time    %.3f s\n", seconds);
+    printf("rays/sec     %.3f M\n", coordinator.getTracedRays() / seconds / 1e6);
+
+    std::vector<float> pixels(size_t(width) * height * 3);
+    film.resolve(pixels.data());
+    if (!writeImage(output, pixels.data(), width, height)) {
+        fprintf(stderr, "Could not write %s\n", output.c_str());
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv) {
+    unsigned int width = 1080;
+    unsigned int height = 720;
+    unsigned int samplesPerPixel = 25;
+    unsigned int depth = 10;
+    unsigned int threads = 0;
+    unsigned int passes = 0;
+    unsigned int frames = 0;
+    float adaptiveError = 0;
+    double timeBudget = 0;
+    unsigned int maxSamples = 1024;
+    bool pin = false;
+    bool nextEventEstimation = true;
+    bool denoise = false;
+    uint64_t seed = 0;
+    std::string integrator = "recursive";
+    std::string output = std::string("render") + defaultImageExtension;
+    std::string meshPath;
+    std::string aovPrefix;
+    std::string statsPath;
+    std::string scenePath;
+    unsigned int localWorkers = 0;
+    std::vector<std::string> workerCommands;
+    unsigned int jobSamples = 0;
+    std::string checkpointPath;
+    double checkpointInterval = 10;
+    bool worker = false;
+
+    // the settings of a scene file are read first, so the options after it can override them
+    LoadedScene loadedScene;
+    double sceneSeconds = 0;
+    for (int index = 1; index + 1 < argc; ++index) {
+        if (std::string(argv[index]) == "--scene") scenePath = argv[++index];
+    }
+    if (!scenePath.empty()) {
+        const auto loadStart = std::chrono::high_resolution_clock::now();
+        std::string error;
+        if (!loadedScene.load(scenePath, error)) {
+            fprintf(stderr, "%s\n", error.c_str());
+            return EXIT_FAILURE;
+        }
+        sceneSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - loadStart).count();
+        const SceneDescription::RenderSettings& settings = loadedScene.description.settings;
+        width = settings.width;
+        height = settings.height;
+        samplesPerPixel = settings.samplesPerPixel;
+        depth = settings.maxDepth;
+        passes = settings.passes;
+        seed = settings.seed;
+        integrator = settings.integrator;
+    }
+
+    for (int index = 1; index < argc; ++index) {
+        const std::string argument = argv[index];
+        const bool hasValue = index + 1 < argc;
+        if (argument == "--width" && hasValue) width = std::stoul(argv[++index]);
+        else if (argument == "--height" && hasValue) height = std::stoul(argv[++index]);
+        else if (argument == "--spp" && hasValue) samplesPerPixel = std::stoul(argv[++index]);
+        else if (argument == "--depth" && hasValue) depth = std::stoul(argv[++index]);
+        else if (argument == "--threads" && hasValue) threads = std::stoul(argv[++index]);
+        else if (argument == "--passes" && hasValue) passes = std::stoul(argv[++index]);
+        else if (argument == "--adaptive" && hasValue) adaptiveError = std::stof(argv[++index]);
+        else if (argument == "--time" && hasValue) timeBudget = std::stod(argv[++index]);
+        else if (argument == "--max-spp" && hasValue) maxSamples = std::stoul(argv[++index]);
+        else if (argument == "--pin") pin = true;
+        else if (argument == "--no-nee") nextEventEstimation = false;
+        else if (argument == "--seed" && hasValue) seed = std::stoull(argv[++index]);
+        else if (argument == "--integrator" && hasValue) integrator = argv[++index];
+        else if (argument == "--output" && hasValue) output = argv[++index];
+        else if (argument == "--frames" && hasValue) frames = std::stoul(argv[++index]);
+        else if (argument == "--scene" && hasValue) ++index;
+        else if (argument == "--mesh" && hasValue) meshPath = argv[++index];
+        else if (argument == "--denoise") denoise = true;
+        else if (argument == "--aov" && hasValue) aovPrefix = argv[++index];
+        else if (argument == "--stats" && hasValue) statsPath = argv[++index];
+        else if (argument == "--workers" && hasValue) localWorkers = std::stoul(argv[++index]);
+        else if (argument == "--worker-command" && hasValue) workerCommands.push_back(argv[++index]);
+        else if (argument == "--job-samples" && hasValue) jobSamples = std::stoul(argv[++index]);
+        else if (argument == "--checkpoint" && hasValue) checkpointPath = argv[++index];
+        else if (argument == "--checkpoint-interval" && hasValue) checkpointInterval = std::stod(argv[++index]);
+        else if (argument == "--worker") worker = true;
+        else {
+            printUsage(argv[0]);
+            return argument == "--help" ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (width == 0 || height == 0 || (integrator != "recursive" && integrator != "wavefront")) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (!canWriteImage(framePath(output, 0))) {
+        fprintf(stderr, "Cannot write %s, the formats are .pfm, .exr and, with stb_image_write.h, .png\n", output.c_str());
+        return EXIT_FAILURE;
+    }
+
+    if (frames > 0 && (adaptiveError > 0 || !aovPrefix.empty() || localWorkers > 0 || !workerCommands.empty())) {
+        fprintf(stderr, "--frames renders with --spp or --passes in this process, without --adaptive, --aov and workers\n");
+        return EXIT_FAILURE;
+    }
+
+    if (localWorkers > 0 || !workerCommands.empty()) {
+        if (denoise || !aovPrefix.empty() || adaptiveError > 0 || !statsPath.empty()) {
+            fprintf(stderr, "The workers render jittered passes, --denoise, --aov, --adaptive and --stats need a single process\n");
+            return EXIT_FAILURE;
+        }
+        FarmCoordinator::Settings settings;
+        settings.workerArguments = { "--width", std::to_string(width), "--height", std::to_string(height), "--depth", std::to_string(depth),
+                                     "--seed", std::to_string(seed), "--integrator", integrator };
+        if (!nextEventEstimation) {
+            settings.workerArguments.push_back("--no-nee");
+        }
+        for (const auto& [option, path] : { std::pair{ "--scene", scenePath }, std::pair{ "--mesh", meshPath } }) {
+            if (!path.empty()) {
+                settings.workerArguments.push_back(option);
+                settings.workerArguments.push_back(std::filesystem::absolute(path).string());
+                settings.inputFiles.push_back(std::filesystem::absolute(path).string());
+            }
+        }
+        // the meshes a text scene names are read by the workers too
+        for (const std::string& path : loadedScene.description.meshFiles) {
+            settings.inputFiles.push_back(std::filesystem::absolute(path).string());
+        }
+        // local workers share the cores of this machine, the others use all of theirs by default
+        const std::string self = FarmCoordinator::shellQuote(FarmCoordinator::currentExecutable(argv[0]));
+        const unsigned int localThreads = threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency() / std::max(localWorkers, 1u));
+        for (unsigned int index = 0; index < localWorkers; ++index) {
+            settings.workerCommands.push_back(self + " --threads " + std::to_string(localThreads));
+        }
+        for (const std::string& command : workerCommands) {
+            settings.workerCommands.push_back(command + " --threads " + std::to_string(threads));
+        }
+        settings.samples = passes > 0 ? passes : samplesPerPixel;
+        settings.jobSamples = jobSamples;
+        settings.checkpointPath = checkpointPath;
+        settings.checkpointInterval = checkpointInterval;
+        return renderOnFarm(settings, width, height, output);
+    }
+    // a worker answers on the standard streams, anything printed goes to stderr
+    const FarmChannel channel = worker ? FarmChannel::workerStreams() : FarmChannel();
+
+    static_assert(sizeof(Color) == 3 * sizeof(float), "Color has to be tightly packed RGB");
+    std::vector<Color> pixels(size_t(width) * height);
+    RayTracer rayTracer{ pixels.data(), width, height, seed, threads, pin };
+    rayTracer.integrator = integrator == "wavefront" ? RayTracer::Integrator::WAVEFRONT : RayTracer::Integrator::RECURSIVE;
+    rayTracer.samplesPerAxis = std::clamp((unsigned int)std::lround(std::sqrt(double(samplesPerPixel))), 1u, RayTracer::maxSamplesPerAxis);
+    rayTracer.maxDepth = depth;
+    rayTracer.nextEventEstimation = nextEventEstimation;
+
+    if (!scenePath.empty()) {
+        const auto buildStart = std::chrono::high_resolution_clock::now();
+        buildScene(rayTracer.getScene(), loadedScene);
+        const SceneDescription::Camera& camera = loadedScene.description.camera;
+        rayTracer.setCamera(camera.position, camera.direction, camera.up, camera.focalLength);
+        const double buildSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - buildStart).count();
+        printf("scene        %s loaded in %.3f ms, built in %.3f ms\n", scenePath.c_str(), sceneSeconds * 1e3, buildSeconds * 1e3);
+    }
+
+    if (!meshPath.empty()) {
+        const std::string extension = ".rtmesh";
+        const bool isCache = meshPath.size() >= extension.size() && meshPath.compare(meshPath.size() - extension.size(), extension.size(), extension) == 0;
+        const auto loadStart = std::chrono::high_resolution_clock::now();
+        MeshCache cache;
+        ThreadPool loadPool{ threads };
+        if (!(isCache ? cache.open(meshPath) : cache.openOrCreate(meshPath, meshPath + extension, &loadPool))) {
+            fprintf(stderr, "Could not load %s\n", meshPath.c_str());
+            return EXIT_FAILURE;
+        }
+        Scene& scene = rayTracer.getScene();
+        const uint32_t geometry = scene.addGeometry(cache.triangleMesh(0));
+        const double loadSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - loadStart).count();
+        printf("mesh         %zu triangles loaded in %.3f ms\n", cache.triangleCount(), loadSeconds * 1e3);
+
+        // scaled to a unit cube and stood up where the scene used to show the bunny
+        const AlignedBox3f bounds = scene.geometries[geometry].bounds();
+        const float size = bounds.isEmpty() ? 1.f : std::max(bounds.sizes().maxCoeff(), 1e-6f);
+        const Affine3f transform = Translation3f(-3, 0.5, -3) * AngleAxisf(-float(pi) / 2, Vector3f::UnitX())
+            * Scaling(1.f / size) * Translation3f(bounds.isEmpty() ? Vector3f::Zero() : Vector3f(-bounds.center()));
+        scene.addInstance(geometry, transform, scene.addMaterial(Lambertian({ 0.8, 0.3, 0.3 })));
+        scene.build();
+    }
+    if (worker) {
+        return runFarmWorker(rayTracer, channel) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (frames > 0) {
+        return renderAnimation(rayTracer, frames, passes, denoise, output, statsPath);
+    }
+
+    unsigned int adaptivePasses = 0;
+    if (!statsPath.empty() && !statsEnabled) {
+        fprintf(stderr, "Counters are compiled out (cmake -DENABLE_STATS=ON), %s only gets frame times\n", statsPath.c_str());
+    }
+
+    // every progressive pass is a frame, the resolve and the denoiser count to the last one
+    Stats& stats = Stats::global();
+    stats.reset();
+    stats.beginFrame();
+    const auto start = std::chrono::high_resolution_clock::now();
+    if (adaptiveError > 0) {
+        RayTracer::AdaptiveSettings settings;
+        settings.threshold = adaptiveError;
+        settings.timeBudget = timeBudget;
+        settings.maxSamples = maxSamples;
+        adaptivePasses = rayTracer.renderAdaptive(settings);
+    } else if (passes > 0) {
+        for (unsigned int pass = 0; pass < passes; ++pass) {
+            rayTracer.renderPass();
+            if (pass + 1 < passes) {
+                stats.endFrame();
+            }
+        }
+        rayTracer.resolve();
+    } else {
+        rayTracer.render();
+    }
+    const auto end = std::chrono::high_resolution_clock::now();
+    const double seconds = std::chrono::duration<double>(end - start).count();
+    double denoiseSeconds = 0;
+    if (denoise) {
+        rayTracer.denoise();
+        denoiseSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - end).count();
+    }
+    stats.endFrame();
+    double samples = double(width) * height * rayTracer.samplesPerAxis * rayTracer.samplesPerAxis;
+    if (adaptiveError > 0 || passes > 0) {
+        samples = 0;
+        for (unsigned int pixel = 0; pixel < width * height; ++pixel) {
+            samples += rayTracer.getFilm().sampleCount(pixel);
+        }
+    }
+
+    if (adaptiveError > 0) {
+        printf("%ux%u, adaptive to error %g, %u passes, %.1f spp on average\n", width, height, adaptiveError, adaptivePasses,
+            samples / (double(width) * height));
+    } else if (passes > 0) {
+        printf("%ux%u, %u progressive passes\n", width, height, passes);
+        printf("time/pass    %.3f ms\n", seconds / passes * 1e3);
+    } else {
+        printf("%ux%u, %u spp, %s integrator\n", width, height, rayTracer.samplesPerAxis * rayTracer.samplesPerAxis, integrator.c_str());
+    }
+    printf("wall time    %.3f s\n", seconds);
+    printf("rays/sec     %.3f M\n", rayTracer.getTracedRays() / seconds / 1e6);
+    printf("samples/sec  %.3f M\n", samples / seconds / 1e6);
+    if (denoise) {
+        printf("denoise      %.3f ms\n", denoiseSeconds * 1e3);
+    }
+    printf("scene memory %.1f KiB\n", rayTracer.getScene().memoryFootprint().total() / 1024.);
+    if (statsEnabled) {
+        const Stats::Values& total = stats.total();
+        const uint64_t rays = total[Counter::CAMERA_RAYS] + total[Counter::SECONDARY_RAYS];
+        const double perRay = 1. / std::max<uint64_t>(rays + total[Counter::SHADOW_RAYS], 1);
+        printf("camera rays  %.3f M, secondary %.3f M, shadow %.3f M\n", total[Counter::CAMERA_RAYS] / 1e6,
+            total[Counter::SECONDARY_RAYS] / 1e6, total[Counter::SHADOW_RAYS] / 1e6);
+        printf("nodes/ray    %.2f\n", total[Counter::BVH_NODES] * perRay);
+        printf("tests/ray    %.2f primitives, %.2f triangles\n", total[Counter::PRIMITIVE_TESTS] * perRay, total[Counter::TRIANGLE_TESTS] * perRay);
+    }
+
+    if (!statsPath.empty() && !stats.write(statsPath)) {
+        fprintf(stderr, "Could not write %s\n", statsPath.c_str());
+        return EXIT_FAILURE;
+    }
+
+    if (!writeImage(output, &pixels[0].r, width, height)) {
+        fprintf(stderr, "Could not write %s\n", output.c_str());
+        return EXIT_FAILURE;
+    }
+    const size_t extensionStart = output.rfind('.');
+    if (!aovPrefix.empty() && !writeFeatures(aovPrefix, extensionStart == std::string::npos ? defaultImageExtension : output.substr(extensionStart), rayTracer.getFeatures())) {
+        fprintf(stderr, "Could not write the feature images %s_*\n", aovPrefix.c_str());
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,150 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+
+// Monotonic allocator: allocations are carved out of large blocks one after the other and are never
+// freed on their own, release() drops every block at once. A block is a single allocation, so an
+// arena that was sized up front with reserve() is torn down with a single free. Pointers stay valid
+// when the arena is moved.
+class MemoryArena {
+public:
+    static constexpr size_t alignment = 64;
+    static constexpr size_t defaultBlockSize = 4096;
+
+    MemoryArena() {}
+    MemoryArena(const MemoryArena&) = delete;
+    MemoryArena& operator=(const MemoryArena&) = delete;
+    MemoryArena(MemoryArena&& other) noexcept {
+        *this = std::move(other);
+    }
+    MemoryArena& operator=(MemoryArena&& other) noexcept {
+        if (this != &other) {
+            release();
+            std::swap(head, other.head);
+            std::swap(used, other.used);
+            std::swap(reserved, other.reserved);
+        }
+        return *this;
+    }
+    ~MemoryArena() {
+        release();
+    }
+
+    // makes sure the next bytes bytes fit into the current block
+    void reserve(size_t bytes) {
+        if (head == nullptr || head->size - head->offset < bytes) {
+            addBlock(bytes);
+        }
+    }
+
+    // uninitialized memory aligned to alignment
+    void* allocate(size_t bytes) {
+        bytes = (bytes + alignment - 1) / alignment * alignment;
+        if (head == nullptr || head->size - head->offset < bytes) {
+            addBlock(std::max(bytes, head == nullptr ? defaultBlockSize : head->size * 2));
+        }
+        void* memory = head->data() + head->offset;
+        head->offset += bytes;
+        used += bytes;
+        return memory;
+    }
+
+    template<typename T>
+    T* allocate(size_t count) {
+        static_assert(std::is_trivially_copyable<T>::value && std::is_trivially_destructible<T>::value,
+            "the arena neither copies with constructors nor runs destructors");
+        return static_cast<T*>(allocate(count * sizeof(T)));
+    }
+
+    void release() {
+        while (head != nullptr) {
+            Block* next = head->next;
+            ::operator delete(head, std::align_val_t(alignment));
+            head = next;
+        }
+        used = 0;
+        reserved = 0;
+    }
+
+    // bytes handed out by allocate, rounded to the alignment
+    size_t bytesUsed() const { return used; }
+    // bytes of all blocks, including the unused end of each
+    size_t bytesReserved() const { return reserved; }
+
+private:
+    struct alignas(alignment) Block {
+        Block* next;
+        size_t size;
+        size_t offset;
+
+        std::byte* data() { return reinterpret_cast<std::byte*>(this + 1); }
+    };
+
+    void addBlock(size_t size) {
+        size = (size + alignment - 1) / alignment * alignment;
+        Block* block = static_cast<Block*>(::operator new(sizeof(Block) + size, std::align_val_t(alignment)));
+        block->next = head;
+        block->size = size;
+        block->offset = 0;
+        head = block;
+        reserved += sizeof(Block) + size;
+    }
+
+    Block* head = nullptr;
+    size_t used = 0;
+    size_t reserved = 0;
+};
+
+// Growable array of trivially copyable values living in a MemoryArena. Growing copies the values to
+// a twice as large allocation and leaves the old one to the arena. The capacity is always a multiple
+// of simdPadding, so vector loads of a last, partly filled group of values stay in bounds.
+template<typename T>
+class ArenaArray {
+public:
+    static constexpr uint32_t simdPadding = 8;
+
+    void push_back(MemoryArena& arena, const T& value) {
+        if (count == capacity) {
+            reserve(arena, std::max(simdPadding, capacity * 2));
+        }
+        values[count++] = value;
+    }
+
+    void reserve(MemoryArena& arena, uint32_t newCapacity) {
+        newCapacity = (newCapacity + simdPadding - 1) / simdPadding * simdPadding;
+        if (newCapacity <= capacity) {
+            return;
+        }
+        T* newValues = arena.allocate<T>(newCapacity);
+        if (count > 0) {
+            std::memcpy(newValues, values, count * sizeof(T));
+        }
+        std::fill(newValues + count, newValues + newCapacity, T());
+        values = newValues;
+        capacity = newCapacity;
+    }
+
+    // forgets the values, the memory belongs to the arena
+    void reset() {
+        values = nullptr;
+        count = 0;
+        capacity = 0;
+    }
+
+    T& operator[](size_t index) { return values[index]; }
+    const T& operator[](size_t index) const { return values[index]; }
+    T* data() { return values; }
+    const T* data() const { return values; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+private:
+    T* values = nullptr;
+    uint32_t count = 0;
+    uint32_t capacity = 0;
+};
@@ -0,0 +1,378 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <limits>
+#include <algorithm>
+#include <cstdint>
+#include "Eigen/Dense"
+#include "Eigen/Geometry"
+#include "cpu_version/threadPool.h"
+#include "cpu_version/stats.h"
+
+using namespace Eigen;
+
+// Node of the flattened BVH. Nodes are stored in depth first order, so the left child of an
+// interior node is always the next node in the array and only the right child has to be stored.
+struct alignas(32) BVHNode {
+    AlignedBox3f bounds;
+    // interior node: index of the right child, leaf: index of the first primitive
+    uint32_t leftFirst;
+    // number of primitives in a leaf, 0 for interior nodes
+    uint32_t count;
+
+    bool isLeaf() const { return count > 0; }
+};
+
+static_assert(sizeof(BVHNode) == 32, "BVHNode should fill half a cache line");
+
+
+// Bounding volume hierarchy built with the binned surface area heuristic. The BVH only knows
+// about primitive bounds, intersecting the primitives themselves is left to the caller.
+class BVH {
+public:
+    static constexpr unsigned int binCount = 16;
+    static constexpr unsigned int maxLeafSize = 4;
+    static constexpr unsigned int maxDepth = 64;
+    static constexpr float traversalCost = 1.f;
+    static constexpr float intersectionCost = 1.f;
+    static constexpr uint32_t noParent = std::numeric_limits<uint32_t>::max();
+
+    void build(const std::vector<AlignedBox3f>& primitiveBounds) {
+        nodes.clear();
+        parents.clear();
+        primitiveIndices.resize(primitiveBounds.size());
+        primitiveLeaves.resize(primitiveBounds.size());
+        interiorArea = 0;
+        leafArea = 0;
+        builtCost = 0;
+        if (primitiveBounds.empty()) {
+            return;
+        }
+
+        centroids.resize(primitiveBounds.size());
+        for (uint32_t index = 0; index < primitiveBounds.size(); ++index) {
+            primitiveIndices[index] = index;
+            centroids[index] = primitiveBounds[index].center();
+        }
+
+        nodes.reserve(2 * primitiveBounds.size());
+        parents.reserve(2 * primitiveBounds.size());
+        buildRecursive(primitiveBounds, 0, (uint32_t)primitiveBounds.size(), 0, noParent);
+        centroids.clear();
+        centroids.shrink_to_fit();
+
+        for (const BVHNode& node : nodes) {
+            addArea(node, 1);
+        }
+        builtCost = sahCost();
+    }
+
+    // Updates the bounds of the leaves holding the changed primitives and of their ancestors, the
+    // rest of the tree is not touched. The tree keeps its topology, so its quality drops as the
+    // primitives move away from where they were at build time, see sahCost() and builtSahCost().
+    // Leaves are refit on the thread pool when there are many of them.
+    void refit(const std::vector<AlignedBox3f>& primitiveBounds, const std::vector<uint32_t>& changedPrimitives, ThreadPool* threadPool = nullptr) {
+        if (nodes.empty()) {
+            return;
+        }
+        marked.resize(nodes.size());
+        dirtyNodes.clear();
+        for (uint32_t primitive : changedPrimitives) {
+            const uint32_t leaf = primitiveLeaves[primitive];
+            if (!marked[leaf]) {
+                marked[leaf] = true;
+                dirtyNodes.push_back(leaf);
+            }
+        }
+        const size_t leafCount = dirtyNodes.size();
+        for (size_t index = 0; index < dirtyNodes.size(); ++index) {
+            const uint32_t parent = parents[dirtyNodes[index]];
+            if (parent != noParent && !marked[parent]) {
+                marked[parent] = true;
+                dirtyNodes.push_back(parent);
+            }
+        }
+
+        for (uint32_t node : dirtyNodes) {
+            addArea(nodes[node], -1);
+        }
+        const auto refitLeaf = [&](uint32_t index) {
+            BVHNode& leaf = nodes[dirtyNodes[index]];
+            AlignedBox3f bounds;
+            for (uint32_t slot = leaf.leftFirst; slot < leaf.leftFirst + leaf.count; ++slot) {
+                bounds.extend(primitiveBounds[primitiveIndices[slot]]);
+            }
+            leaf.bounds = bounds;
+        };
+        if (threadPool != nullptr && leafCount >= parallelRefitLeaves) {
+            threadPool->parallelFor((uint32_t)leafCount, refitLeaf);
+        } else {
+            for (uint32_t index = 0; index < leafCount; ++index) {
+                refitLeaf(index);
+            }
+        }
+
+        // children come after their parent in depth first order, so going through the interior
+        // nodes from the back sees every child before its parent
+        std::sort(dirtyNodes.begin() + leafCount, dirtyNodes.end(), std::greater<uint32_t>());
+        for (size_t index = leafCount; index < dirtyNodes.size(); ++index) {
+            const uint32_t node = dirtyNodes[index];
+            nodes[node].bounds = nodes[node + 1].bounds.merged(nodes[nodes[node].leftFirst].bounds);
+        }
+
+        for (uint32_t node : dirtyNodes) {
+            addArea(nodes[node], 1);
+            marked[node] = false;
+        }
+    }
+
+    bool empty() const {
+        return nodes.empty();
+    }
+
+    void clear() {
+        nodes.clear();
+        parents.clear();
+        primitiveIndices.clear();
+        primitiveLeaves.clear();
+    }
+
+    // hitPrimitive(primitiveIndex, tMax) tests a single primitive, returns true on a hit and
+    // shrinks tMax to the distance of that hit.
+    template<typename HitPrimitive>
+    bool intersect(const Vector3f& origin, const Vector3f& direction, float tMin, float tMax, HitPrimitive&& hitPrimitive) const {
+        return intersectLeaves(origin, direction, tMin, tMax, [&](uint32_t first, uint32_t count, float& tMax) {
+            Stats::count(Counter::PRIMITIVE_TESTS, count);
+            bool hitSomething = false;
+            for (uint32_t index = first; index < first + count; ++index) {
+                hitSomething |= hitPrimitive(primitiveIndices[index], tMax);
+            }
+            return hitSomething;
+        });
+    }
+
+    // hitLeaf(first, count, tMax) tests the primitives at positions [first, first + count) of
+    // primitiveIndices, for callers that keep their primitive data in BVH order.
+    template<typename HitLeaf>
+    bool intersectLeaves(const Vector3f& origin, const Vector3f& direction, float tMin, float tMax, HitLeaf&& hitLeaf) const {
+        return !nodes.empty() && intersectLeaves(nodes.data(), origin, direction, tMin, tMax, hitLeaf);
+    }
+
+    // Same traversal over nodes stored elsewhere, for example in a memory mapped file.
+    template<typename HitLeaf>
+    static bool intersectLeaves(const BVHNode* nodes, const Vector3f& origin, const Vector3f& direction, float tMin, float tMax, HitLeaf&& hitLeaf) {
+
+        const Vector3f inverseDirection = direction.cwiseInverse();
+        // far children with the distance the ray enters them, the closest hit may have moved in
+        // front of it by the time they are popped
+        struct StackEntry {
+            uint32_t node;
+            float tEnter;
+        };
+        std::array<StackEntry, maxDepth> stack;
+        unsigned int stackSize = 0;
+        uint32_t nodeIndex = 0;
+        bool hitSomething = false;
+        uint32_t visited = 0;
+
+        if (intersectBounds(nodes[0].bounds, origin, inverseDirection, tMin, tMax) == std::numeric_limits<float>::infinity()) {
+            return false;
+        }
+
+        while (true) {
+            const BVHNode& node = nodes[nodeIndex];
+            ++visited;
+            if (node.isLeaf()) {
+                hitSomething |= hitLeaf(node.leftFirst, node.count, tMax);
+            } else {
+                uint32_t near = nodeIndex + 1;
+                uint32_t far = node.leftFirst;
+                float tNear = intersectBounds(nodes[near].bounds, origin, inverseDirection, tMin, tMax);
+                float tFar = intersectBounds(nodes[far].bounds, origin, inverseDirection, tMin, tMax);
+                if (tNear > tFar) {
+                    std::swap(near, far);
+                    std::swap(tNear, tFar);
+                }
+                if (tNear < std::numeric_limits<float>::infinity()) {
+                    if (tFar < std::numeric_limits<float>::infinity()) {
+                        stack[stackSize++] = { far, tFar };
+                    }
+                    nodeIndex = near;
+                    continue;
+                }
+            }
+
+            do {
+                if (stackSize == 0) {
+                    Stats::count(Counter::BVH_NODES, visited);
+                    return hitSomething;
+                }
+                --stackSize;
+            } while (stack[stackSize].tEnter >= tMax);
+            nodeIndex = stack[stackSize].node;
+        }
+    }
+
+    // Entry distance of the ray into the box, infinity if the box is missed.
+    static inline float intersectBounds(const AlignedBox3f& box, const Vector3f& origin, const Vector3f& inverseDirection, float tMin, float tMax) {
+        const Array3f t0 = (box.min() - origin).array() * inverseDirection.array();
+        const Array3f t1 = (box.max() - origin).array() * inverseDirection.array();
+        const float tEnter = std::max(t0.min(t1).maxCoeff(), tMin);
+        const float tExit = std::min(t0.max(t1).minCoeff(), tMax);
+        return tEnter <= tExit ? tEnter : std::numeric_limits<float>::infinity();
+    }
+
+    // Expected cost of a ray traversing the tree, relative to the cost of testing one primitive.
+    // The area sums behind it are kept up to date by build and refit.
+    float sahCost() const {
+        if (nodes.empty()) {
+            return 0;
+        }
+        const float rootArea = surfaceArea(nodes[0].bounds);
+        return rootArea > 0 ? float((interiorArea * traversalCost + leafArea * intersectionCost) / rootArea) : 0.f;
+    }
+
+    // sahCost() right after the last build
+    float builtSahCost() const {
+        return builtCost;
+    }
+
+    size_t memoryBytes() const {
+        return nodes.capacity() * sizeof(BVHNode) + (parents.capacity() + primitiveIndices.capacity() + primitiveLeaves.capacity()) * sizeof(uint32_t);
+    }
+
+    static inline float surfaceArea(const AlignedBox3f& box) {
+        if (box.isEmpty()) {
+            return 0;
+        }
+        const Vector3f extent = box.sizes();
+        return 2 * (extent.x() * extent.y() + extent.y() * extent.z() + extent.z() * extent.x());
+    }
+
+    std::vector<BVHNode> nodes;
+    std::vector<uint32_t> primitiveIndices;
+
+private:
+    // below this many changed leaves a refit stays on the calling thread
+    static constexpr size_t parallelRefitLeaves = 1024;
+    struct Bin {
+        AlignedBox3f bounds;
+        uint32_t count = 0;
+    };
+
+    uint32_t buildRecursive(const std::vector<AlignedBox3f>& primitiveBounds, uint32_t first, uint32_t count, unsigned int depth, uint32_t parent) {
+        const uint32_t nodeIndex = (uint32_t)nodes.size();
+        nodes.emplace_back();
+        parents.push_back(parent);
+
+        AlignedBox3f bounds;
+        AlignedBox3f centroidBounds;
+        for (uint32_t index = first; index < first + count; ++index) {
+            bounds.extend(primitiveBounds[primitiveIndices[index]]);
+            centroidBounds.extend(centroids[primitiveIndices[index]]);
+        }
+        nodes[nodeIndex].bounds = bounds;
+
+        const auto makeLeaf = [&]() {
+            nodes[nodeIndex].leftFirst = first;
+            nodes[nodeIndex].count = count;
+            for (uint32_t index = first; index < first + count; ++index) {
+                primitiveLeaves[primitiveIndices[index]] = nodeIndex;
+            }
+            return nodeIndex;
+        };
+
+        if (count <= 1 || depth + 1 >= maxDepth) {
+            return makeLeaf();
+        }
+
+        int bestAxis = -1;
+        unsigned int bestSplit = 0;
+        float bestCost = std::numeric_limits<float>::max();
+        const Vector3f centroidExtent = centroidBounds.sizes();
+
+        for (int axis = 0; axis < 3; ++axis) {
+            if (centroidExtent[axis] <= 0) {
+                continue;
+            }
+            std::array<Bin, binCount> bins;
+            const float scale = binCount / centroidExtent[axis];
+            for (uint32_t index = first; index < first + count; ++index) {
+                const uint32_t primitive = primitiveIndices[index];
+                Bin& bin = bins[binIndex(centroids[primitive][axis], centroidBounds.min()[axis], scale)];
+                bin.bounds.extend(primitiveBounds[primitive]);
+                ++bin.count;
+            }
+
+            // sweep from the right to get the area and count of every right partition
+            std::array<float, binCount - 1> rightArea;
+            std::array<uint32_t, binCount - 1> rightCount;
+            AlignedBox3f rightBounds;
+            uint32_t rightSum = 0;
+            for (unsigned int split = binCount - 1; split > 0; --split) {
+                rightBounds.extend(bins[split].bounds);
+                rightSum += bins[split].count;
+                rightArea[split - 1] = surfaceArea(rightBounds);
+                rightCount[split - 1] = rightSum;
+            }
+
+            AlignedBox3f leftBounds;
+            uint32_t leftSum = 0;
+            for (unsigned int split = 0; split < binCount - 1; ++split) {
+                leftBounds.extend(bins[split].bounds);
+                leftSum += bins[split].count;
+                if (leftSum == 0 || rightCount[split] == 0) {
+                    continue;
+                }
+                const float cost = leftSum * surfaceArea(leftBounds) + rightCount[split] * rightArea[split];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = split;
+                }
+            }
+        }
+
+        const float leafCost = count * intersectionCost;
+        const float splitCost = traversalCost + intersectionCost * bestCost / surfaceArea(bounds);
+        if (bestAxis == -1 || (count <= maxLeafSize && splitCost >= leafCost)) {
+            return makeLeaf();
+        }
+
+        const float scale = binCount / centroidExtent[bestAxis];
+        const float axisMin = centroidBounds.min()[bestAxis];
+        const auto middle = std::partition(primitiveIndices.begin() + first, primitiveIndices.begin() + first + count,
+            [&](uint32_t primitive) { return binIndex(centroids[primitive][bestAxis], axisMin, scale) <= bestSplit; });
+        const uint32_t leftCount = (uint32_t)(middle - (primitiveIndices.begin() + first));
+
+        buildRecursive(primitiveBounds, first, leftCount, depth + 1, nodeIndex);
+        const uint32_t rightChild = buildRecursive(primitiveBounds, first + leftCount, count - leftCount, depth + 1, nodeIndex);
+        nodes[nodeIndex].leftFirst = rightChild;
+        nodes[nodeIndex].count = 0;
+        return nodeIndex;
+    }
+
+    static inline unsigned int binIndex(float centroid, float axisMin, float scale) {
+        const int index = (int)((centroid - axisMin) * scale);
+        return (unsigned int)std::clamp(index, 0, (int)binCount - 1);
+    }
+
+    void addArea(const BVHNode& node, int sign) {
+        if (node.isLeaf()) {
+            leafArea += sign * double(surfaceArea(node.bounds)) * node.count;
+        } else {
+            interiorArea += sign * double(surfaceArea(node.bounds));
+        }
+    }
+
+    std::vector<Vector3f> centroids;
+    std::vector<uint32_t> parents;
+    // leaf node holding each primitive
+    std::vector<uint32_t> primitiveLeaves;
+    std::vector<uint32_t> dirtyNodes;
+    std::vector<char> marked;
+    // surface area sums of the interior nodes and of the leaves weighted by their primitive count
+    double interiorArea = 0;
+    double leafArea = 0;
+    float builtCost = 0;
+};
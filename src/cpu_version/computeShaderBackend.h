@@ -0,0 +1,424 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <cstring>
+#include <cstdint>
+#include "Eigen/Dense"
+#include "utils.h"
+#include "gpu_version/camera.h"
+#include "gpu_version/shape.h"
+#include "gpu_version/shaderBVH.h"
+#include "cpu_version/simd.h"
+#include "cpu_version/threadPool.h"
+#include "cpu_version/stats.h"
+
+using namespace Eigen;
+
+// CPU implementation of RayTracing.glsl followed by PixelConversion.glsl. It takes the shapes,
+// triangles and camera data the way RayTracingComputeShader uploads them and reads them back at the
+// std430 offsets the shader declares, so a scene built for the interactive renderer renders the same
+// here, and a struct that stops matching the shader layout shows up in both renderers.
+// Both walk the same ShaderBVH node buffer. The primitives of every leaf are kept as structure of
+// arrays, so a ray is tested against a whole leaf at once. The shader's sine hash is replaced by RandomStream, the sampling is the same.
+// Unlike the shader the samples are summed as floats instead of 8 bit integers.
+class ComputeShaderBackend {
+public:
+    // invocations of one work group of RayTracing.glsl, each traces one sample of the pixel
+    static constexpr unsigned int workGroupSize = 100;
+    // the depth RayTracing.glsl passes to ray_color
+    static constexpr unsigned int maxDepth = 10;
+
+    // material and shape type codes of RayTracing.glsl
+    static constexpr uint32_t lightMaterial = 0, lambertianMaterial = 1, metalMaterial = 2, debugMaterial = 100;
+    static constexpr uint32_t sphereShape = 0, boxShape = 1;
+
+    // std430 strides and offsets of Shape and Triangle in RayTracing.glsl
+    static constexpr size_t shapeStride = 144, triangleStride = 64;
+    static constexpr size_t shapeType = 64, materialColor = 112, materialType = 124;
+    static constexpr size_t trianglePosition = 0, triangleNormal = 16, triangleBeta = 28, triangleM1 = 32, triangleM2 = 48;
+
+    ComputeShaderBackend(Camera& camera, unsigned int width, unsigned int height, uint64_t seed = 0, unsigned int threads = 0,
+                         bool pin = false)
+        : camera(camera), width(width), height(height), seed(seed), threadPool(threads, pin),
+          accumulated(size_t(width) * height * 3, 0.f) {
+        updateCameraBuffer();
+    }
+
+    void updateCameraBuffer() {
+        std::memcpy(cameraData, camera.data, sizeof(cameraData));
+    }
+
+    // Builds the BVH and decodes the shapes and triangles in its order from their bytes, call it
+    // after changing either.
+    void updateShapeBuffer() {
+        bvh.build(shapes, triangles);
+        const uint32_t shapeCount = uint32_t(bvh.orderedShapes.size());
+        kinds.resize(shapeCount);
+        materialTypes.resize(shapeCount);
+        materialColors.resize(shapeCount);
+        centers.resize(shapeCount);
+        scales.resize(shapeCount);
+        const unsigned char* shapeBytes = reinterpret_cast<const unsigned char*>(bvh.orderedShapes.data());
+        for (uint32_t index = 0; index < shapeCount; ++index) {
+            const unsigned char* shape = shapeBytes + index * shapeStride;
+            // transformation is a column major mat4, the scale is [0][0] and the translation column 3
+            scales[index] = readFloat(shape, 0);
+            centers[index] = readVector(shape, 12 * sizeof(float));
+            kinds[index] = readUInt(shape, shapeType);
+            materialTypes[index] = readUInt(shape, materialType);
+            materialColors[index] = readVector(shape, materialColor);
+        }
+
+        const uint32_t triangleCount = uint32_t(bvh.orderedTriangles.size());
+        triangleNormals.resize(triangleCount);
+        triangleFields.resize(triangleCount);
+        const unsigned char* triangleBytes = reinterpret_cast<const unsigned char*>(bvh.orderedTriangles.data());
+        for (uint32_t index = 0; index < triangleCount; ++index) {
+            const unsigned char* triangle = triangleBytes + index * triangleStride;
+            const Vector3f position = readVector(triangle, trianglePosition);
+            const Vector3f normal = readVector(triangle, triangleNormal);
+            const Vector3f m1 = readVector(triangle, triangleM1);
+            const Vector3f m2 = readVector(triangle, triangleM2);
+            triangleNormals[index] = normal;
+            triangleFields[index] = { position.x(), position.y(), position.z(), normal.x(), normal.y(), normal.z(),
+                                      readFloat(triangle, triangleBeta), m1.x(), m1.y(), m1.z(), m2.x(), m2.y(), m2.z() };
+        }
+
+        shapeLeaves.clear();
+        triangleLeaves.clear();
+        shapeLeafOf.assign(shapeCount, 0);
+        triangleLeafOf.assign(triangleCount, 0);
+        for (uint32_t node = 0; node < bvh.nodeCount(); ++node) {
+            const ShaderBVHNode& leaf = bvh.nodes[node];
+            if (!leaf.isLeaf()) {
+                continue;
+            }
+            if (node < bvh.shapeRoot) {
+                triangleLeafOf[leaf.skipFirst] = addLeaf(triangleLeaves, leaf, [&](uint32_t index) { return triangleFields[index]; });
+            } else {
+                shapeLeafOf[leaf.skipFirst] = addLeaf(shapeLeaves, leaf, [&](uint32_t index) {
+                    const Vector3f& center = centers[index];
+                    return std::array<float, 5>{ center.x(), center.y(), center.z(), scales[index], float(kinds[index]) };
+                });
+            }
+        }
+    }
+
+    // One dispatch of both shaders: workGroupSize samples of every pixel, averaged with the previous
+    // dispatches.
+    void compute() {
+        const Stats::ScopedPhase phase(Phase::RENDER);
+        const uint64_t firstSample = uint64_t(passes) * workGroupSize;
+        threadPool.parallelFor(height, [&](uint32_t y) {
+            const Vector3f upperLeft = cameraVector(8);
+            const Vector3f up = cameraVector(12);
+            const Vector3f right = cameraVector(16);
+            const Vector3f position = cameraVector(0);
+            const float worldStep = cameraData[19];
+            uint64_t rays = 0;
+            for (uint32_t x = 0; x < width; ++x) {
+                // same order as the pixel buffer of the shaders: bottom row first
+                const uint32_t pixel = (height - 1 - y) * width + x;
+                const Vector3f pixelCoordinate = upperLeft + worldStep * float(x) * right - worldStep * float(y) * up;
+                Vector3f sum = Vector3f::Zero();
+                for (unsigned int sample = 0; sample < workGroupSize; ++sample) {
+                    threadRandom = RandomStream(seed, pixel, firstSample + sample);
+                    const float u = threadRandom.nextFloat();
+                    const float v = threadRandom.nextFloat();
+                    const Vector3f origin = pixelCoordinate + worldStep * u * right - worldStep * v * up;
+                    // the shader stores the samples as unsigned integers, negative colors become 0
+                    sum += rayColor(origin, (origin - position).normalized(), rays).cwiseMax(0.f);
+                }
+                accumulated[pixel * 3 + 0] += sum.x();
+                accumulated[pixel * 3 + 1] += sum.y();
+                accumulated[pixel * 3 + 2] += sum.z();
+            }
+            tracedRays += rays;
+        });
+        ++passes;
+    }
+
+    // Linear RGB average of every dispatch so far, 3 floats per pixel in the order of the shader's
+    // pixel buffer.
+    void resolve(float* rgb) const {
+        const Stats::ScopedPhase phase(Phase::RESOLVE);
+        const float scale = passes == 0 ? 0.f : 1.f / (float(passes) * workGroupSize);
+        for (size_t index = 0; index < accumulated.size(); ++index) {
+            rgb[index] = accumulated[index] * scale;
+        }
+    }
+
+    void clear() {
+        std::fill(accumulated.begin(), accumulated.end(), 0.f);
+        passes = 0;
+    }
+
+    uint32_t passCount() const {
+        return passes;
+    }
+
+    uint64_t getTracedRays() const {
+        return tracedRays;
+    }
+
+    const ShaderBVH& getBVH() const {
+        return bvh;
+    }
+
+    std::vector<Shape> shapes;
+    std::vector<SimpleTriangle> triangles;
+
+private:
+    static constexpr unsigned int laneCount = SimdFloat::width;
+
+    static_assert(BVH::maxLeafSize <= laneCount, "every leaf has to fit into one SimdFloat");
+
+    // fields of the primitives of one leaf, lanes without a primitive hold NaN and never hit
+    template<unsigned int fieldCount>
+    struct Lanes {
+        alignas(32) float fields[fieldCount][laneCount];
+        // index of the primitive as float, so it can be blended like the distances
+        alignas(32) float index[laneCount];
+    };
+
+    template<unsigned int fieldCount, typename Fields>
+    static uint32_t addLeaf(std::vector<Lanes<fieldCount>>& leaves, const ShaderBVHNode& leaf, Fields&& primitiveFields) {
+        Lanes<fieldCount>& group = leaves.emplace_back();
+        for (unsigned int field = 0; field < fieldCount; ++field) {
+            std::fill(group.fields[field], group.fields[field] + laneCount, std::numeric_limits<float>::quiet_NaN());
+        }
+        std::fill(group.index, group.index + laneCount, -1.f);
+        for (uint32_t lane = 0; lane < leaf.count; ++lane) {
+            const std::array<float, fieldCount> values = primitiveFields(leaf.skipFirst + lane);
+            for (unsigned int field = 0; field < fieldCount; ++field) {
+                group.fields[field][lane] = values[field];
+            }
+            group.index[lane] = float(leaf.skipFirst + lane);
+        }
+        return uint32_t(leaves.size() - 1);
+    }
+
+    static float readFloat(const unsigned char* bytes, size_t offset) {
+        float value;
+        std::memcpy(&value, bytes + offset, sizeof(value));
+        return value;
+    }
+
+    static uint32_t readUInt(const unsigned char* bytes, size_t offset) {
+        uint32_t value;
+        std::memcpy(&value, bytes + offset, sizeof(value));
+        return value;
+    }
+
+    static Vector3f readVector(const unsigned char* bytes, size_t offset) {
+        return { readFloat(bytes, offset), readFloat(bytes, offset + 4), readFloat(bytes, offset + 8) };
+    }
+
+    Vector3f cameraVector(unsigned int offset) const {
+        return { cameraData[offset], cameraData[offset + 1], cameraData[offset + 2] };
+    }
+
+    static SimdFloat sign(SimdFloat value) {
+        return select(value > SimdFloat(0.f), SimdFloat(1.f), select(value < SimdFloat(0.f), SimdFloat(-1.f), SimdFloat(0.f)));
+    }
+
+    static SimdFloat abs(SimdFloat value) {
+        return max(value, SimdFloat(0.f) - value);
+    }
+
+    // closest distance in each lane and the index of the primitive it belongs to
+    struct LaneHit {
+        SimdFloat t{ std::numeric_limits<float>::infinity() };
+        SimdFloat index{ -1.f };
+
+        // the distance filter of getClosestShapeIndex and getClosestTriangleIndex
+        void update(SimdFloat candidate, SimdFloat candidateIndex) {
+            const SimdMask closer = (candidate < SimdFloat(1000.f)) & (candidate > SimdFloat(0.0001f)) & (candidate < t);
+            t = select(closer, candidate, t);
+            index = select(closer, candidateIndex, index);
+        }
+
+        // the closest lane, on equal distances the lower index like the loops of the shader
+        void reduce(float& distance, int& closest) const {
+            alignas(32) float distances[laneCount];
+            alignas(32) float indices[laneCount];
+            t.store(distances);
+            index.store(indices);
+            for (unsigned int lane = 0; lane < laneCount; ++lane) {
+                if (indices[lane] >= 0 && (distances[lane] < distance || (distances[lane] == distance && int(indices[lane]) < closest))) {
+                    distance = distances[lane];
+                    closest = int(indices[lane]);
+                }
+            }
+        }
+    };
+
+    struct SimdRay {
+        SimdFloat ox, oy, oz, dx, dy, dz;
+
+        SimdRay(const Vector3f& origin, const Vector3f& direction)
+            : ox(origin.x()), oy(origin.y()), oz(origin.z()), dx(direction.x()), dy(direction.y()), dz(direction.z()) {}
+    };
+
+    // hitSphere and hitBox of the shader for the spheres and boxes of one leaf
+    static SimdFloat hitShapes(const Lanes<5>& leaf, const SimdRay& ray) {
+        const SimdFloat inf(std::numeric_limits<float>::infinity());
+        const SimdFloat cx = SimdFloat::load(leaf.fields[0]), cy = SimdFloat::load(leaf.fields[1]), cz = SimdFloat::load(leaf.fields[2]);
+        const SimdFloat scale = SimdFloat::load(leaf.fields[3]);
+
+        const SimdFloat ocx = ray.ox - cx, ocy = ray.oy - cy, ocz = ray.oz - cz;
+        const SimdFloat b = ray.dx * ocx + ray.dy * ocy + ray.dz * ocz;
+        const SimdFloat c = ocx * ocx + ocy * ocy + ocz * ocz - scale * scale;
+        const SimdFloat discriminant = b * b - c;
+        const SimdFloat sphere = select(discriminant < SimdFloat(0.f), inf, SimdFloat(0.f) - b - sqrt(discriminant));
+
+        // in the frame of the box, scaled to a unit cube around the origin
+        const SimdFloat inverseScale = SimdFloat(1.f) / scale;
+        const SimdFloat px = ocx * inverseScale, py = ocy * inverseScale, pz = ocz * inverseScale;
+        const SimdFloat vx = ray.dx * inverseScale, vy = ray.dy * inverseScale, vz = ray.dz * inverseScale;
+        const SimdFloat sx = sign(px), sy = sign(py), sz = sign(pz);
+        const SimdFloat faces[3] = { (SimdFloat(0.5f) - px * sx) / (sx * vx), (SimdFloat(0.5f) - py * sy) / (sy * vy),
+                                     (SimdFloat(0.5f) - pz * sz) / (sz * vz) };
+        SimdFloat box = inf;
+        for (const SimdFloat& t : faces) {
+            const SimdFloat infNorm = max(abs(px + vx * t), max(abs(py + vy * t), abs(pz + vz * t)));
+            const SimdMask onFace = (infNorm < SimdFloat(0.5001f)) & (infNorm > SimdFloat(0.4999f)) & (box > t);
+            box = select(onFace, t, box);
+        }
+        return select(SimdFloat::load(leaf.fields[4]) < SimdFloat(0.5f), sphere, box);
+    }
+
+    // hitTriangle of the shader for the triangles of one leaf
+    static SimdFloat hitTriangles(const Lanes<13>& leaf, const SimdRay& ray) {
+        const SimdFloat ax = SimdFloat::load(leaf.fields[3]), ay = SimdFloat::load(leaf.fields[4]), az = SimdFloat::load(leaf.fields[5]);
+        const SimdFloat k = (SimdFloat::load(leaf.fields[6]) - (ax * ray.ox + ay * ray.oy + az * ray.oz)) / (ax * ray.dx + ay * ray.dy + az * ray.dz);
+        const SimdFloat qx = k * ray.dx + ray.ox - SimdFloat::load(leaf.fields[0]);
+        const SimdFloat qy = k * ray.dy + ray.oy - SimdFloat::load(leaf.fields[1]);
+        const SimdFloat qz = k * ray.dz + ray.oz - SimdFloat::load(leaf.fields[2]);
+        const SimdFloat x = qx * SimdFloat::load(leaf.fields[7]) + qy * SimdFloat::load(leaf.fields[8]) + qz * SimdFloat::load(leaf.fields[9]);
+        const SimdFloat y = qx * SimdFloat::load(leaf.fields[10]) + qy * SimdFloat::load(leaf.fields[11]) + qz * SimdFloat::load(leaf.fields[12]);
+        const SimdMask inside = (k >= SimdFloat(0.f)) & (x > SimdFloat(0.f)) & (y > SimdFloat(0.f)) & (x + y < SimdFloat(1.f));
+        return select(inside, k, SimdFloat(std::numeric_limits<float>::infinity()));
+    }
+
+    // getClosestShapeIndex and getClosestTriangleIndex: the nodes [begin, end) of the BVH, leafOf maps
+    // the first primitive of a leaf to its lanes and leafDistance intersects them
+    template<unsigned int fieldCount, typename LeafDistance>
+    void closestHit(const std::vector<Lanes<fieldCount>>& leaves, const std::vector<uint32_t>& leafOf, uint32_t begin, uint32_t end,
+                    const Vector3f& origin, const Vector3f& direction, float& distance, int& closest, LeafDistance&& leafDistance) const {
+        const SimdRay ray(origin, direction);
+        distance = std::numeric_limits<float>::infinity();
+        closest = -1;
+        ShaderBVH::traverse(bvh.nodes.data(), begin, end, origin, direction, 1000.f, [&](uint32_t first, uint32_t /*count*/, float& tMax) {
+            const Lanes<fieldCount>& leaf = leaves[leafOf[first]];
+            LaneHit hit;
+            hit.update(leafDistance(leaf, ray), SimdFloat::load(leaf.index));
+            hit.reduce(distance, closest);
+            tMax = std::min(tMax, distance);
+        });
+    }
+
+    Vector3f normalAt(uint32_t shape, const Vector3f& point) const {
+        if (kinds[shape] == sphereShape) {
+            return (point - centers[shape]).normalized();
+        }
+        if (kinds[shape] == boxShape) {
+            const Vector3f local = (point - centers[shape]) / scales[shape];
+            const Vector3f face = local.unaryExpr([](float value) { return std::abs(value) >= 0.499f ? (value > 0 ? 1.f : value < 0 ? -1.f : 0.f) : 0.f; });
+            return face.normalized();
+        }
+        return Vector3f::Ones();
+    }
+
+    // randomOnHalfUnitShere: uniform on the hemisphere around normal
+    static Vector3f randomOnHemisphere(const Vector3f& normal) {
+        const float angle = threadRandom.nextFloat() * 2 * float(pi);
+        const float r = threadRandom.nextFloat();
+        const float distance = std::sqrt(1 - r * r);
+        const float x = std::cos(angle) * distance;
+        const float y = std::sin(angle) * distance;
+        Vector3f b1{ -normal[1], normal[0], 0 };
+        if (b1.head<2>().norm() < 0.01f) {
+            b1 = Vector3f{ 0, -normal[2], normal[1] }.normalized();
+        } else {
+            b1.normalize();
+        }
+        const Vector3f b2 = normal.cross(b1);
+        return b1 * x + b2 * y + normal * r;
+    }
+
+    // ray_color and scatter of RayTracing.glsl
+    Vector3f rayColor(Vector3f origin, Vector3f direction, uint64_t& rays) const {
+        Vector3f result = Vector3f::Ones();
+        for (unsigned int depth = 0; depth < maxDepth; ++depth) {
+            ++rays;
+            Stats::countRays(depth);
+            float distance, triangleDistance;
+            int index, triangle;
+            closestHit(shapeLeaves, shapeLeafOf, bvh.shapeRoot, bvh.nodeCount(), origin, direction, distance, index, hitShapes);
+            closestHit(triangleLeaves, triangleLeafOf, 0, bvh.shapeRoot, origin, direction, triangleDistance, triangle, hitTriangles);
+            if (index == -1 && triangle == -1) {
+                return Vector3f::Zero();
+            }
+
+            // triangles have no material in the shader, they are red and diffuse
+            if (triangleDistance < distance) {
+                const Vector3f& a = triangleNormals[triangle];
+                const float facing = -direction.dot(a);
+                const Vector3f normal = a * float(facing > 0 ? 1 : facing < 0 ? -1 : 0);
+                origin = triangleDistance * direction + origin;
+                direction = randomOnHemisphere(normal);
+                result = result.cwiseProduct(Vector3f{ 1, 0, 0 });
+                continue;
+            }
+
+            const uint32_t type = materialTypes[index];
+            const Vector3f& color = materialColors[index];
+            if (type == lightMaterial) {
+                return result.cwiseProduct(color);
+            }
+            origin = distance * direction + origin;
+            if (type == lambertianMaterial) {
+                direction = randomOnHemisphere(normalAt(index, origin));
+                result = result.cwiseProduct(color);
+            } else if (type == metalMaterial) {
+                direction = reflect(direction, normalAt(index, origin)).normalized();
+                result = result.cwiseProduct(color);
+            } else if (type == debugMaterial) {
+                return normalAt(index, origin);
+            } else {
+                return result;
+            }
+        }
+        return Vector3f::Zero();
+    }
+
+    Camera& camera;
+    float cameraData[Camera::dataSize];
+    unsigned int width, height;
+    uint64_t seed;
+    ThreadPool threadPool;
+
+    ShaderBVH bvh;
+    // per shape and triangle in BVH order, decoded from the std430 bytes
+    std::vector<uint32_t> kinds;
+    std::vector<uint32_t> materialTypes;
+    std::vector<Vector3f> materialColors;
+    std::vector<Vector3f> centers;
+    std::vector<float> scales;
+    std::vector<Vector3f> triangleNormals;
+    std::vector<std::array<float, 13>> triangleFields;
+    // center, scale and type of the shapes, position, normal, beta, m1 and m2 of the triangles
+    std::vector<Lanes<5>> shapeLeaves;
+    std::vector<Lanes<13>> triangleLeaves;
+    std::vector<uint32_t> shapeLeafOf;
+    std::vector<uint32_t> triangleLeafOf;
+
+    std::vector<float> accumulated;
+    uint32_t passes = 0;
+    std::atomic<uint64_t> tracedRays{ 0 };
+};
@@ -0,0 +1,266 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include "Eigen/Dense"
+#include "cpu_version/film.h"
+#include "cpu_version/threadPool.h"
+
+using namespace Eigen;
+
+// Edge avoiding a-trous wavelet filter guided by the FeatureBuffers. The color is divided by the
+// albedo first, so material edges survive and only the noisy illumination is smoothed, and is
+// multiplied back at the end. Every iteration applies the 5x5 B3 spline kernel with holes of 2^i
+// pixels and weights each tap by how close its normal, depth, albedo and illumination are to the
+// center pixel, so five iterations reach 61 pixels wide with 25 taps each. Images are kept as float
+// planes and every tap is a branch free loop over a contiguous row, which the compiler vectorizes.
+// Blocks of rows run on the thread pool.
+class Denoiser {
+public:
+    struct Settings {
+        unsigned int iterations = 5;
+        // difference of the square root encoded illumination in units of its local noise
+        float colorSigma = 4.f;
+        // the noise assumed to remain is divided by this after every iteration
+        float noiseFalloff = 4.f;
+        float normalSigma = 0.2f;
+        float albedoSigma = 0.1f;
+        // depth difference relative to the depth of the center pixel, per pixel of tap distance
+        float depthSigma = 0.003f;
+    };
+
+    // rgb holds linear interleaved RGB of the size of the features, it is filtered in place.
+    void denoise(float* rgb, const FeatureBuffers& features, ThreadPool* threadPool = nullptr) {
+        denoise(rgb, features, Settings(), threadPool);
+    }
+
+    void denoise(float* rgb, const FeatureBuffers& features, const Settings& settings, ThreadPool* threadPool = nullptr) {
+        width = features.getWidth();
+        height = features.getHeight();
+        const size_t pixelCount = size_t(width) * height;
+        for (std::vector<float>* plane : { &depth, &depthScale, &colorScale }) {
+            plane->resize(pixelCount);
+        }
+        for (unsigned int channel = 0; channel < 3; ++channel) {
+            for (std::vector<float>* plane : { &color[channel], &filtered[channel], &encoded[channel], &albedo[channel], &normal[channel] }) {
+                plane->resize(pixelCount);
+            }
+        }
+
+        forRows(threadPool, [&](unsigned int firstRow, unsigned int lastRow) {
+            for (size_t pixel = size_t(firstRow) * width; pixel < size_t(lastRow) * width; ++pixel) {
+                const Vector3f pixelAlbedo = features.albedo((unsigned int)pixel);
+                const Vector3f pixelNormal = features.normal((unsigned int)pixel);
+                for (unsigned int channel = 0; channel < 3; ++channel) {
+                    // channels without albedo are filtered as they are
+                    const float demodulate = pixelAlbedo[channel] > minAlbedo ? pixelAlbedo[channel] : 1.f;
+                    albedo[channel][pixel] = demodulate;
+                    color[channel][pixel] = std::max(0.f, rgb[pixel * 3 + channel]) / demodulate;
+                    normal[channel][pixel] = pixelNormal[channel];
+                }
+                depth[pixel] = features.depth((unsigned int)pixel);
+                // misses have depth 0 and only blend with other misses
+                depthScale[pixel] = 1 / (settings.depthSigma * std::max(depth[pixel], 1e-3f));
+            }
+        });
+
+        encode(threadPool);
+        estimateNoise(settings, threadPool);
+        float noiseScale = 1;
+        for (unsigned int iteration = 0; iteration < settings.iterations; ++iteration) {
+            if (iteration > 0) {
+                encode(threadPool);
+            }
+            filterIteration(1u << iteration, noiseScale, settings, threadPool);
+            std::swap(color, filtered);
+            noiseScale *= settings.noiseFalloff;
+        }
+
+        forRows(threadPool, [&](unsigned int firstRow, unsigned int lastRow) {
+            for (size_t pixel = size_t(firstRow) * width; pixel < size_t(lastRow) * width; ++pixel) {
+                for (unsigned int channel = 0; channel < 3; ++channel) {
+                    rgb[pixel * 3 + channel] = color[channel][pixel] * albedo[channel][pixel];
+                }
+            }
+        });
+    }
+
+private:
+    static constexpr float minAlbedo = 1e-3f;
+    // keeps noise free regions from stopping at every rounding difference
+    static constexpr float minVariance = 1e-4f;
+    static constexpr unsigned int rowsPerTask = 8;
+
+    // e^-x for x >= 0 with a relative error below 1e-5, results below e^-60 are flushed to e^-60.
+    // Everything is plain arithmetic on floats and their bits, a float comparison or conversion
+    // would keep the tap loops from vectorizing.
+    static inline float expNegative(float x) {
+        // non negative floats order like their bits
+        int32_t clamped;
+        std::memcpy(&clamped, &x, sizeof(clamped));
+        clamped = std::min(clamped, int32_t(0x42700000));
+        float t;
+        std::memcpy(&t, &clamped, sizeof(t));
+        t *= -1.44269504f;
+
+        // adding 1.5 * 2^23 rounds t to an integer that lands in the low bits of the mantissa
+        const float shifted = t + 12582912.f;
+        int32_t whole;
+        std::memcpy(&whole, &shifted, sizeof(whole));
+        whole -= 0x4B400000;
+        const float f = t - (shifted - 12582912.f);
+        const float power = 1.f + f * (0.693147181f + f * (0.240226507f + f * (0.0555041087f + f * (0.00961812911f + f * 0.00133335581f))));
+        int32_t bits;
+        std::memcpy(&bits, &power, sizeof(bits));
+        bits += whole * (1 << 23);
+        float result;
+        std::memcpy(&result, &bits, sizeof(result));
+        return result;
+    }
+
+    template<typename Task>
+    void forRows(ThreadPool* threadPool, Task&& task) {
+        const uint32_t blocks = (height + rowsPerTask - 1) / rowsPerTask;
+        const auto block = [&](uint32_t index) {
+            task(index * rowsPerTask, std::min(height, (index + 1) * rowsPerTask));
+        };
+        if (threadPool == nullptr) {
+            for (uint32_t index = 0; index < blocks; ++index) {
+                block(index);
+            }
+        } else {
+            threadPool->parallelFor(blocks, block);
+        }
+    }
+
+    void encode(ThreadPool* threadPool) {
+        forRows(threadPool, [&](unsigned int firstRow, unsigned int lastRow) {
+            const size_t first = size_t(firstRow) * width, last = size_t(lastRow) * width;
+            for (unsigned int channel = 0; channel < 3; ++channel) {
+                for (size_t pixel = first; pixel < last; ++pixel) {
+                    encoded[channel][pixel] = std::sqrt(color[channel][pixel]);
+                }
+            }
+        });
+    }
+
+    // Variance of the encoded input over the 3x3 pixels around every pixel, the noise a color
+    // difference is compared with. Noisy regions blur more, clean ones keep their detail.
+    void estimateNoise(const Settings& settings, ThreadPool* threadPool) {
+        const float sigmaSquared = settings.colorSigma * settings.colorSigma;
+        forRows(threadPool, [&](unsigned int firstRow, unsigned int lastRow) {
+            for (unsigned int y = firstRow; y < lastRow; ++y) {
+                for (unsigned int x = 0; x < width; ++x) {
+                    float sum[3] = {}, squaredSum = 0;
+                    unsigned int count = 0;
+                    for (unsigned int sourceY = y > 0 ? y - 1 : 0; sourceY <= std::min(y + 1, height - 1); ++sourceY) {
+                        for (unsigned int sourceX = x > 0 ? x - 1 : 0; sourceX <= std::min(x + 1, width - 1); ++sourceX) {
+                            const size_t source = size_t(sourceY) * width + sourceX;
+                            for (unsigned int channel = 0; channel < 3; ++channel) {
+                                sum[channel] += encoded[channel][source];
+                                squaredSum += encoded[channel][source] * encoded[channel][source];
+                            }
+                            ++count;
+                        }
+                    }
+                    const float variance = std::max(0.f, squaredSum - (sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]) / count) / count;
+                    colorScale[size_t(y) * width + x] = 1 / (sigmaSquared * variance + minVariance);
+                }
+            }
+        });
+    }
+
+    void filterIteration(unsigned int step, float noiseScale, const Settings& settings, ThreadPool* threadPool) {
+        static constexpr float kernel[5] = { 1.f / 16, 1.f / 4, 3.f / 8, 1.f / 4, 1.f / 16 };
+        const float normalWeight = 1 / (settings.normalSigma * settings.normalSigma);
+        const float albedoWeight = 1 / (settings.albedoSigma * settings.albedoSigma);
+
+        forRows(threadPool, [&](unsigned int firstRow, unsigned int lastRow) {
+            for (unsigned int y = firstRow; y < lastRow; ++y) {
+                for (unsigned int spanStart = 0; spanStart < width; spanStart += spanWidth) {
+                    const int spanEnd = int(std::min(width, spanStart + spanWidth));
+                    Span span = {};
+                    for (int tapY = -2; tapY <= 2; ++tapY) {
+                        const int sourceY = int(y) + tapY * int(step);
+                        if (sourceY < 0 || sourceY >= int(height)) {
+                            continue;
+                        }
+                        for (int tapX = -2; tapX <= 2; ++tapX) {
+                            const int offsetX = tapX * int(step);
+                            // taps outside the image are left out, the weights are normalized anyway
+                            const int firstX = std::max(int(spanStart), -offsetX);
+                            const int lastX = std::min(spanEnd, int(width) - offsetX);
+                            const TapWeights weights = { kernel[tapX + 2] * kernel[tapY + 2],
+                                1 / (float(step) * float(std::abs(tapX) + std::abs(tapY)) + 1), noiseScale, normalWeight, albedoWeight };
+                            const ptrdiff_t row = ptrdiff_t(y) * width;
+                            addTap(span, row + spanStart, row + firstX, row + std::max(firstX, lastX),
+                                   ptrdiff_t(sourceY - int(y)) * width + offsetX, weights);
+                        }
+                    }
+                    for (int x = int(spanStart); x < spanEnd; ++x) {
+                        const size_t pixel = size_t(y) * width + x;
+                        const float inverse = 1 / span.weight[x - spanStart];
+                        for (unsigned int channel = 0; channel < 3; ++channel) {
+                            filtered[channel][pixel] = span.sum[channel][x - spanStart] * inverse;
+                        }
+                    }
+                }
+            }
+        });
+    }
+
+    // Sums of a run of pixels of one row, kept apart from the image planes so the compiler sees
+    // that the tap loop only reads those and vectorizes it without runtime alias checks.
+    static constexpr unsigned int spanWidth = 64;
+    struct Span {
+        float weight[spanWidth];
+        float sum[3][spanWidth];
+    };
+
+    struct TapWeights {
+        float kernel;
+        float depth;
+        float noise;
+        float normal;
+        float albedo;
+    };
+
+    // adds the pixels at offset from [first, last) to the span starting at spanStart
+    void addTap(Span& span, ptrdiff_t spanStart, ptrdiff_t first, ptrdiff_t last, ptrdiff_t offset, const TapWeights& weights) const {
+        const float* e0 = encoded[0].data(), * e1 = encoded[1].data(), * e2 = encoded[2].data();
+        const float* n0 = normal[0].data(), * n1 = normal[1].data(), * n2 = normal[2].data();
+        const float* a0 = albedo[0].data(), * a1 = albedo[1].data(), * a2 = albedo[2].data();
+        const float* c0 = color[0].data(), * c1 = color[1].data(), * c2 = color[2].data();
+        const float* d = depth.data(), * scale = depthScale.data(), * colorScales = colorScale.data();
+        const ptrdiff_t count = last - first, start = first - spanStart;
+        float* weightSum = span.weight + start;
+        float* s0 = span.sum[0] + start, * s1 = span.sum[1] + start, * s2 = span.sum[2] + start;
+        for (ptrdiff_t index = 0; index < count; ++index) {
+            const ptrdiff_t p = first + index, q = p + offset;
+            const float colorDistance = (e0[p] - e0[q]) * (e0[p] - e0[q]) + (e1[p] - e1[q]) * (e1[p] - e1[q]) + (e2[p] - e2[q]) * (e2[p] - e2[q]);
+            const float normalDistance = (n0[p] - n0[q]) * (n0[p] - n0[q]) + (n1[p] - n1[q]) * (n1[p] - n1[q]) + (n2[p] - n2[q]) * (n2[p] - n2[q]);
+            const float albedoDistance = (a0[p] - a0[q]) * (a0[p] - a0[q]) + (a1[p] - a1[q]) * (a1[p] - a1[q]) + (a2[p] - a2[q]) * (a2[p] - a2[q]);
+            const float depthDistance = std::abs(d[p] - d[q]) * scale[p] * weights.depth;
+            const float weight = weights.kernel * expNegative(colorDistance * colorScales[p] * weights.noise + normalDistance * weights.normal
+                                                              + albedoDistance * weights.albedo + depthDistance);
+            weightSum[index] += weight;
+            s0[index] += weight * c0[q];
+            s1[index] += weight * c1[q];
+            s2[index] += weight * c2[q];
+        }
+    }
+
+    unsigned int width = 0;
+    unsigned int height = 0;
+    // illumination being filtered and the result of the current iteration
+    std::array<std::vector<float>, 3> color, filtered;
+    // square root of color, compared by the edge stopping function
+    std::array<std::vector<float>, 3> encoded;
+    std::array<std::vector<float>, 3> albedo, normal;
+    // inverse of the squared color sigma times the noise of every pixel
+    std::vector<float> colorScale;
+    std::vector<float> depth, depthScale;
+};
@@ -0,0 +1,219 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <iostream>
+#include "Eigen/Dense"
+
+using namespace Eigen;
+
+// Running sums of the radiance of every pixel together with the number of samples that went into
+// them, so an image can be refined one cheap pass at a time. Pixels use the index layout of the
+// display buffer, bottom row first. Every pixel may only be written by one thread at a time.
+// A second buffer sums only the even numbered samples, the difference between the two averages
+// estimates the remaining noise of a pixel.
+class Film {
+public:
+    Film(unsigned int width = 0, unsigned int height = 0) {
+        resize(width, height);
+    }
+
+    void resize(unsigned int width, unsigned int height) {
+        this->width = width;
+        this->height = height;
+        sums.assign(size_t(width) * height * 3, 0.f);
+        halfSums.assign(size_t(width) * height * 3, 0.f);
+        counts.assign(size_t(width) * height, 0);
+        passes = 0;
+    }
+
+    // drops every sample, needed whenever the camera or the scene changed
+    void clear() {
+        std::fill(sums.begin(), sums.end(), 0.f);
+        std::fill(halfSums.begin(), halfSums.end(), 0.f);
+        std::fill(counts.begin(), counts.end(), 0);
+        passes = 0;
+    }
+
+    void add(unsigned int pixelIndex, const Vector3f& radiance) {
+        float* sum = &sums[size_t(pixelIndex) * 3];
+        sum[0] += radiance.x();
+        sum[1] += radiance.y();
+        sum[2] += radiance.z();
+        if (counts[pixelIndex] % 2 == 0) {
+            float* halfSum = &halfSums[size_t(pixelIndex) * 3];
+            halfSum[0] += radiance.x();
+            halfSum[1] += radiance.y();
+            halfSum[2] += radiance.z();
+        }
+        ++counts[pixelIndex];
+    }
+
+    // Adds count samples whose running sums are sum and halfSum, as another film holds them, to a
+    // pixel. Films rendered apart, for example by the workers of a render farm, merge this way. The
+    // samples continue the numbering of the pixel, so after an odd count the odd samples of the
+    // other film are the ones that go into the half sum and halfDifference() stays valid.
+    void addSamples(unsigned int pixelIndex, const float* sum, const float* halfSum, uint32_t count) {
+        const bool odd = counts[pixelIndex] % 2 != 0;
+        for (unsigned int channel = 0; channel < 3; ++channel) {
+            sums[size_t(pixelIndex) * 3 + channel] += sum[channel];
+            halfSums[size_t(pixelIndex) * 3 + channel] += odd ? sum[channel] - halfSum[channel] : halfSum[channel];
+        }
+        counts[pixelIndex] += count;
+    }
+
+    uint32_t sampleCount(unsigned int pixelIndex) const {
+        return counts[pixelIndex];
+    }
+
+    const float* sum(unsigned int pixelIndex) const {
+        return &sums[size_t(pixelIndex) * 3];
+    }
+
+    const float* halfSum(unsigned int pixelIndex) const {
+        return &halfSums[size_t(pixelIndex) * 3];
+    }
+
+    Vector3f average(unsigned int pixelIndex) const {
+        if (counts[pixelIndex] == 0) {
+            return Vector3f::Zero();
+        }
+        const float* sum = &sums[size_t(pixelIndex) * 3];
+        return Vector3f{ sum[0], sum[1], sum[2] } / float(counts[pixelIndex]);
+    }
+
+    // Sum over the channels of the difference between the average of all samples and the average of
+    // the even samples, a noise estimate for the pixel. Infinite until the pixel has two samples.
+    float halfDifference(unsigned int pixelIndex) const {
+        const uint32_t count = counts[pixelIndex];
+        if (count < 2) {
+            return std::numeric_limits<float>::infinity();
+        }
+        const float* sum = &sums[size_t(pixelIndex) * 3];
+        const float* halfSum = &halfSums[size_t(pixelIndex) * 3];
+        const float halfCount = float((count + 1) / 2);
+        float difference = 0;
+        for (unsigned int channel = 0; channel < 3; ++channel) {
+            difference += std::abs(sum[channel] / count - halfSum[channel] / halfCount);
+        }
+        return difference;
+    }
+
+    // Writes the square root encoded average of every pixel as packed RGB floats, the format of the
+    // renderer's display buffer.
+    void resolve(float* rgb) const {
+        for (size_t pixel = 0; pixel < counts.size(); ++pixel) {
+            const Vector3f color = average((unsigned int)pixel).cwiseMax(0.f).cwiseSqrt();
+            rgb[pixel * 3] = color.x();
+            rgb[pixel * 3 + 1] = color.y();
+            rgb[pixel * 3 + 2] = color.z();
+        }
+    }
+
+    void finishPass() {
+        ++passes;
+    }
+
+    uint32_t passCount() const {
+        return passes;
+    }
+
+    unsigned int getWidth() const { return width; }
+    unsigned int getHeight() const { return height; }
+
+    // The sums and counts as raw bytes, for checkpoints of films of the same size.
+    void write(std::ostream& stream) const {
+        stream.write(reinterpret_cast<const char*>(counts.data()), std::streamsize(counts.size() * sizeof(uint32_t)));
+        stream.write(reinterpret_cast<const char*>(sums.data()), std::streamsize(sums.size() * sizeof(float)));
+        stream.write(reinterpret_cast<const char*>(halfSums.data()), std::streamsize(halfSums.size() * sizeof(float)));
+    }
+
+    bool read(std::istream& stream) {
+        stream.read(reinterpret_cast<char*>(counts.data()), std::streamsize(counts.size() * sizeof(uint32_t)));
+        stream.read(reinterpret_cast<char*>(sums.data()), std::streamsize(sums.size() * sizeof(float)));
+        stream.read(reinterpret_cast<char*>(halfSums.data()), std::streamsize(halfSums.size() * sizeof(float)));
+        return bool(stream);
+    }
+
+private:
+    unsigned int width;
+    unsigned int height;
+    std::vector<float> sums;
+    std::vector<float> halfSums;
+    std::vector<uint32_t> counts;
+    uint32_t passes;
+};
+
+// Auxiliary images of the first hit of every sample, averaged per pixel like the Film: the albedo
+// of the material, the normal and the distance from the camera. Samples that leave the scene count
+// as zero. They guide the Denoiser and are written next to the image on request.
+class FeatureBuffers {
+public:
+    FeatureBuffers(unsigned int width = 0, unsigned int height = 0) {
+        resize(width, height);
+    }
+
+    void resize(unsigned int width, unsigned int height) {
+        this->width = width;
+        this->height = height;
+        albedoSums.assign(size_t(width) * height * 3, 0.f);
+        normalSums.assign(size_t(width) * height * 3, 0.f);
+        depthSums.assign(size_t(width) * height, 0.f);
+        counts.assign(size_t(width) * height, 0);
+    }
+
+    void clear() {
+        std::fill(albedoSums.begin(), albedoSums.end(), 0.f);
+        std::fill(normalSums.begin(), normalSums.end(), 0.f);
+        std::fill(depthSums.begin(), depthSums.end(), 0.f);
+        std::fill(counts.begin(), counts.end(), 0);
+    }
+
+    void add(unsigned int pixelIndex, const Vector3f& albedo, const Vector3f& normal, float depth) {
+        for (unsigned int channel = 0; channel < 3; ++channel) {
+            albedoSums[size_t(pixelIndex) * 3 + channel] += albedo[channel];
+            normalSums[size_t(pixelIndex) * 3 + channel] += normal[channel];
+        }
+        depthSums[pixelIndex] += depth;
+        ++counts[pixelIndex];
+    }
+
+    // a sample that missed the scene
+    void addMiss(unsigned int pixelIndex) {
+        ++counts[pixelIndex];
+    }
+
+    Vector3f albedo(unsigned int pixelIndex) const {
+        return average(albedoSums, pixelIndex);
+    }
+
+    // average of the sample normals, shorter than 1 where the normals of a pixel disagree
+    Vector3f normal(unsigned int pixelIndex) const {
+        return average(normalSums, pixelIndex);
+    }
+
+    float depth(unsigned int pixelIndex) const {
+        return counts[pixelIndex] == 0 ? 0.f : depthSums[pixelIndex] / float(counts[pixelIndex]);
+    }
+
+    unsigned int getWidth() const { return width; }
+    unsigned int getHeight() const { return height; }
+
+private:
+    Vector3f average(const std::vector<float>& sums, unsigned int pixelIndex) const {
+        if (counts[pixelIndex] == 0) {
+            return Vector3f::Zero();
+        }
+        const float* sum = &sums[size_t(pixelIndex) * 3];
+        return Vector3f{ sum[0], sum[1], sum[2] } / float(counts[pixelIndex]);
+    }
+
+    unsigned int width;
+    unsigned int height;
+    std::vector<float> albedoSums;
+    std::vector<float> normalSums;
+    std::vector<float> depthSums;
+    std::vector<uint32_t> counts;
+};
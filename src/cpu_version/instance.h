@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdint>
+#include "Eigen/Dense"
+#include "Eigen/Geometry"
+#include "cpu_version/ray.h"
+#include "cpu_version/mesh.h"
+
+using namespace Eigen;
+
+// Placement of a shared TriangleMesh in the scene. The mesh and its BVH stay in object space and
+// are shared by every instance, the instance only holds the object to world transform, its cached
+// inverse and a material, so memory grows with the unique geometry and not with the copies.
+class MeshInstance {
+public:
+    MeshInstance(uint32_t geometry, const Affine3f& transform, MaterialId material)
+        : geometry(geometry), material(material), toWorld(transform.matrix().topRows<3>()),
+          toObject(transform.inverse(Affine).matrix().topRows<3>()) {}
+
+    // The ray direction is moved to object space without normalizing it, so distances along the
+    // local ray are the distances along the world ray and tMin, tMax and rec.t need no conversion.
+    inline bool hit(const TriangleMesh& mesh, const Ray& ray, float tMin, float tMax, HitRecord& rec) const {
+        Ray local;
+        local.orig = toObject.leftCols<3>() * ray.orig + toObject.col(3);
+        local.dir = toObject.leftCols<3>() * ray.dir;
+        if (!mesh.hit(local, tMin, tMax, rec)) {
+            return false;
+        }
+        rec.p = ray.at(rec.t);
+        // normals go back with the inverse transpose
+        rec.normal = (toObject.leftCols<3>().transpose() * rec.normal).normalized();
+        rec.material = material;
+        return true;
+    }
+
+    // world bounds of the transformed object space bounds of the mesh
+    AlignedBox3f bounds(const TriangleMesh& mesh) const {
+        const AlignedBox3f local = mesh.bounds();
+        AlignedBox3f world;
+        if (local.isEmpty()) {
+            return world;
+        }
+        for (unsigned int corner = 0; corner < 8; ++corner) {
+            const Vector3f point = local.corner(AlignedBox3f::CornerType(corner));
+            world.extend(Vector3f(toWorld.leftCols<3>() * point + toWorld.col(3)));
+        }
+        return world;
+    }
+
+    Affine3f transform() const {
+        Affine3f transform = Affine3f::Identity();
+        transform.matrix().topRows<3>() = toWorld;
+        return transform;
+    }
+
+    uint32_t geometry;
+    MaterialId material;
+
+private:
+    Matrix<float, 3, 4> toWorld;
+    Matrix<float, 3, 4> toObject;
+};
@@ -0,0 +1,107 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include "Eigen/Dense"
+#include "utils.h"
+#include "cpu_version/ray.h"
+#include "cpu_version/material.h"
+#include "cpu_version/primitiveArrays.h"
+
+using namespace Eigen;
+
+// Direction toward a light chosen by SphereLights::sample. distance is the distance to the light
+// surface along the normalized direction, pdf the density over solid angle of choosing it.
+struct LightSample {
+    Vector3f direction;
+    float distance;
+    float pdf;
+    MaterialId material;
+};
+
+// The spheres with a LightSource material, sampled for next event estimation. A light is picked
+// uniformly and then a direction uniformly inside the cone the sphere subtends from the shaded
+// point, so small and distant lights are hit by every sample. Only the sphere indices are kept,
+// positions are read from the scene, so moving a light needs no rebuild.
+class SphereLights {
+public:
+    void build(const SphereArrays& spheres, const MaterialTable& materials) {
+        lights.clear();
+        for (uint32_t index = 0; index < spheres.size(); ++index) {
+            if (materials.type(spheres.material[index]) == MaterialType::LIGHT_SOURCE) {
+                lights.push_back(index);
+            }
+        }
+    }
+
+    bool empty() const { return lights.empty(); }
+    size_t size() const { return lights.size(); }
+
+    // Returns false if the point lies inside the chosen light.
+    bool sample(const SphereArrays& spheres, const Vector3f& point, float u0, float u1, float u2, LightSample& sample) const {
+        const uint32_t sphere = lights[std::min(size_t(u0 * lights.size()), lights.size() - 1)];
+        const Vector3f toCenter = spheres.center(sphere) - point;
+        const float distanceSquared = toCenter.squaredNorm();
+        const float radius = spheres.radius[sphere];
+        if (distanceSquared <= radius * radius) {
+            return false;
+        }
+        const float distance = std::sqrt(distanceSquared);
+        const float oneMinusCosMax = coneSize(radius * radius / distanceSquared);
+
+        const float cosTheta = 1 - u1 * oneMinusCosMax;
+        const float sinTheta = std::sqrt(std::max(0.f, 1 - cosTheta * cosTheta));
+        const float phi = 2 * float(pi) * u2;
+        const Vector3f w = toCenter / distance;
+        const Vector3f u = (std::abs(w.x()) > 0.9f ? Vector3f::UnitY() : Vector3f::UnitX()).cross(w).normalized();
+        const Vector3f v = w.cross(u);
+        sample.direction = (u * (std::cos(phi) * sinTheta) + v * (std::sin(phi) * sinTheta) + w * cosTheta).normalized();
+
+        // nearer root of the ray sphere intersection, a direction at the rim can miss by rounding
+        const float b = sample.direction.dot(toCenter);
+        sample.distance = b - std::sqrt(std::max(0.f, radius * radius - (distanceSquared - b * b)));
+        sample.pdf = coneDensity(oneMinusCosMax) / float(lights.size());
+        sample.material = spheres.material[sphere];
+        return true;
+    }
+
+    // Density with which sample() produces the ray from origin along direction that first hits a
+    // light at distance t, 0 if what it hit is not one of the lights.
+    float pdf(const SphereArrays& spheres, const Vector3f& origin, const Vector3f& direction, float t) const {
+        const float length = direction.norm();
+        const Vector3f unit = direction / length;
+        const float distance = t * length;
+        for (uint32_t sphere : lights) {
+            const Vector3f toCenter = spheres.center(sphere) - origin;
+            const float distanceSquared = toCenter.squaredNorm();
+            const float radius = spheres.radius[sphere];
+            const float b = unit.dot(toCenter);
+            const float discriminant = radius * radius - (distanceSquared - b * b);
+            if (distanceSquared <= radius * radius || discriminant < 0) {
+                continue;
+            }
+            if (std::abs(b - std::sqrt(discriminant) - distance) <= 1e-3f * (1 + distance)) {
+                return coneDensity(coneSize(radius * radius / distanceSquared)) / float(lights.size());
+            }
+        }
+        return 0;
+    }
+
+    // power heuristic with exponent 2
+    static float misWeight(float pdf, float otherPdf) {
+        return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+    }
+
+private:
+    // 1 - cos(theta max) for a sphere covering sinSquared = r^2 / d^2, written so it stays
+    // accurate for tiny cones
+    static float coneSize(float sinSquared) {
+        return sinSquared / (1 + std::sqrt(std::max(0.f, 1 - sinSquared)));
+    }
+
+    static float coneDensity(float oneMinusCosMax) {
+        return 1 / (2 * float(pi) * oneMinusCosMax);
+    }
+
+    std::vector<uint32_t> lights;
+};
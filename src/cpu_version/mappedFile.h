@@ -0,0 +1,93 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read only memory mapping of a whole file. Pages are loaded on first access and shared through the
+// page cache with every other process mapping the same file.
+class MappedFile {
+public:
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() {
+        close();
+    }
+
+    bool open(const std::string& path) {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+            close();
+            return false;
+        }
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        memory = mapping == nullptr ? nullptr : MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (memory == nullptr) {
+            close();
+            return false;
+        }
+        bytes = size_t(fileSize.QuadPart);
+#else
+        const int file = ::open(path.c_str(), O_RDONLY);
+        if (file < 0) {
+            return false;
+        }
+        struct stat status;
+        if (fstat(file, &status) != 0 || status.st_size == 0) {
+            ::close(file);
+            return false;
+        }
+        void* mapped = mmap(nullptr, size_t(status.st_size), PROT_READ, MAP_SHARED, file, 0);
+        // the mapping stays valid after the descriptor is closed
+        ::close(file);
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        memory = mapped;
+        bytes = size_t(status.st_size);
+#endif
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (memory != nullptr) UnmapViewOfFile(memory);
+        if (mapping != nullptr) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (memory != nullptr) munmap(const_cast<void*>(memory), bytes);
+#endif
+        memory = nullptr;
+        bytes = 0;
+    }
+
+    const std::byte* data() const { return static_cast<const std::byte*>(memory); }
+    size_t size() const { return bytes; }
+
+private:
+    const void* memory = nullptr;
+    size_t bytes = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+};
@@ -0,0 +1,132 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include "Eigen/Dense"
+#include "utils.h"
+#include "cpu_version/ray.h"
+
+using namespace Eigen;
+
+// Descriptions of the materials a scene can hold, added to a MaterialTable which returns the
+// MaterialId the primitives refer to.
+
+struct Lambertian {
+    Lambertian(const Vector3f& albedo) : albedo(albedo) {}
+    Vector3f albedo;
+};
+
+struct Metal {
+    Metal(const Vector3f& albedo, float fuzzy = 0) : albedo(albedo), fuzzy(fuzzy) {}
+    Vector3f albedo;
+    float fuzzy;
+};
+
+struct LightSource {
+    LightSource(const Vector3f& lightColor) : lightColor(lightColor) {}
+    Vector3f lightColor;
+};
+
+enum class MaterialType : uint8_t {
+    LAMBERTIAN, METAL, LIGHT_SOURCE
+};
+
+// Every material of a scene as structure of arrays tagged by type. color is the albedo of Lambertian
+// and Metal and the emitted light of LightSource, fuzzy is only used by Metal. Shading switches on
+// the type instead of calling through a vtable, and a few thousand materials take a few pages.
+class MaterialTable {
+public:
+    MaterialId add(const Lambertian& material) {
+        return add(MaterialType::LAMBERTIAN, material.albedo, 0);
+    }
+
+    MaterialId add(const Metal& material) {
+        return add(MaterialType::METAL, material.albedo, material.fuzzy);
+    }
+
+    MaterialId add(const LightSource& material) {
+        return add(MaterialType::LIGHT_SOURCE, material.lightColor, 0);
+    }
+
+    void clear() {
+        types.clear();
+        colorR.clear(); colorG.clear(); colorB.clear();
+        fuzzy.clear();
+    }
+
+    size_t size() const {
+        return types.size();
+    }
+
+    size_t memoryBytes() const {
+        return types.capacity() * sizeof(MaterialType) + 4 * colorR.capacity() * sizeof(float);
+    }
+
+    MaterialType type(MaterialId material) const {
+        return types[material];
+    }
+
+    Vector3f color(MaterialId material) const {
+        return { colorR[material], colorG[material], colorB[material] };
+    }
+
+    // Returns false if the path ends on this hit, the hit then only contributes emit().
+    bool scatter(const Ray& rayIn, const HitRecord& hitRecord, Vector3f& attenuation, Ray& scattered) const {
+        const MaterialId material = hitRecord.material;
+        switch (types[material]) {
+            case MaterialType::LAMBERTIAN:
+                scattered = Ray(hitRecord.p, randomUnitVector(hitRecord.normal));
+                attenuation = 0.6f * color(material);
+                return true;
+            case MaterialType::METAL:
+                scattered.orig = hitRecord.p;
+                scattered.dir = reflect(rayIn.direction(), hitRecord.normal) + fuzzy[material] * randomUnitVector();
+                attenuation = color(material);
+                return scattered.dir.dot(hitRecord.normal) > 0;
+            case MaterialType::LIGHT_SOURCE:
+                return false;
+        }
+        return false;
+    }
+
+    // Lambertian picks directions with a cosine density around the normal and is shaded with
+    // light samples too. Metal reflects into a lobe without a closed form density and is treated
+    // like a mirror, lights are only found by the directions it scatters.
+    bool samplesLights(MaterialId material) const {
+        return types[material] == MaterialType::LAMBERTIAN;
+    }
+
+    // Density over solid angle with which scatter() picks the normalized direction, 0 for materials
+    // that do not sample lights.
+    float scatterPdf(const HitRecord& hitRecord, const Vector3f& direction) const {
+        if (!samplesLights(hitRecord.material)) {
+            return 0;
+        }
+        return std::max(0.f, hitRecord.normal.dot(direction)) / float(pi);
+    }
+
+    // BRDF times the cosine toward the normalized direction, divided by scatterPdf it gives the
+    // attenuation scatter() returns for that direction.
+    Vector3f evaluate(const HitRecord& hitRecord, const Vector3f& direction) const {
+        if (!samplesLights(hitRecord.material)) {
+            return Vector3f::Zero();
+        }
+        return 0.6f * color(hitRecord.material) * (std::max(0.f, hitRecord.normal.dot(direction)) / float(pi));
+    }
+
+    Vector3f emit(MaterialId material) const {
+        return types[material] == MaterialType::LIGHT_SOURCE ? color(material) : Vector3f::Zero();
+    }
+
+private:
+    MaterialId add(MaterialType type, const Vector3f& color, float fuzz) {
+        types.push_back(type);
+        colorR.push_back(color.x()); colorG.push_back(color.y()); colorB.push_back(color.z());
+        fuzzy.push_back(fuzz);
+        return MaterialId(types.size() - 1);
+    }
+
+    std::vector<MaterialType> types;
+    std::vector<float> colorR, colorG, colorB;
+    std::vector<float> fuzzy;
+};
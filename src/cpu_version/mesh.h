@@ -0,0 +1,201 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <memory>
+#include <limits>
+#include <cmath>
+#include "Eigen/Dense"
+#include "SimpleMesh.h"
+#include "cpu_version/ray.h"
+#include "cpu_version/bvh.h"
+
+using namespace Eigen;
+
+// Triangle mesh prepared for ray tracing. Triangles are stored in BVH order as structure of arrays
+// of the first vertex and the two edges, which is all the Moeller-Trumbore test needs, so testing
+// a BVH leaf is a loop over contiguous floats. The arrays and the BVH nodes are either owned by the
+// mesh or borrowed from storage it keeps alive, such as a memory mapped mesh cache.
+class TriangleMesh {
+public:
+    static constexpr unsigned int componentCount = 9;
+    using Components = std::array<const float*, componentCount>;
+
+    TriangleMesh(const SimpleMesh& mesh, MaterialId material) : material(material) {
+        const auto& vertices = mesh.getVertices();
+        const auto& triangles = mesh.getTriangles();
+
+        std::vector<AlignedBox3f> bounds;
+        bounds.reserve(triangles.size());
+        for (const SimpleMesh::Triangle& triangle : triangles) {
+            AlignedBox3f box;
+            box.extend(Vector3f(vertices[triangle.idx0].position.head(3)));
+            box.extend(Vector3f(vertices[triangle.idx1].position.head(3)));
+            box.extend(Vector3f(vertices[triangle.idx2].position.head(3)));
+            bounds.push_back(box);
+        }
+        bvh.build(bounds);
+
+        resize(triangles.size());
+        for (size_t index = 0; index < triangles.size(); ++index) {
+            const SimpleMesh::Triangle& triangle = triangles[bvh.primitiveIndices[index]];
+            const Vector3f p0 = vertices[triangle.idx0].position.head(3);
+            const Vector3f p1 = vertices[triangle.idx1].position.head(3);
+            const Vector3f p2 = vertices[triangle.idx2].position.head(3);
+            setTriangle(index, p0, p1 - p0, p2 - p0);
+        }
+        nodes = bvh.nodes.data();
+        nodeCount = uint32_t(bvh.nodes.size());
+    }
+
+    // Uses triangle arrays in BVH order and their BVH nodes without copying them, storage owns the
+    // memory and is kept alive as long as the mesh.
+    TriangleMesh(const Components& components, size_t triangleCount, const BVHNode* nodes, uint32_t nodeCount,
+                 std::shared_ptr<const void> storage, MaterialId material)
+        : material(material), storage(std::move(storage)), nodes(nodes), nodeCount(nodeCount), count(triangleCount) {
+        setComponents(components);
+    }
+
+    // moving keeps the pointers valid, the vectors move their buffers along
+    TriangleMesh(TriangleMesh&&) = default;
+    TriangleMesh& operator=(TriangleMesh&&) = default;
+    TriangleMesh(const TriangleMesh&) = delete;
+    TriangleMesh& operator=(const TriangleMesh&) = delete;
+
+    inline bool hit(const Ray& ray, float tMin, float tMax, HitRecord& rec) const {
+        uint32_t closest = std::numeric_limits<uint32_t>::max();
+        float distance = tMax;
+        if (nodeCount == 0) {
+            return false;
+        }
+        const bool hitSomething = BVH::intersectLeaves(nodes, ray.orig, ray.dir, tMin, tMax, [&](uint32_t first, uint32_t count, float& tMax) {
+            Stats::count(Counter::TRIANGLE_TESTS, count);
+            if (!hitLeaf(ray, first, count, tMin, tMax, closest)) {
+                return false;
+            }
+            distance = tMax;
+            return true;
+        });
+        if (!hitSomething) {
+            return false;
+        }
+
+        const Vector3f edge1{ e1x[closest], e1y[closest], e1z[closest] };
+        const Vector3f edge2{ e2x[closest], e2y[closest], e2z[closest] };
+        const Vector3f normal = edge1.cross(edge2).normalized();
+        rec.t = distance;
+        rec.p = ray.at(rec.t);
+        // triangles are two sided, the normal always faces the incoming ray
+        rec.normal = normal.dot(ray.dir) < 0 ? normal : -normal;
+        rec.material = material;
+        return true;
+    }
+
+    AlignedBox3f bounds() const {
+        return nodeCount == 0 ? AlignedBox3f() : nodes[0].bounds;
+    }
+
+    size_t triangleCount() const {
+        return count;
+    }
+
+    // v0x, v0y, v0z, e1x, e1y, e1z, e2x, e2y, e2z, each triangleCount() floats in BVH order
+    Components components() const {
+        return { v0x, v0y, v0z, e1x, e1y, e1z, e2x, e2y, e2z };
+    }
+
+    const BVHNode* bvhNodes() const { return nodes; }
+    uint32_t bvhNodeCount() const { return nodeCount; }
+
+    // heap memory owned by the mesh, borrowed storage is not counted
+    size_t memoryBytes() const {
+        return owned.capacity() * sizeof(float) + bvh.memoryBytes();
+    }
+
+    MaterialId material;
+
+private:
+    static constexpr float epsilon = 1e-8f;
+
+    void resize(size_t triangleCount) {
+        count = triangleCount;
+        owned.assign(componentCount * count, 0.f);
+        Components components;
+        for (unsigned int component = 0; component < componentCount; ++component) {
+            components[component] = owned.data() + component * count;
+        }
+        setComponents(components);
+    }
+
+    void setComponents(const Components& components) {
+        v0x = components[0]; v0y = components[1]; v0z = components[2];
+        e1x = components[3]; e1y = components[4]; e1z = components[5];
+        e2x = components[6]; e2y = components[7]; e2z = components[8];
+    }
+
+    void setTriangle(size_t index, const Vector3f& p0, const Vector3f& edge1, const Vector3f& edge2) {
+        float* data = owned.data();
+        const float values[componentCount] = { p0.x(), p0.y(), p0.z(), edge1.x(), edge1.y(), edge1.z(), edge2.x(), edge2.y(), edge2.z() };
+        for (unsigned int component = 0; component < componentCount; ++component) {
+            data[component * count + index] = values[component];
+        }
+    }
+
+    // Moeller-Trumbore for every triangle of the leaf, in chunks of leafChunk triangles. The first
+    // loop only writes the distance of every triangle, infinity for misses, and has no dependency
+    // between iterations, so the compiler can vectorize it over the structure of arrays. The
+    // closest hit is picked from the distances in a second loop.
+    inline bool hitLeaf(const Ray& ray, uint32_t first, uint32_t count, float tMin, float& tMax, uint32_t& closest) const {
+        const float ox = ray.orig.x(), oy = ray.orig.y(), oz = ray.orig.z();
+        const float dx = ray.dir.x(), dy = ray.dir.y(), dz = ray.dir.z();
+        const float limit = tMax;
+        bool hitSomething = false;
+        for (uint32_t chunk = first; chunk < first + count; chunk += leafChunk) {
+            const uint32_t chunkSize = std::min(leafChunk, first + count - chunk);
+            float distances[leafChunk];
+            for (uint32_t lane = 0; lane < chunkSize; ++lane) {
+                const uint32_t index = chunk + lane;
+                const float px = dy * e2z[index] - dz * e2y[index];
+                const float py = dz * e2x[index] - dx * e2z[index];
+                const float pz = dx * e2y[index] - dy * e2x[index];
+                const float determinant = e1x[index] * px + e1y[index] * py + e1z[index] * pz;
+                const float inverseDeterminant = 1.f / determinant;
+
+                const float tx = ox - v0x[index], ty = oy - v0y[index], tz = oz - v0z[index];
+                const float u = (tx * px + ty * py + tz * pz) * inverseDeterminant;
+
+                const float qx = ty * e1z[index] - tz * e1y[index];
+                const float qy = tz * e1x[index] - tx * e1z[index];
+                const float qz = tx * e1y[index] - ty * e1x[index];
+                const float v = (dx * qx + dy * qy + dz * qz) * inverseDeterminant;
+                const float t = (e2x[index] * qx + e2y[index] * qy + e2z[index] * qz) * inverseDeterminant;
+
+                // & instead of && keeps the loop free of branches
+                const bool valid = (std::abs(determinant) > epsilon) & (u >= 0) & (v >= 0) & (u + v <= 1) & (t > tMin) & (t < limit);
+                distances[lane] = valid ? t : std::numeric_limits<float>::infinity();
+            }
+            for (uint32_t lane = 0; lane < chunkSize; ++lane) {
+                if (distances[lane] < tMax) {
+                    tMax = distances[lane];
+                    closest = chunk + lane;
+                    hitSomething = true;
+                }
+            }
+        }
+        return hitSomething;
+    }
+
+    static constexpr uint32_t leafChunk = 8;
+
+    // storage of meshes built from a SimpleMesh, empty for borrowed meshes
+    std::vector<float> owned;
+    BVH bvh;
+    std::shared_ptr<const void> storage;
+
+    const BVHNode* nodes = nullptr;
+    uint32_t nodeCount = 0;
+    size_t count = 0;
+    const float* v0x, * v0y, * v0z;
+    const float* e1x, * e1y, * e1z;
+    const float* e2x, * e2y, * e2z;
+};
@@ -0,0 +1,312 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <filesystem>
+#include "Eigen/Dense"
+#include "SimpleMesh.h"
+#include "cpu_version/ray.h"
+#include "cpu_version/bvh.h"
+#include "cpu_version/mesh.h"
+#include "cpu_version/mappedFile.h"
+#include "cpu_version/meshLoader.h"
+#include "cpu_version/meshProcessing.h"
+
+using namespace Eigen;
+
+// Binary mesh file written once and then mapped instead of parsed. After the header follow the
+// sections, each starting at a multiple of sectionAlignment:
+//   positions  vertexCount x 3 floats
+//   indices    triangleCount x 3 uint32
+//   normals    vertexCount x 3 floats, only with hasNormals
+//   nodes      nodeCount BVHNodes, only with hasBVH
+//   triangles  9 x triangleCount floats of TriangleMesh::components() in BVH order, only with hasBVH
+// With the BVH sections a TriangleMesh reads straight from the mapping, nothing is copied or built.
+// Values are stored in the byte order of the writer, the header records it so a foreign file is
+// rejected instead of misread.
+struct MeshCacheHeader {
+    static constexpr char magicValue[8] = { 'R', 'T', 'M', 'E', 'S', 'H', 0, 0 };
+    static constexpr uint32_t currentVersion = 1;
+    static constexpr uint32_t byteOrderValue = 0x01020304;
+    static constexpr uint32_t hasNormals = 1;
+    static constexpr uint32_t hasBVH = 2;
+    static constexpr uint64_t sectionAlignment = 64;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t flags;
+    uint32_t nodeSize;
+    uint64_t vertexCount;
+    uint64_t triangleCount;
+    uint64_t nodeCount;
+    uint64_t positionsOffset;
+    uint64_t indicesOffset;
+    uint64_t normalsOffset;
+    uint64_t nodesOffset;
+    uint64_t trianglesOffset;
+    uint64_t fileSize;
+};
+
+// Writes mesh as a mesh cache, the BVH is built here so loading the file needs no preprocessing.
+inline bool writeMeshCache(const std::string& path, const SimpleMesh& mesh, bool withNormals = true, bool withBVH = true) {
+    const auto& vertices = mesh.getVertices();
+    const auto& triangles = mesh.getTriangles();
+    const auto align = [](uint64_t offset) {
+        return (offset + MeshCacheHeader::sectionAlignment - 1) / MeshCacheHeader::sectionAlignment * MeshCacheHeader::sectionAlignment;
+    };
+
+    std::unique_ptr<TriangleMesh> prepared;
+    if (withBVH) {
+        prepared = std::make_unique<TriangleMesh>(mesh, MaterialId(0));
+    }
+
+    MeshCacheHeader header = {};
+    std::memcpy(header.magic, MeshCacheHeader::magicValue, sizeof(header.magic));
+    header.version = MeshCacheHeader::currentVersion;
+    header.byteOrder = MeshCacheHeader::byteOrderValue;
+    header.flags = (withNormals ? MeshCacheHeader::hasNormals : 0) | (withBVH ? MeshCacheHeader::hasBVH : 0);
+    header.nodeSize = sizeof(BVHNode);
+    header.vertexCount = vertices.size();
+    header.triangleCount = triangles.size();
+    header.nodeCount = withBVH ? prepared->bvhNodeCount() : 0;
+    header.positionsOffset = align(sizeof(MeshCacheHeader));
+    header.indicesOffset = align(header.positionsOffset + header.vertexCount * 3 * sizeof(float));
+    uint64_t end = header.indicesOffset + header.triangleCount * 3 * sizeof(uint32_t);
+    if (withNormals) {
+        header.normalsOffset = align(end);
+        end = header.normalsOffset + header.vertexCount * 3 * sizeof(float);
+    }
+    if (withBVH) {
+        header.nodesOffset = align(end);
+        header.trianglesOffset = align(header.nodesOffset + header.nodeCount * sizeof(BVHNode));
+        end = header.trianglesOffset + TriangleMesh::componentCount * header.triangleCount * sizeof(float);
+    }
+    header.fileSize = end;
+
+    // written to a temporary file first, so a reader never maps a half written cache
+    const std::string temporaryPath = path + ".tmp";
+    std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        return false;
+    }
+    uint64_t position = 0;
+    const auto write = [&](uint64_t offset, const void* data, size_t bytes) {
+        static const char zeros[MeshCacheHeader::sectionAlignment] = {};
+        file.write(zeros, std::streamsize(offset - position));
+        file.write(static_cast<const char*>(data), std::streamsize(bytes));
+        position = offset + bytes;
+    };
+
+    write(0, &header, sizeof(header));
+    std::vector<float> values(vertices.size() * 3);
+    for (size_t vertex = 0; vertex < vertices.size(); ++vertex) {
+        std::memcpy(&values[vertex * 3], vertices[vertex].position.data(), 3 * sizeof(float));
+    }
+    write(header.positionsOffset, values.data(), values.size() * sizeof(float));
+    std::vector<uint32_t> indices(triangles.size() * 3);
+    for (size_t triangle = 0; triangle < triangles.size(); ++triangle) {
+        indices[triangle * 3] = triangles[triangle].idx0;
+        indices[triangle * 3 + 1] = triangles[triangle].idx1;
+        indices[triangle * 3 + 2] = triangles[triangle].idx2;
+    }
+    write(header.indicesOffset, indices.data(), indices.size() * sizeof(uint32_t));
+    if (withNormals) {
+        for (size_t vertex = 0; vertex < vertices.size(); ++vertex) {
+            std::memcpy(&values[vertex * 3], vertices[vertex].normal.data(), 3 * sizeof(float));
+        }
+        write(header.normalsOffset, values.data(), values.size() * sizeof(float));
+    }
+    if (withBVH) {
+        write(header.nodesOffset, prepared->bvhNodes(), header.nodeCount * sizeof(BVHNode));
+        const TriangleMesh::Components components = prepared->components();
+        for (unsigned int component = 0; component < TriangleMesh::componentCount; ++component) {
+            const uint64_t offset = header.trianglesOffset + component * header.triangleCount * sizeof(float);
+            write(offset, components[component], header.triangleCount * sizeof(float));
+        }
+    }
+    file.close();
+    if (!file) {
+        std::remove(temporaryPath.c_str());
+        return false;
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, path, error);
+    return !error;
+}
+
+// A mapped mesh cache. Accessors point into the mapping, meshes handed out by triangleMesh() keep
+// the mapping alive on their own, so the MeshCache itself may be dropped after loading.
+class MeshCache {
+public:
+    // Maps the file and checks it with valid(), returns false for missing, foreign, truncated or
+    // damaged files.
+    bool open(const std::string& path) {
+        auto mapping = std::make_shared<MappedFile>();
+        if (!mapping->open(path)) {
+            return false;
+        }
+        const uint64_t size = mapping->size();
+        return open(std::move(mapping), 0, size);
+    }
+
+    // A cache embedded at offset in a larger mapped file, as a compiled scene holds them. The
+    // offset has to keep the sections aligned.
+    bool open(std::shared_ptr<MappedFile> mapping, uint64_t offset, uint64_t size) {
+        if (offset % MeshCacheHeader::sectionAlignment != 0 || offset > mapping->size() || size > mapping->size() - offset
+            || size < sizeof(MeshCacheHeader)) {
+            return false;
+        }
+        const MeshCacheHeader* candidate = reinterpret_cast<const MeshCacheHeader*>(mapping->data() + offset);
+        if (!valid(*candidate, size)) {
+            return false;
+        }
+        file = std::move(mapping);
+        header = candidate;
+        return true;
+    }
+
+    bool isOpen() const { return file != nullptr; }
+    size_t vertexCount() const { return size_t(header->vertexCount); }
+    size_t triangleCount() const { return size_t(header->triangleCount); }
+    bool hasNormals() const { return (header->flags & MeshCacheHeader::hasNormals) != 0; }
+    bool hasBVH() const { return (header->flags & MeshCacheHeader::hasBVH) != 0; }
+    size_t fileSize() const { return size_t(header->fileSize); }
+    // the whole cache as it is stored, header included
+    const std::byte* data() const { return reinterpret_cast<const std::byte*>(header); }
+
+    // xyz per vertex
+    const float* positions() const { return section<float>(header->positionsOffset); }
+    // three vertex indices per triangle
+    const uint32_t* indices() const { return section<uint32_t>(header->indicesOffset); }
+    // xyz per vertex, nullptr without normals
+    const float* normals() const { return hasNormals() ? section<float>(header->normalsOffset) : nullptr; }
+
+    // The mesh ready for tracing. With a stored BVH the triangles and nodes are used in place,
+    // otherwise the mesh is built from the positions and indices.
+    TriangleMesh triangleMesh(MaterialId material) const {
+        if (!hasBVH()) {
+            return TriangleMesh(toSimpleMesh(), material);
+        }
+        TriangleMesh::Components components;
+        const float* triangles = section<float>(header->trianglesOffset);
+        for (unsigned int component = 0; component < TriangleMesh::componentCount; ++component) {
+            components[component] = triangles + component * triangleCount();
+        }
+        return TriangleMesh(components, triangleCount(), section<BVHNode>(header->nodesOffset), uint32_t(header->nodeCount), file, material);
+    }
+
+    // copies the mesh back into a SimpleMesh, for code that edits meshes
+    SimpleMesh toSimpleMesh() const {
+        SimpleMesh mesh;
+        auto& vertices = mesh.getVertices();
+        auto& triangles = mesh.getTriangles();
+        vertices.resize(vertexCount());
+        triangles.resize(triangleCount());
+        const float* position = positions();
+        const float* normal = normals();
+        for (size_t vertex = 0; vertex < vertices.size(); ++vertex) {
+            vertices[vertex].position = { position[vertex * 3], position[vertex * 3 + 1], position[vertex * 3 + 2], 1.f };
+            vertices[vertex].color = { 0, 0, 0, 1 };
+            vertices[vertex].normal = normal == nullptr ? Vector3f::Zero() : Vector3f{ normal[vertex * 3], normal[vertex * 3 + 1], normal[vertex * 3 + 2] };
+        }
+        const uint32_t* index = indices();
+        for (size_t triangle = 0; triangle < triangles.size(); ++triangle) {
+            triangles[triangle] = SimpleMesh::Triangle(index[triangle * 3], index[triangle * 3 + 1], index[triangle * 3 + 2]);
+        }
+        return mesh;
+    }
+
+    // Opens cachePath if it is a valid cache at least as new as sourcePath, otherwise imports the
+    // OFF or OBJ source, prepares it with MeshProcessor::preprocess, writes the cache and maps that.
+    bool openOrCreate(const std::string& sourcePath, const std::string& cachePath, ThreadPool* threadPool = nullptr) {
+        std::error_code error;
+        const auto sourceTime = std::filesystem::last_write_time(sourcePath, error);
+        const bool sourceExists = !error;
+        const auto cacheTime = std::filesystem::last_write_time(cachePath, error);
+        if (!error && (!sourceExists || cacheTime >= sourceTime) && open(cachePath)) {
+            return true;
+        }
+        SimpleMesh mesh;
+        if (!sourceExists || !MeshLoader::load(sourcePath, mesh, threadPool)) {
+            return false;
+        }
+        MeshProcessor::preprocess(mesh, threadPool);
+        if (!writeMeshCache(cachePath, mesh)) {
+            return false;
+        }
+        return open(cachePath);
+    }
+
+private:
+    // Checks the header, that every section fits into the file and that the indices and BVH nodes
+    // stay inside their sections, so a damaged cache is rejected instead of read out of bounds.
+    static bool valid(const MeshCacheHeader& header, size_t fileSize) {
+        if (std::memcmp(header.magic, MeshCacheHeader::magicValue, sizeof(header.magic)) != 0
+            || header.version != MeshCacheHeader::currentVersion || header.byteOrder != MeshCacheHeader::byteOrderValue
+            || header.nodeSize != sizeof(BVHNode) || header.fileSize != fileSize) {
+            return false;
+        }
+        // the size of an element covers all its components, so no count is multiplied
+        const auto fits = [&](uint64_t offset, uint64_t count, uint64_t elementSize) {
+            return offset % MeshCacheHeader::sectionAlignment == 0 && offset <= fileSize
+                && count <= (fileSize - offset) / elementSize;
+        };
+        if (!fits(header.positionsOffset, header.vertexCount, 3 * sizeof(float))
+            || !fits(header.indicesOffset, header.triangleCount, 3 * sizeof(uint32_t))
+            || header.triangleCount > std::numeric_limits<uint32_t>::max()) {
+            return false;
+        }
+        if ((header.flags & MeshCacheHeader::hasNormals) && !fits(header.normalsOffset, header.vertexCount, 3 * sizeof(float))) {
+            return false;
+        }
+        if ((header.flags & MeshCacheHeader::hasBVH)
+            && (header.nodeCount > std::numeric_limits<uint32_t>::max()
+                || !fits(header.nodesOffset, header.nodeCount, sizeof(BVHNode))
+                || !fits(header.trianglesOffset, header.triangleCount, TriangleMesh::componentCount * sizeof(float)))) {
+            return false;
+        }
+
+        const std::byte* data = reinterpret_cast<const std::byte*>(&header);
+        const uint32_t* indices = reinterpret_cast<const uint32_t*>(data + header.indicesOffset);
+        for (uint64_t index = 0; index < header.triangleCount * 3; ++index) {
+            if (indices[index] >= header.vertexCount) {
+                return false;
+            }
+        }
+        if (header.flags & MeshCacheHeader::hasBVH) {
+            // Children come after their parent, which also rules out cycles, and no node may lie
+            // deeper than the traversal stack of BVH::intersectLeaves() reaches.
+            const BVHNode* nodes = reinterpret_cast<const BVHNode*>(data + header.nodesOffset);
+            std::vector<uint8_t> depth(size_t(header.nodeCount), 0);
+            for (uint64_t node = 0; node < header.nodeCount; ++node) {
+                if (nodes[node].isLeaf()) {
+                    if (uint64_t(nodes[node].leftFirst) + nodes[node].count > header.triangleCount) {
+                        return false;
+                    }
+                    continue;
+                }
+                const uint64_t right = nodes[node].leftFirst;
+                if (node + 1 >= header.nodeCount || right <= node || right >= header.nodeCount || depth[node] + 1 >= BVH::maxDepth) {
+                    return false;
+                }
+                depth[node + 1] = std::max<uint8_t>(depth[node + 1], depth[node] + 1);
+                depth[right] = std::max<uint8_t>(depth[right], depth[node] + 1);
+            }
+        }
+        return true;
+    }
+
+    template<typename T>
+    const T* section(uint64_t offset) const {
+        return reinterpret_cast<const T*>(data() + offset);
+    }
+
+    std::shared_ptr<MappedFile> file;
+    const MeshCacheHeader* header = nullptr;
+};
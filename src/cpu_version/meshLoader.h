@@ -0,0 +1,397 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <charconv>
+#include <algorithm>
+#include <limits>
+#include <cctype>
+#include "Eigen/Dense"
+#include "SimpleMesh.h"
+#include "cpu_version/threadPool.h"
+#include "cpu_version/mappedFile.h"
+
+using namespace Eigen;
+
+// Native OFF and OBJ importers. The file is mapped and cut into chunks at line starts, each chunk is
+// parsed by one task with std::from_chars. A counting pass sizes the vertex and triangle arrays of
+// the SimpleMesh exactly and the parsing pass writes every element straight to its slot, so
+// nothing is allocated per element. Every vertex and face has to be on a line of its own, which is
+// how every common exporter writes them. Polygons with more than three corners become triangle
+// fans. Without a thread pool the chunks are parsed one after the other.
+class MeshLoader {
+public:
+    static constexpr size_t chunkBytes = size_t(1) << 20;
+
+    static bool loadOff(const std::string& path, SimpleMesh& mesh, ThreadPool* threadPool = nullptr) {
+        MappedFile file;
+        if (!file.open(path)) {
+            return false;
+        }
+        const char* p = reinterpret_cast<const char*>(file.data());
+        const char* end = p + file.size();
+
+        // [C][N]OFF, then the vertex, face and edge counts, possibly on the same line
+        skipBlank(p, end);
+        const char* keyword = p;
+        while (p < end && !isSpace(*p)) ++p;
+        const std::string format(keyword, p);
+        if (format != "OFF" && format != "COFF" && format != "NOFF" && format != "CNOFF") {
+            return false;
+        }
+        const bool hasNormals = format.find('N') != std::string::npos;
+        const bool hasColors = format.front() == 'C';
+        uint64_t counts[3];
+        for (uint64_t& count : counts) {
+            skipBlank(p, end);
+            if (!parseNumber(p, end, count)) {
+                return false;
+            }
+        }
+        const uint64_t vertexCount = counts[0], faceCount = counts[1];
+        skipLine(p, end);
+
+        const std::vector<const char*> chunks = split(p, end, threadPool);
+        const uint32_t chunkCount = uint32_t(chunks.size() - 1);
+
+        // the element of a line only follows from the number of data lines before it
+        std::vector<uint64_t> firstLine(chunkCount + 1, 0);
+        run(threadPool, chunkCount, [&](uint32_t chunk) {
+            forEachLine(chunks[chunk], chunks[chunk + 1], [&](const char*, const char*) { ++firstLine[chunk + 1]; });
+        });
+        prefixSum(firstLine);
+        if (firstLine.back() < vertexCount + faceCount) {
+            return false;
+        }
+
+        auto& vertices = mesh.getVertices();
+        auto& triangles = mesh.getTriangles();
+        vertices.resize(vertexCount);
+        std::atomic<bool> failed{ false };
+        std::vector<uint64_t> firstTriangle(chunkCount + 1, 0);
+        run(threadPool, chunkCount, [&](uint32_t chunk) {
+            uint64_t line = firstLine[chunk];
+            forEachLine(chunks[chunk], chunks[chunk + 1], [&](const char* begin, const char* lineEnd) {
+                bool valid = true;
+                if (line < vertexCount) {
+                    SimpleMesh::Vertex& vertex = vertices[line];
+                    valid = parseFloats(begin, lineEnd, vertex.position.data(), 3);
+                    vertex.position.w() = 1.f;
+                    vertex.normal.setZero();
+                    if (valid && hasNormals) {
+                        valid = parseFloats(begin, lineEnd, vertex.normal.data(), 3);
+                    }
+                    // colors are given as integers, an alpha that is left out defaults to opaque
+                    vertex.color = { 0, 0, 0, 255 };
+                    if (valid && hasColors) {
+                        valid = parseFloats(begin, lineEnd, vertex.color.data(), 3);
+                        parseFloats(begin, lineEnd, vertex.color.data() + 3, 1);
+                    }
+                    vertex.color /= 255;
+                } else if (line < vertexCount + faceCount) {
+                    uint64_t corners = 0;
+                    valid = parseNumber(begin, lineEnd, corners) && corners >= 3 && corners <= uint64_t(lineEnd - begin);
+                    firstTriangle[chunk + 1] += valid ? corners - 2 : 0;
+                }
+                if (!valid) {
+                    failed = true;
+                }
+                ++line;
+            });
+        });
+        prefixSum(firstTriangle);
+        if (failed) {
+            return false;
+        }
+
+        triangles.resize(firstTriangle.back());
+        run(threadPool, chunkCount, [&](uint32_t chunk) {
+            if (firstLine[chunk + 1] <= vertexCount) {
+                return;
+            }
+            uint64_t line = firstLine[chunk];
+            uint64_t triangle = firstTriangle[chunk];
+            forEachLine(chunks[chunk], chunks[chunk + 1], [&](const char* begin, const char* lineEnd) {
+                if (line >= vertexCount && line < vertexCount + faceCount) {
+                    uint64_t corners = 0, first = 0, previous = 0, current = 0;
+                    parseNumber(begin, lineEnd, corners);
+                    bool valid = parseNumber(begin, lineEnd, first) && parseNumber(begin, lineEnd, previous)
+                        && first < vertexCount && previous < vertexCount;
+                    // every slot counted for the face is written, even after an error
+                    for (uint64_t corner = 2; corner < corners; ++corner) {
+                        valid = valid && parseNumber(begin, lineEnd, current) && current < vertexCount;
+                        triangles[triangle++] = valid ? SimpleMesh::Triangle(unsigned(first), unsigned(previous), unsigned(current)) : SimpleMesh::Triangle();
+                        previous = current;
+                    }
+                    if (!valid) {
+                        failed = true;
+                    }
+                }
+                ++line;
+            });
+        });
+        return !failed;
+    }
+
+    // Reads v, vn and f records, everything else is skipped. Face corners may be v, v/t, v//n or
+    // v/t/n with negative indices counting back from the last vertex. Normals are per corner in OBJ
+    // and per vertex in SimpleMesh, a vertex gets the normal of the last corner referring to it.
+    static bool loadObj(const std::string& path, SimpleMesh& mesh, ThreadPool* threadPool = nullptr) {
+        MappedFile file;
+        if (!file.open(path)) {
+            return false;
+        }
+        const char* begin = reinterpret_cast<const char*>(file.data());
+        const std::vector<const char*> chunks = split(begin, begin + file.size(), threadPool);
+        const uint32_t chunkCount = uint32_t(chunks.size() - 1);
+
+        std::vector<uint64_t> firstVertex(chunkCount + 1, 0);
+        std::vector<uint64_t> firstNormal(chunkCount + 1, 0);
+        std::vector<uint64_t> firstTriangle(chunkCount + 1, 0);
+        run(threadPool, chunkCount, [&](uint32_t chunk) {
+            forEachLine(chunks[chunk], chunks[chunk + 1], [&](const char* p, const char* lineEnd) {
+                switch (record(p, lineEnd)) {
+                    case Record::VERTEX: ++firstVertex[chunk + 1]; break;
+                    case Record::NORMAL: ++firstNormal[chunk + 1]; break;
+                    case Record::FACE: {
+                        uint64_t corners = 0;
+                        while (skipSpaces(p, lineEnd), p < lineEnd) {
+                            while (p < lineEnd && !isSpace(*p)) ++p;
+                            ++corners;
+                        }
+                        firstTriangle[chunk + 1] += corners >= 3 ? corners - 2 : 0;
+                        break;
+                    }
+                    case Record::OTHER: break;
+                }
+            });
+        });
+        prefixSum(firstVertex);
+        prefixSum(firstNormal);
+        prefixSum(firstTriangle);
+        const uint64_t vertexCount = firstVertex.back();
+        const uint64_t normalCount = firstNormal.back();
+
+        auto& vertices = mesh.getVertices();
+        auto& triangles = mesh.getTriangles();
+        vertices.resize(vertexCount);
+        triangles.resize(firstTriangle.back());
+        std::vector<Vector3f> normals(normalCount);
+        // normal index of every triangle corner, noNormal where the face gave none
+        std::vector<uint32_t> cornerNormals(normalCount > 0 ? 3 * triangles.size() : 0);
+        std::atomic<bool> failed{ false };
+        run(threadPool, chunkCount, [&](uint32_t chunk) {
+            uint64_t vertex = firstVertex[chunk];
+            uint64_t normal = firstNormal[chunk];
+            uint64_t triangle = firstTriangle[chunk];
+            forEachLine(chunks[chunk], chunks[chunk + 1], [&](const char* p, const char* lineEnd) {
+                bool valid = true;
+                switch (record(p, lineEnd)) {
+                    case Record::VERTEX: {
+                        SimpleMesh::Vertex& target = vertices[vertex++];
+                        valid = parseFloats(p, lineEnd, target.position.data(), 3);
+                        target.position.w() = 1.f;
+                        target.normal.setZero();
+                        // some exporters append a color to the position
+                        target.color = { 0, 0, 0, 1 };
+                        parseFloats(p, lineEnd, target.color.data(), 3);
+                        break;
+                    }
+                    case Record::NORMAL:
+                        valid = parseFloats(p, lineEnd, normals[normal++].data(), 3);
+                        break;
+                    case Record::FACE: {
+                        uint32_t firstCorner[2], previous[2], current[2];
+                        uint64_t corners = 0;
+                        while (valid && (skipSpaces(p, lineEnd), p < lineEnd)) {
+                            valid = parseCorner(p, lineEnd, vertex, normal, vertexCount, normalCount, current);
+                            if (corners == 0) {
+                                std::copy(current, current + 2, firstCorner);
+                            } else if (corners >= 2) {
+                                triangles[triangle] = SimpleMesh::Triangle(firstCorner[0], previous[0], current[0]);
+                                if (!cornerNormals.empty()) {
+                                    cornerNormals[3 * triangle] = firstCorner[1];
+                                    cornerNormals[3 * triangle + 1] = previous[1];
+                                    cornerNormals[3 * triangle + 2] = current[1];
+                                }
+                                ++triangle;
+                            }
+                            std::copy(current, current + 2, previous);
+                            ++corners;
+                        }
+                        valid = valid && corners >= 3;
+                        break;
+                    }
+                    case Record::OTHER: break;
+                }
+                if (!valid) {
+                    failed = true;
+                }
+            });
+        });
+        if (failed) {
+            return false;
+        }
+
+        for (size_t corner = 0; corner < cornerNormals.size(); ++corner) {
+            if (cornerNormals[corner] != noNormal) {
+                const SimpleMesh::Triangle& triangle = triangles[corner / 3];
+                const unsigned int index = corner % 3 == 0 ? triangle.idx0 : corner % 3 == 1 ? triangle.idx1 : triangle.idx2;
+                vertices[index].normal = normals[cornerNormals[corner]];
+            }
+        }
+        return true;
+    }
+
+    // loadObj for .obj files, loadOff for everything else
+    static bool load(const std::string& path, SimpleMesh& mesh, ThreadPool* threadPool = nullptr) {
+        std::string extension = path.substr(std::min(path.size(), path.find_last_of('.')));
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return char(std::tolower((unsigned char)c)); });
+        return extension == ".obj" ? loadObj(path, mesh, threadPool) : loadOff(path, mesh, threadPool);
+    }
+
+private:
+    static constexpr uint32_t noNormal = std::numeric_limits<uint32_t>::max();
+
+    enum class Record { VERTEX, NORMAL, FACE, OTHER };
+
+    static bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+    }
+
+    // spaces within a line
+    static void skipSpaces(const char*& p, const char* end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+    }
+
+    static void skipLine(const char*& p, const char* end) {
+        const void* newline = std::memchr(p, '\n', size_t(end - p));
+        p = newline == nullptr ? end : static_cast<const char*>(newline) + 1;
+    }
+
+    // whitespace, line breaks and # comments
+    static void skipBlank(const char*& p, const char* end) {
+        while (p < end) {
+            if (isSpace(*p)) {
+                ++p;
+            } else if (*p == '#') {
+                skipLine(p, end);
+            } else {
+                return;
+            }
+        }
+    }
+
+    template<typename T>
+    static bool parseNumber(const char*& p, const char* end, T& value) {
+        skipSpaces(p, end);
+        if (p < end && *p == '+') ++p;
+        const std::from_chars_result result = std::from_chars(p, end, value);
+        if (result.ec != std::errc()) {
+            return false;
+        }
+        p = result.ptr;
+        return true;
+    }
+
+    static bool parseFloats(const char*& p, const char* end, float* values, unsigned int count) {
+        for (unsigned int index = 0; index < count; ++index) {
+            if (!parseNumber(p, end, values[index])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Calls function(begin, end) for every line holding data, blank lines and # comments are left out.
+    template<typename Function>
+    static void forEachLine(const char* p, const char* end, Function&& function) {
+        while (p < end) {
+            const void* newline = std::memchr(p, '\n', size_t(end - p));
+            const char* lineEnd = newline == nullptr ? end : static_cast<const char*>(newline);
+            skipSpaces(p, lineEnd);
+            if (p < lineEnd && *p != '#') {
+                function(p, lineEnd);
+            }
+            p = lineEnd + 1;
+        }
+    }
+
+    // Chunk boundaries at line starts, chunk i is [chunks[i], chunks[i + 1]). A few chunks per
+    // worker so the work stealing evens out chunks of different density.
+    static std::vector<const char*> split(const char* begin, const char* end, ThreadPool* threadPool) {
+        const size_t bytes = size_t(end - begin);
+        const size_t workers = threadPool == nullptr ? 1 : threadPool->size();
+        const size_t chunkCount = std::max<size_t>(1, std::min(bytes / chunkBytes, 4 * workers));
+        std::vector<const char*> chunks{ begin };
+        for (size_t chunk = 1; chunk < chunkCount; ++chunk) {
+            const char* p = std::max(begin + bytes * chunk / chunkCount, chunks.back());
+            skipLine(p, end);
+            chunks.push_back(p);
+        }
+        chunks.push_back(end);
+        return chunks;
+    }
+
+    template<typename Task>
+    static void run(ThreadPool* threadPool, uint32_t count, Task&& task) {
+        if (threadPool != nullptr && count > 1) {
+            threadPool->parallelFor(count, task);
+        } else {
+            for (uint32_t index = 0; index < count; ++index) {
+                task(index);
+            }
+        }
+    }
+
+    // turns per chunk counts stored at index + 1 into the first element of every chunk
+    static void prefixSum(std::vector<uint64_t>& values) {
+        for (size_t index = 1; index < values.size(); ++index) {
+            values[index] += values[index - 1];
+        }
+    }
+
+    // reads the keyword of an OBJ line and leaves p behind it
+    static Record record(const char*& p, const char* end) {
+        const char* keyword = p;
+        while (p < end && !isSpace(*p)) ++p;
+        const size_t length = size_t(p - keyword);
+        if (length == 1 && keyword[0] == 'v') return Record::VERTEX;
+        if (length == 1 && keyword[0] == 'f') return Record::FACE;
+        if (length == 2 && keyword[0] == 'v' && keyword[1] == 'n') return Record::NORMAL;
+        return Record::OTHER;
+    }
+
+    // One face corner, writes the zero based vertex and normal index. Relative indices count back
+    // from the vertices and normals read so far.
+    static bool parseCorner(const char*& p, const char* end, uint64_t vertices, uint64_t normals,
+                            uint64_t vertexCount, uint64_t normalCount, uint32_t corner[2]) {
+        const auto resolve = [](int64_t index, uint64_t readSoFar, uint64_t count, uint32_t& result) {
+            const int64_t resolved = index > 0 ? index - 1 : int64_t(readSoFar) + index;
+            if (index == 0 || resolved < 0 || uint64_t(resolved) >= count) {
+                return false;
+            }
+            result = uint32_t(resolved);
+            return true;
+        };
+        int64_t index = 0;
+        if (!parseNumber(p, end, index) || !resolve(index, vertices, vertexCount, corner[0])) {
+            return false;
+        }
+        corner[1] = noNormal;
+        if (p < end && *p == '/') {
+            ++p;
+            // the texture coordinate is skipped, SimpleMesh has none
+            while (p < end && *p != '/' && !isSpace(*p)) ++p;
+            if (p < end && *p == '/') {
+                ++p;
+                if (!parseNumber(p, end, index) || !resolve(index, normals, normalCount, corner[1])) {
+                    return false;
+                }
+            }
+        }
+        return p == end || isSpace(*p);
+    }
+};
@@ -0,0 +1,247 @@
+#pragma once
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+#include <array>
+#include <vector>
+#include <numeric>
+#include <utility>
+#include <algorithm>
+#include "Eigen/Dense"
+#include "SimpleMesh.h"
+#include "cpu_version/threadPool.h"
+
+using namespace Eigen;
+
+// Preparation of imported meshes: welding duplicate vertices, smooth vertex normals and ordering
+// vertices and triangles along a Morton curve, so that neighbours in space are neighbours in
+// memory. Every step splits its loops into blocks run on the thread pool when one is given.
+class MeshProcessor {
+public:
+    // Merges vertices whose positions fall into the same cell of a grid with the given spacing,
+    // 0 only merges exact duplicates. The first vertex of a group is kept with its color and normal.
+    // Triangles that collapse to a line or a point are dropped. Returns the number of removed
+    // vertices.
+    static size_t weldVertices(SimpleMesh& mesh, float tolerance = 0, ThreadPool* threadPool = nullptr) {
+        auto& vertices = mesh.getVertices();
+        auto& triangles = mesh.getTriangles();
+        const size_t vertexCount = vertices.size();
+
+        // grid cell or exact position of every vertex together with the vertex, sorting brings
+        // equal keys next to each other and keeps ties in the original order
+        using Key = std::pair<std::array<int64_t, 3>, uint32_t>;
+        std::vector<Key> keys(vertexCount);
+        forBlocks(threadPool, vertexCount, [&](size_t first, size_t last) {
+            for (size_t vertex = first; vertex < last; ++vertex) {
+                for (unsigned int axis = 0; axis < 3; ++axis) {
+                    // + 0.f turns -0 into 0, so both compare equal bit for bit
+                    const float value = vertices[vertex].position[axis] + 0.f;
+                    int32_t bits;
+                    std::memcpy(&bits, &value, sizeof(bits));
+                    keys[vertex].first[axis] = tolerance > 0 ? int64_t(std::floor(double(value) / tolerance)) : int64_t(bits);
+                }
+                keys[vertex].second = uint32_t(vertex);
+            }
+        });
+        sort(threadPool, keys);
+
+        std::vector<uint32_t> remap(vertexCount);
+        for (size_t index = 0; index < vertexCount; ++index) {
+            const bool newGroup = index == 0 || keys[index].first != keys[index - 1].first;
+            remap[keys[index].second] = newGroup ? keys[index].second : remap[keys[index - 1].second];
+        }
+        keys = std::vector<Key>();
+        // the kept vertices stay in file order
+        std::vector<uint32_t> newIndex(vertexCount);
+        uint32_t kept = 0;
+        for (size_t vertex = 0; vertex < vertexCount; ++vertex) {
+            if (remap[vertex] == vertex) {
+                newIndex[vertex] = kept;
+                vertices[kept++] = vertices[vertex];
+            }
+        }
+        vertices.resize(kept);
+
+        forBlocks(threadPool, triangles.size(), [&](size_t first, size_t last) {
+            for (size_t triangle = first; triangle < last; ++triangle) {
+                SimpleMesh::Triangle& t = triangles[triangle];
+                t = SimpleMesh::Triangle(newIndex[remap[t.idx0]], newIndex[remap[t.idx1]], newIndex[remap[t.idx2]]);
+            }
+        });
+        triangles.erase(std::remove_if(triangles.begin(), triangles.end(), [](const SimpleMesh::Triangle& t) {
+            return t.idx0 == t.idx1 || t.idx1 == t.idx2 || t.idx2 == t.idx0;
+        }), triangles.end());
+        return vertexCount - kept;
+    }
+
+    // Area weighted average of the normals of the triangles around every vertex. Vertices that no
+    // triangle uses get a zero normal.
+    static void computeNormals(SimpleMesh& mesh, ThreadPool* threadPool = nullptr) {
+        auto& vertices = mesh.getVertices();
+        const auto& triangles = mesh.getTriangles();
+
+        // the cross product of the edges is twice the area times the normal
+        std::vector<Vector3f> faceNormals(triangles.size());
+        forBlocks(threadPool, triangles.size(), [&](size_t first, size_t last) {
+            for (size_t triangle = first; triangle < last; ++triangle) {
+                const SimpleMesh::Triangle& t = triangles[triangle];
+                const Vector3f p0 = vertices[t.idx0].position.head(3);
+                const Vector3f p1 = vertices[t.idx1].position.head(3);
+                const Vector3f p2 = vertices[t.idx2].position.head(3);
+                faceNormals[triangle] = (p1 - p0).cross(p2 - p0);
+            }
+        });
+
+        // triangles of every vertex as compressed rows, so each vertex is summed by one task and
+        // no two tasks write to the same normal
+        std::vector<uint32_t> firstCorner(vertices.size() + 1, 0);
+        for (const SimpleMesh::Triangle& t : triangles) {
+            ++firstCorner[t.idx0 + 1]; ++firstCorner[t.idx1 + 1]; ++firstCorner[t.idx2 + 1];
+        }
+        std::partial_sum(firstCorner.begin(), firstCorner.end(), firstCorner.begin());
+        std::vector<uint32_t> cornerTriangles(firstCorner.back());
+        std::vector<uint32_t> filled(firstCorner.begin(), firstCorner.end() - 1);
+        for (uint32_t triangle = 0; triangle < triangles.size(); ++triangle) {
+            const SimpleMesh::Triangle& t = triangles[triangle];
+            cornerTriangles[filled[t.idx0]++] = triangle;
+            cornerTriangles[filled[t.idx1]++] = triangle;
+            cornerTriangles[filled[t.idx2]++] = triangle;
+        }
+
+        forBlocks(threadPool, vertices.size(), [&](size_t first, size_t last) {
+            for (size_t vertex = first; vertex < last; ++vertex) {
+                Vector3f normal = Vector3f::Zero();
+                for (uint32_t corner = firstCorner[vertex]; corner < firstCorner[vertex + 1]; ++corner) {
+                    normal += faceNormals[cornerTriangles[corner]];
+                }
+                const float length = normal.norm();
+                vertices[vertex].normal = length > 0 ? Vector3f(normal / length) : Vector3f::Zero();
+            }
+        });
+    }
+
+    // Sorts the vertices by the Morton code of their position and the triangles by the code of
+    // their centroid within the bounds of the mesh.
+    static void reorderForLocality(SimpleMesh& mesh, ThreadPool* threadPool = nullptr) {
+        auto& vertices = mesh.getVertices();
+        auto& triangles = mesh.getTriangles();
+        if (vertices.empty()) {
+            return;
+        }
+        AlignedBox3f bounds;
+        for (const SimpleMesh::Vertex& vertex : vertices) {
+            bounds.extend(Vector3f(vertex.position.head(3)));
+        }
+        const Vector3f scale = bounds.sizes().cwiseMax(1e-30f).cwiseInverse() * float(mortonCells - 1);
+        const auto code = [&](const Vector3f& point) {
+            const Vector3f cell = (point - bounds.min()).cwiseProduct(scale).cwiseMax(0.f).cwiseMin(float(mortonCells - 1));
+            return mortonCode(uint32_t(cell.x()), uint32_t(cell.y()), uint32_t(cell.z()));
+        };
+
+        // code and index, ties keep the original order
+        std::vector<std::pair<uint64_t, uint32_t>> order(vertices.size());
+        forBlocks(threadPool, vertices.size(), [&](size_t first, size_t last) {
+            for (size_t vertex = first; vertex < last; ++vertex) {
+                order[vertex] = { code(vertices[vertex].position.head(3)), uint32_t(vertex) };
+            }
+        });
+        sort(threadPool, order);
+
+        std::vector<uint32_t> newIndex(vertices.size());
+        std::vector<SimpleMesh::Vertex> sortedVertices(vertices.size());
+        forBlocks(threadPool, vertices.size(), [&](size_t first, size_t last) {
+            for (size_t index = first; index < last; ++index) {
+                newIndex[order[index].second] = uint32_t(index);
+                sortedVertices[index] = vertices[order[index].second];
+            }
+        });
+        vertices.swap(sortedVertices);
+
+        order.resize(triangles.size());
+        forBlocks(threadPool, triangles.size(), [&](size_t first, size_t last) {
+            for (size_t triangle = first; triangle < last; ++triangle) {
+                SimpleMesh::Triangle& t = triangles[triangle];
+                t = SimpleMesh::Triangle(newIndex[t.idx0], newIndex[t.idx1], newIndex[t.idx2]);
+                const Vector3f centroid = (vertices[t.idx0].position + vertices[t.idx1].position + vertices[t.idx2].position).head(3) / 3.f;
+                order[triangle] = { code(centroid), uint32_t(triangle) };
+            }
+        });
+        sort(threadPool, order);
+        std::vector<SimpleMesh::Triangle> sortedTriangles(triangles.size());
+        forBlocks(threadPool, triangles.size(), [&](size_t first, size_t last) {
+            for (size_t index = first; index < last; ++index) {
+                sortedTriangles[index] = triangles[order[index].second];
+            }
+        });
+        triangles.swap(sortedTriangles);
+    }
+
+    // Welds exact duplicates, computes normals if the mesh came without any and reorders it.
+    static void preprocess(SimpleMesh& mesh, ThreadPool* threadPool = nullptr) {
+        weldVertices(mesh, 0, threadPool);
+        const auto& vertices = mesh.getVertices();
+        const bool hasNormals = std::any_of(vertices.begin(), vertices.end(), [](const SimpleMesh::Vertex& vertex) {
+            return !vertex.normal.isZero();
+        });
+        if (!hasNormals) {
+            computeNormals(mesh, threadPool);
+        }
+        reorderForLocality(mesh, threadPool);
+    }
+
+    // 21 bits per axis
+    static uint64_t mortonCode(uint32_t x, uint32_t y, uint32_t z) {
+        const auto spread = [](uint64_t value) {
+            value &= 0x1FFFFF;
+            value = (value | (value << 32)) & 0x001F00000000FFFFull;
+            value = (value | (value << 16)) & 0x001F0000FF0000FFull;
+            value = (value | (value << 8)) & 0x100F00F00F00F00Full;
+            value = (value | (value << 4)) & 0x10C30C30C30C30C3ull;
+            value = (value | (value << 2)) & 0x1249249249249249ull;
+            return value;
+        };
+        return spread(x) | (spread(y) << 1) | (spread(z) << 2);
+    }
+
+private:
+    static constexpr uint32_t mortonCells = 1u << 21;
+    static constexpr size_t minBlockSize = 1 << 14;
+
+    // task(first, last) over [0, count) in blocks, a few per worker
+    template<typename Task>
+    static void forBlocks(ThreadPool* threadPool, size_t count, Task&& task) {
+        const size_t blocks = threadPool == nullptr ? 1 : std::max<size_t>(1, std::min(count / minBlockSize, size_t(4) * threadPool->size()));
+        if (blocks == 1) {
+            task(size_t(0), count);
+            return;
+        }
+        threadPool->parallelFor(uint32_t(blocks), [&](uint32_t block) {
+            task(count * block / blocks, count * (block + 1) / blocks);
+        });
+    }
+
+    // sorts one block per worker, then merges neighbouring blocks pairwise
+    template<typename T>
+    static void sort(ThreadPool* threadPool, std::vector<T>& values) {
+        const size_t workers = threadPool == nullptr ? 1 : threadPool->size();
+        const size_t blocks = std::max<size_t>(1, std::min(values.size() / minBlockSize, workers));
+        if (blocks == 1) {
+            std::sort(values.begin(), values.end());
+            return;
+        }
+        const auto boundary = [&](size_t block) {
+            return values.begin() + std::min(values.size(), values.size() * block / blocks);
+        };
+        threadPool->parallelFor(uint32_t(blocks), [&](uint32_t block) {
+            std::sort(boundary(block), boundary(block + 1));
+        });
+        for (size_t width = 1; width < blocks; width *= 2) {
+            const size_t merges = (blocks + 2 * width - 1) / (2 * width);
+            threadPool->parallelFor(uint32_t(merges), [&](uint32_t merge) {
+                const size_t first = merge * 2 * width;
+                const size_t middle = std::min(blocks, first + width), last = std::min(blocks, first + 2 * width);
+                std::inplace_merge(boundary(first), boundary(middle), boundary(last));
+            });
+        }
+    }
+};
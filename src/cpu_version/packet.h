@@ -0,0 +1,147 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <limits>
+#include <cstdint>
+#include <bitset>
+#include "Eigen/Dense"
+#include "cpu_version/simd.h"
+#include "cpu_version/ray.h"
+#include "cpu_version/bvh.h"
+#include "cpu_version/primitiveArrays.h"
+
+using namespace Eigen;
+
+// Up to SimdFloat::width rays stored as structure of arrays, so one vector instruction works on the
+// same component of every ray. Lanes that are not set are inactive and never report hits.
+struct RayPacket {
+    static constexpr unsigned int width = SimdFloat::width;
+
+    alignas(32) float originX[width];
+    alignas(32) float originY[width];
+    alignas(32) float originZ[width];
+    alignas(32) float directionX[width];
+    alignas(32) float directionY[width];
+    alignas(32) float directionZ[width];
+    unsigned int activeLanes = 0;
+
+    void set(unsigned int lane, const Ray& ray) {
+        originX[lane] = ray.orig.x(); originY[lane] = ray.orig.y(); originZ[lane] = ray.orig.z();
+        directionX[lane] = ray.dir.x(); directionY[lane] = ray.dir.y(); directionZ[lane] = ray.dir.z();
+        activeLanes |= 1u << lane;
+    }
+
+    // fills the unused lanes with copies of lane 0 so every lane holds valid numbers
+    void pad() {
+        for (unsigned int lane = 0; lane < width; ++lane) {
+            if (!(activeLanes & (1u << lane))) {
+                originX[lane] = originX[0]; originY[lane] = originY[0]; originZ[lane] = originZ[0];
+                directionX[lane] = directionX[0]; directionY[lane] = directionY[0]; directionZ[lane] = directionZ[0];
+            }
+        }
+    }
+
+    Ray ray(unsigned int lane) const {
+        Ray ray;
+        ray.orig = { originX[lane], originY[lane], originZ[lane] };
+        ray.dir = { directionX[lane], directionY[lane], directionZ[lane] };
+        return ray;
+    }
+
+    bool active(unsigned int lane) const {
+        return activeLanes & (1u << lane);
+    }
+
+    unsigned int activeCount() const {
+        return (unsigned int)std::bitset<width>(activeLanes).count();
+    }
+};
+
+struct PacketVectors {
+    SimdFloat originX, originY, originZ;
+    SimdFloat directionX, directionY, directionZ;
+
+    explicit PacketVectors(const RayPacket& packet)
+        : originX(SimdFloat::load(packet.originX)), originY(SimdFloat::load(packet.originY)), originZ(SimdFloat::load(packet.originZ)),
+          directionX(SimdFloat::load(packet.directionX)), directionY(SimdFloat::load(packet.directionY)), directionZ(SimdFloat::load(packet.directionZ)) {}
+};
+
+// Same test as Sphere::hit for every lane of the packet. Returns the lanes that hit the sphere
+// in (tMin, tMax) and moves tMax of those lanes to the hit.
+inline SimdMask hitSpherePacket(const PacketVectors& rays, const SphereArrays& spheres, uint32_t index, SimdFloat tMin, SimdFloat& tMax) {
+    const SimdFloat ocX = rays.originX - SimdFloat(spheres.centerX[index]);
+    const SimdFloat ocY = rays.originY - SimdFloat(spheres.centerY[index]);
+    const SimdFloat ocZ = rays.originZ - SimdFloat(spheres.centerZ[index]);
+    const SimdFloat b = ocX * rays.directionX + ocY * rays.directionY + ocZ * rays.directionZ;
+    const SimdFloat c = ocX * ocX + ocY * ocY + ocZ * ocZ - SimdFloat(spheres.radius[index] * spheres.radius[index]);
+    const SimdFloat discriminant = b * b - c;
+    const SimdFloat t = SimdFloat(0.f) - b - sqrt(max(discriminant, SimdFloat(0.f)));
+    const SimdMask hit = (discriminant >= SimdFloat(0.f)) & (t > tMin) & (t < tMax);
+    tMax = select(hit, t, tMax);
+    return hit;
+}
+
+// Same slab test as Cube::hit for every lane of the packet.
+inline SimdMask hitCubePacket(const PacketVectors& rays, const CubeArrays& cubes, uint32_t index, SimdFloat tMin, SimdFloat& tMax) {
+    const auto& r = cubes.rotation;
+    const SimdFloat ocX = rays.originX - SimdFloat(cubes.centerX[index]);
+    const SimdFloat ocY = rays.originY - SimdFloat(cubes.centerY[index]);
+    const SimdFloat ocZ = rays.originZ - SimdFloat(cubes.centerZ[index]);
+
+    const SimdFloat halfSize(cubes.halfSize[index]);
+    SimdFloat tNear = tMin;
+    SimdFloat tFar = tMax;
+    for (unsigned int axis = 0; axis < 3; ++axis) {
+        const SimdFloat r0(r[axis * 3][index]), r1(r[axis * 3 + 1][index]), r2(r[axis * 3 + 2][index]);
+        const SimdFloat origin = r0 * ocX + r1 * ocY + r2 * ocZ;
+        const SimdFloat inverseDirection = SimdFloat(1.f) / (r0 * rays.directionX + r1 * rays.directionY + r2 * rays.directionZ);
+        const SimdFloat t0 = (SimdFloat(0.f) - halfSize - origin) * inverseDirection;
+        const SimdFloat t1 = (halfSize - origin) * inverseDirection;
+        tNear = max(tNear, min(t0, t1));
+        tFar = min(tFar, max(t0, t1));
+    }
+    const SimdMask hit = (tNear <= tFar) & (tNear > tMin) & (tNear < tMax);
+    tMax = select(hit, tNear, tMax);
+    return hit;
+}
+
+// Traverses the BVH with the whole packet, a node is visited as long as one active lane hits it.
+// hitLeaf(first, count, tMax) tests the primitives of a leaf against the packet and updates tMax.
+template<typename HitLeaf>
+void intersectPacket(const BVH& bvh, const PacketVectors& rays, SimdFloat tMin, SimdFloat& tMax, HitLeaf&& hitLeaf) {
+    if (bvh.empty()) {
+        return;
+    }
+
+    const SimdFloat inverseX = SimdFloat(1.f) / rays.directionX;
+    const SimdFloat inverseY = SimdFloat(1.f) / rays.directionY;
+    const SimdFloat inverseZ = SimdFloat(1.f) / rays.directionZ;
+
+    std::array<uint32_t, 2 * BVH::maxDepth> stack;
+    unsigned int stackSize = 0;
+    stack[stackSize++] = 0;
+    uint32_t visited = 0;
+
+    while (stackSize > 0) {
+        const BVHNode& node = bvh.nodes[stack[--stackSize]];
+        ++visited;
+        const Vector3f& low = node.bounds.min();
+        const Vector3f& high = node.bounds.max();
+        const SimdFloat t0X = (SimdFloat(low.x()) - rays.originX) * inverseX, t1X = (SimdFloat(high.x()) - rays.originX) * inverseX;
+        const SimdFloat t0Y = (SimdFloat(low.y()) - rays.originY) * inverseY, t1Y = (SimdFloat(high.y()) - rays.originY) * inverseY;
+        const SimdFloat t0Z = (SimdFloat(low.z()) - rays.originZ) * inverseZ, t1Z = (SimdFloat(high.z()) - rays.originZ) * inverseZ;
+        const SimdFloat tEnter = max(max(min(t0X, t1X), min(t0Y, t1Y)), max(min(t0Z, t1Z), tMin));
+        const SimdFloat tExit = min(min(max(t0X, t1X), max(t0Y, t1Y)), min(max(t0Z, t1Z), tMax));
+        if (!(tEnter <= tExit).any()) {
+            continue;
+        }
+
+        if (node.isLeaf()) {
+            hitLeaf(node.leftFirst, node.count, tMax);
+        } else {
+            stack[stackSize++] = node.leftFirst;
+            stack[stackSize++] = uint32_t(&node - bvh.nodes.data()) + 1;
+        }
+    }
+    Stats::count(Counter::PACKET_NODES, visited);
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include "Eigen/Dense"
+#include "cpu_version/arena.h"
+#include "cpu_version/ray.h"
+
+using namespace Eigen;
+
+// Spheres of a scene as structure of arrays allocated from the scene's arena, read by the scalar
+// and the packet kernels alike.
+struct SphereArrays {
+    ArenaArray<float> centerX, centerY, centerZ, radius;
+    ArenaArray<MaterialId> material;
+
+    void add(MemoryArena& arena, const Vector3f& center, float sphereRadius, MaterialId sphereMaterial) {
+        centerX.push_back(arena, center.x()); centerY.push_back(arena, center.y()); centerZ.push_back(arena, center.z());
+        radius.push_back(arena, sphereRadius);
+        material.push_back(arena, sphereMaterial);
+    }
+
+    void reserve(MemoryArena& arena, uint32_t count) {
+        for (ArenaArray<float>* component : { &centerX, &centerY, &centerZ, &radius }) {
+            component->reserve(arena, count);
+        }
+        material.reserve(arena, count);
+    }
+
+    void reset() {
+        for (ArenaArray<float>* component : { &centerX, &centerY, &centerZ, &radius }) {
+            component->reset();
+        }
+        material.reset();
+    }
+
+    size_t size() const {
+        return material.size();
+    }
+
+    Vector3f center(size_t index) const {
+        return { centerX[index], centerY[index], centerZ[index] };
+    }
+};
+
+// Cubes as structure of arrays, rotation holds the row major world to cube rotation.
+struct CubeArrays {
+    ArenaArray<float> centerX, centerY, centerZ;
+    // half the edge length
+    ArenaArray<float> halfSize;
+    std::array<ArenaArray<float>, 9> rotation;
+    ArenaArray<MaterialId> material;
+
+    void add(MemoryArena& arena, const Vector3f& center, float size, const Matrix3f& cubeRotation, MaterialId cubeMaterial) {
+        centerX.push_back(arena, center.x()); centerY.push_back(arena, center.y()); centerZ.push_back(arena, center.z());
+        halfSize.push_back(arena, size / 2);
+        for (unsigned int element = 0; element < 9; ++element) {
+            rotation[element].push_back(arena, cubeRotation(element / 3, element % 3));
+        }
+        material.push_back(arena, cubeMaterial);
+    }
+
+    void reserve(MemoryArena& arena, uint32_t count) {
+        for (ArenaArray<float>* component : { &centerX, &centerY, &centerZ, &halfSize }) {
+            component->reserve(arena, count);
+        }
+        for (ArenaArray<float>& component : rotation) {
+            component.reserve(arena, count);
+        }
+        material.reserve(arena, count);
+    }
+
+    void reset() {
+        for (ArenaArray<float>* component : { &centerX, &centerY, &centerZ, &halfSize }) {
+            component->reset();
+        }
+        for (ArenaArray<float>& component : rotation) {
+            component.reset();
+        }
+        material.reset();
+    }
+
+    size_t size() const {
+        return material.size();
+    }
+
+    Vector3f center(size_t index) const {
+        return { centerX[index], centerY[index], centerZ[index] };
+    }
+
+    Matrix3f getRotation(size_t index) const {
+        Matrix3f cubeRotation;
+        for (unsigned int element = 0; element < 9; ++element) {
+            cubeRotation(element / 3, element % 3) = rotation[element][index];
+        }
+        return cubeRotation;
+    }
+
+    void setRotation(size_t index, const Matrix3f& cubeRotation) {
+        for (unsigned int element = 0; element < 9; ++element) {
+            rotation[element][index] = cubeRotation(element / 3, element % 3);
+        }
+    }
+};
@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include "Eigen/Dense"
+
+using namespace Eigen;
+
+// index of a material in the MaterialTable of the scene
+using MaterialId = uint32_t;
+
+class Ray {
+public:
+    Ray() {}
+    Ray(const Vector3f& origin, const Vector3f& direction)
+        : orig(origin), dir(direction.normalized())
+    {};
+
+    Vector3f origin() const { return orig; };
+    Vector3f direction() const { return dir; };
+
+    Vector3f at(double t) const {
+        return orig + t * dir;
+    };
+
+public:
+    Vector3f orig;
+    Vector3f dir;
+};
+
+
+struct HitRecord {
+    Vector3f p;
+    Vector3f normal;
+    double t;
+    MaterialId material;
+};
@@ -1,14 +1,17 @@
 #pragma once
 #include "Eigen/Dense"
 #include "Eigen/Geometry" 
-#include <time.h>
 #include <stdlib.h>
-#include <execution>
 #include <algorithm>
-#include <execution>
-#include "cpu_version/scene.h"
-#include <random>
+#include <vector>
 #include <atomic>
+#include <type_traits>
+#include <chrono>
+#include "cpu_version/scene.h"
+#include "cpu_version/threadPool.h"
+#include "cpu_version/wavefront.h"
+#include "cpu_version/film.h"
+#include "cpu_version/denoiser.h"
 #include "utils.h"
 
 using namespace Eigen;
@@ -28,12 +31,26 @@ struct Color {
 };
 
 
-class Camera {
+class RayTracer {
 public:
 
-    Camera(void* buffer, unsigned int width, unsigned int height) : width(width), height(height) {
-        srand((unsigned)time(NULL));
+    static constexpr unsigned int tileSize = 16;
+    // pixels whose paths the wavefront integrator keeps in flight at once
+    static constexpr unsigned int wavefrontBatchSize = 16384;
+    static constexpr unsigned int maxSamplesPerAxis = 8;
+
+    enum class Integrator {
+        RECURSIVE, WAVEFRONT
+    };
+
+    struct Tile {
+        unsigned int x;
+        unsigned int y;
+    };
 
+    // threadCount 0 renders on every hardware thread, pinThreads binds each worker to its own core.
+    RayTracer(void* buffer, unsigned int width, unsigned int height, uint64_t seed = 0, unsigned int threadCount = 0, bool pinThreads = false)
+        : width(width), height(height), threadPool(threadCount, pinThreads), seed(seed), film(width, height), features(width, height) {
         position = Vector3f(1, 0, 6);
         focalLength = 1;
         up = Vector3f(0, 1, 0);
@@ -45,47 +62,237 @@ public:
         upper_left = Vector3f{ -worldWidth / 2, worldHeight / 2, -focalLength} + position;
         worldStep = worldWidth / width;
 
-        scene.addSphere({ 0, 0, -4 }, 0.5, new Lambertian({0.8, 0.8, 0}));
-        scene.addSphere({ 1.5, 0, -3 }, 0.5, new Lambertian({0.5, 0, 0}));
-        scene.addSphere({ 0, -94, -40 }, 100, new Lambertian({0.3, 0.9, 0.7}));
+        scene.addSphere({ 0, 0, -4 }, 0.5, scene.addMaterial(Lambertian({0.8, 0.8, 0})));
+        scene.addSphere({ 1.5, 0, -3 }, 0.5, scene.addMaterial(Lambertian({0.5, 0, 0})));
+        scene.addSphere({ 0, -94, -40 }, 100, scene.addMaterial(Lambertian({0.3, 0.9, 0.7})));
 
-        //scene.addCube({ 1, 2, -2 }, new LightSource({ 5, 5, 5 }));
-        //scene.addCube({ 1, 2, -2 }, new Lambertian({ 1, 0, 0.2 }));
-        scene.addSphere({ 1, 2, -2 }, 0.5, new LightSource({ 5, 5, 5 }));
+        //scene.addCube({ 1, 2, -2 }, scene.addMaterial(LightSource({ 5, 5, 5 })));
+        //scene.addCube({ 1, 2, -2 }, scene.addMaterial(Lambertian({ 1, 0, 0.2 })));
+        scene.addSphere({ 1, 2, -2 }, 0.5, scene.addMaterial(LightSource({ 5, 5, 5 })));
 
-        //scene.addCube({ 1, 1.5, -2 }, new Lambertian({ 0.8, 0, 0.8 }));
+        //scene.addCube({ 1, 1.5, -2 }, scene.addMaterial(Lambertian({ 0.8, 0, 0.8 })));
 
-        scene.addSphere({ 4.5, 1, -3 }, 1, new Metal({ 0.8, 0.5, 1 }, 0.08));
-        //scene.addSphere({ 4.5, 1, -3 }, 1, new Lambertian({ 0.8, 0.5, 1 }));
+        scene.addSphere({ 4.5, 1, -3 }, 1, scene.addMaterial(Metal({ 0.8, 0.5, 1 }, 0.08)));
+        //scene.addSphere({ 4.5, 1, -3 }, 1, scene.addMaterial(Lambertian({ 0.8, 0.5, 1 })));
 
-        scene.addCube({ -1.5, 0.5, -4 }, new Lambertian({ 0.5, 0.5, 1 }));
-        //scene.addSphere({ -1.5, 1, -5 }, 1, new Metal({ 0.5, 0.5, 1 }));
-
-
-        gen = std::mt19937(rd());
-        normalDistribution = std::normal_distribution<float>{ 0, 1 };
-        uniformDistribution = std::uniform_real_distribution<float>{ 0,  pi};
+        scene.addCube({ -1.5, 0.5, -4 }, scene.addMaterial(Lambertian({ 0.5, 0.5, 1 })));
+        //scene.addSphere({ -1.5, 1, -5 }, 1, scene.addMaterial(Metal({ 0.5, 0.5, 1 })));
 
+        //SimpleMesh bunny;
+        //bunny.loadMesh("../src/meshes/bunny.off");
+        //bunny.normalize();
+        //bunny.transform(AngleAxisf(-pi / 2, Vector3f::UnitX()).toRotationMatrix(), { -3, 0.5, -3 });
+        //scene.addMesh(bunny, scene.addMaterial(Lambertian({ 0.8, 0.3, 0.3 })));
+        scene.build();
+        createTiles();
     }
 
     void render() { 
 
-        auto p = [this](Color& pixel) {
-            int index = &pixel - buffer;
-            int i = index % width;
-            int j = index / width;
-            Vector3f pixelWorldSpace = upper_left + worldStep * i * right - worldStep * j * up;
-            renderPixel<5>(pixelWorldSpace, (height - 1 - j) * width + i, 10);
-        };
-
-        std::for_each(std::execution::par_unseq, buffer, buffer+width*height-1, p);
-        scene.cubes[0].rotate(0.1);
-        scene.cubes[1].rotate(0.05);
+        features.clear();
+        {
+            const Stats::ScopedPhase phase(Phase::RENDER);
+            withSamplesPerAxis([this](auto n) {
+                constexpr unsigned int N = decltype(n)::value;
+                if (integrator == Integrator::WAVEFRONT) {
+                    renderWavefront<N>(maxDepth);
+                } else {
+                    renderTiles<N>(maxDepth);
+                }
+            });
+        }
+        advanceFrame();
 
         //light += Vector3f(0, 0, -0.01);
         //upper_left += Vector3f{0, 0, -0.01};
     }
 
+    // Moves the scene on to the next frame of the animation. The BVH is refitted around the moved
+    // cubes instead of built again, see Scene::update().
+    void advanceFrame() {
+        ++frame;
+        const Stats::ScopedPhase phase(Phase::SCENE_UPDATE);
+        if (scene.cubes.size() > 0) scene.rotateCube(0, 0.1);
+        if (scene.cubes.size() > 1) scene.rotateCube(1, 0.05);
+        scene.update(&threadPool);
+        // the moved cubes make the accumulated samples stale
+        film.clear();
+    }
+
+    // Points the renderer at another display buffer of the same size, so frames can be rendered
+    // into buffers that are still being written out.
+    void setBuffer(void* buffer) {
+        this->buffer = static_cast<Color*>(buffer);
+    }
+
+    template<unsigned int N>
+    void renderTiles(unsigned int steps = 10) {
+        threadPool.parallelFor((uint32_t)tiles.size(), [this, steps](uint32_t tileIndex) {
+            const Tile& tile = tiles[tileIndex];
+            const unsigned int tileWidth = std::min(tileSize, width - tile.x);
+            const unsigned int tileHeight = std::min(tileSize, height - tile.y);
+            for (unsigned int j = tile.y; j < tile.y + tileHeight; ++j) {
+                for (unsigned int i = tile.x; i < tile.x + tileWidth; ++i) {
+                    Vector3f pixelWorldSpace = upper_left + worldStep * i * right - worldStep * j * up;
+                    renderPixel<N>(pixelWorldSpace, (height - 1 - j) * width + i, steps);
+                }
+            }
+        });
+    }
+
+    // Same samples as renderPixel<N>, traced a batch of pixels at a time by the wavefront integrator.
+    template<unsigned int N>
+    void renderWavefront(unsigned int steps = 10) {
+        constexpr unsigned int totalRays = N * N;
+        const float stepSize = worldStep / (float)(N + 1);
+        const unsigned int pixelCount = width * height;
+
+        for (unsigned int firstPixel = 0; firstPixel < pixelCount; firstPixel += wavefrontBatchSize) {
+            const unsigned int batchPixels = std::min(wavefrontBatchSize, pixelCount - firstPixel);
+            const auto pixelIndex = [&](unsigned int localPixel) {
+                const unsigned int index = firstPixel + localPixel;
+                return (height - 1 - index / width) * width + index % width;
+            };
+
+            primaryRays.resize(batchPixels * totalRays);
+            pathPixel.resize(batchPixels * totalRays);
+            pathSample.resize(batchPixels * totalRays);
+            threadPool.parallelFor(batchPixels, [&](uint32_t localPixel) {
+                const unsigned int index = firstPixel + localPixel;
+                const Vector3f pixelWorldSpace = upper_left + worldStep * (index % width) * right - worldStep * (index / width) * up;
+                Vector3f currentPosition = pixelWorldSpace;
+                for (unsigned int i = 0; i < N; ++i) {
+                    currentPosition = pixelWorldSpace - up * stepSize * i;
+                    for (unsigned int j = 0; j < N; ++j) {
+                        currentPosition += right * stepSize * j;
+                        const uint32_t path = localPixel * totalRays + i * N + j;
+                        primaryRays.set(path, Ray(currentPosition, currentPosition - position), Vector3f::Ones(), path);
+                        pathPixel[path] = pixelIndex(localPixel);
+                        pathSample[path] = frame * totalRays + i * N + j;
+                    }
+                }
+            });
+
+            const std::vector<Vector3f>& radiance = wavefront.trace(primaryRays, pathPixel, pathSample, seed, steps, nextEventEstimation);
+            tracedRays += wavefront.tracedRays();
+            const HitQueue& primaryHits = wavefront.primaryHits();
+
+            threadPool.parallelFor(batchPixels, [&](uint32_t localPixel) {
+                Vector3f pixelColor{ 0, 0, 0 };
+                for (unsigned int sample = 0; sample < totalRays; ++sample) {
+                    const uint32_t path = localPixel * totalRays + sample;
+                    pixelColor += radiance[path];
+                    if (primaryHits.material[path] == HitQueue::noHit) {
+                        features.addMiss(pathPixel[path]);
+                    } else {
+                        addFeature(pathPixel[path], primaryHits.record(path));
+                    }
+                }
+                buffer[pixelIndex(localPixel)] = (static_cast<Vector3f>(pixelColor / totalRays)).cwiseSqrt();
+            });
+        }
+    }
+
+    // Adds one jittered sample to every pixel of the film. Unlike render() the scene stays still, so
+    // the passes converge, resolve() turns the film into the display image.
+    void renderPass() {
+        const Stats::ScopedPhase phase(Phase::RENDER);
+        if (film.passCount() == 0) {
+            features.clear();
+        }
+        sampleTiles(allTiles, 1);
+        film.finishPass();
+    }
+
+    // Keeps adding passes of passSamples samples to the tiles whose error is above threshold, until
+    // every tile converged, a tile holds maxSamples samples or timeBudget seconds passed (0 for no
+    // limit). Sample counts stay even, so the two halves of the film's error estimate stay balanced.
+    struct AdaptiveSettings {
+        float threshold = 0.05f;
+        double timeBudget = 0;
+        uint32_t minSamples = 8;
+        uint32_t passSamples = 4;
+        uint32_t maxSamples = 1024;
+    };
+
+    // returns the number of passes
+    uint32_t renderAdaptive(const AdaptiveSettings& settings) {
+        const Stats::ScopedPhase phase(Phase::RENDER);
+        const auto start = std::chrono::steady_clock::now();
+        const auto even = [](uint32_t value) { return std::max(2u, value + value % 2); };
+        std::vector<uint32_t> active = allTiles;
+        std::vector<char> converged(tiles.size());
+        uint32_t passes = 0;
+        if (film.passCount() == 0) {
+            features.clear();
+        }
+
+        while (!active.empty()) {
+            const uint32_t tileSamples = film.sampleCount(firstPixel(tiles[active[0]]));
+            const uint32_t samples = tileSamples < settings.minSamples ? even(settings.minSamples - tileSamples) : even(settings.passSamples);
+            sampleTiles(active, samples);
+            film.finishPass();
+            ++passes;
+
+            threadPool.parallelFor((uint32_t)active.size(), [&](uint32_t index) {
+                const Tile& tile = tiles[active[index]];
+                converged[active[index]] = film.sampleCount(firstPixel(tile)) >= settings.maxSamples || tileError(tile) <= settings.threshold;
+            });
+            active.erase(std::remove_if(active.begin(), active.end(), [&](uint32_t tile) { return converged[tile]; }), active.end());
+
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (settings.timeBudget > 0 && seconds >= settings.timeBudget) {
+                break;
+            }
+        }
+        resolve();
+        return passes;
+    }
+
+    void resolve() {
+        const Stats::ScopedPhase phase(Phase::RESOLVE);
+        film.resolve(&buffer[0].r);
+    }
+
+    // Replaces the display buffer by its denoised version, guided by the features of the samples
+    // that produced it. Call after render() or resolve().
+    void denoise(const Denoiser::Settings& settings = Denoiser::Settings()) {
+        const Stats::ScopedPhase phase(Phase::DENOISE);
+        float* rgb = &buffer[0].r;
+        const size_t valueCount = size_t(width) * height * 3;
+        for (size_t value = 0; value < valueCount; ++value) {
+            rgb[value] *= rgb[value];
+        }
+        denoiser.denoise(rgb, features, settings, &threadPool);
+        for (size_t value = 0; value < valueCount; ++value) {
+            rgb[value] = std::sqrt(rgb[value]);
+        }
+    }
+
+    // Adds the samples firstSample..firstSample + samples - 1 of every pixel of the rectangle at
+    // (x, y), counted from the top left like the tiles, to target. They are the samples
+    // renderPass() takes with those indices. target only covers the rectangle and is indexed
+    // bottom row first like the film. Render farm workers take their jobs this way.
+    void sampleRegion(unsigned int x, unsigned int y, unsigned int regionWidth, unsigned int regionHeight, uint32_t firstSample,
+                      uint32_t samples, Film& target) {
+        const Stats::ScopedPhase phase(Phase::RENDER);
+        threadPool.parallelFor(regionHeight, [&](uint32_t row) {
+            const unsigned int j = y + row;
+            for (unsigned int i = x; i < x + regionWidth; ++i) {
+                const unsigned int pixelIndex = (height - 1 - j) * width + i;
+                const unsigned int targetIndex = (regionHeight - 1 - row) * regionWidth + (i - x);
+                for (uint32_t sample = firstSample; sample < firstSample + samples; ++sample) {
+                    target.add(targetIndex, samplePixel(i, j, pixelIndex, sample));
+                }
+            }
+            tracedRays += threadRays;
+            threadRays = 0;
+        });
+    }
+
+    const Film& getFilm() const { return film; }
+    const FeatureBuffers& getFeatures() const { return features; }
+
     template<unsigned int N>
     void renderPixel(Vector3f& pixelWorldSpace, unsigned int pixelIndex, unsigned int steps = 10) {
 
@@ -93,36 +300,89 @@ public:
         constexpr unsigned int totalRays = N * N;
         Vector3f pixelColor{ 0, 0, 0 };
         Vector3f currentPosition = pixelWorldSpace;
+
+        // the camera rays of a pixel are coherent, so their first hit is found a packet at a time
+        RayPacket packet;
+        HitRecord hits[RayPacket::width];
+        unsigned int firstSample = 0;
+        const auto tracePacket = [&]() {
+            const unsigned int hitLanes = scene.hitPacket(packet, 0.001f, hits);
+            threadRays += packet.activeCount();
+            Stats::countRays(0, packet.activeCount());
+            for (unsigned int lane = 0; lane < RayPacket::width && packet.active(lane); ++lane) {
+                threadRandom = RandomStream(seed, pixelIndex, frame * totalRays + firstSample + lane);
+                threadRandom.setBounce(steps);
+                if (hitLanes & (1u << lane)) {
+                    addFeature(pixelIndex, hits[lane]);
+                    pixelColor += shade(packet.ray(lane), hits[lane], steps);
+                } else {
+                    features.addMiss(pixelIndex);
+                }
+            }
+            firstSample += RayPacket::width;
+            packet.activeLanes = 0;
+        };
+
         for (unsigned int i = 0; i < N; ++i) {
             currentPosition = pixelWorldSpace - up * stepSize * i;
             for (unsigned int j = 0; j < N; ++j) {
                 currentPosition += right * stepSize * j;
-                Ray ray(currentPosition, currentPosition - position);
-                pixelColor += ray_color(ray, steps);
+                const unsigned int sample = i * N + j;
+                packet.set(sample - firstSample, Ray(currentPosition, currentPosition - position));
+                if (sample - firstSample + 1 == RayPacket::width) {
+                    tracePacket();
+                }
             }
         }
+        if (packet.activeLanes != 0) {
+            packet.pad();
+            tracePacket();
+        }
 
         buffer[pixelIndex] = (static_cast<Vector3f>(pixelColor / totalRays)).cwiseSqrt();
+        tracedRays += threadRays;
+        threadRays = 0;
         //buffer[pixelIndex] = clamp(static_cast<Vector3f>(pixelColor / totalRays), 0.f, 1.f).cwiseSqrt();
 
     }
 
-    Vector3f ray_color(const Ray& r, int depth) {
+    // One path through a random point of pixel (i, j), the stream is keyed by the pixel and the sample index.
+    Vector3f samplePixel(unsigned int i, unsigned int j, unsigned int pixelIndex, uint64_t sample) {
+        threadRandom = RandomStream(seed, pixelIndex, sample);
+        // the pixel position uses a bounce index no path reaches
+        threadRandom.setBounce(~0u);
+        // pixel (i, j) spans [i, i + 1) x [j, j + 1) from upper_left, like the grid of renderPixel()
+        const float x = i + threadRandom.nextFloat();
+        const float y = j + threadRandom.nextFloat();
+        const Vector3f pixelWorldSpace = upper_left + worldStep * x * right - worldStep * y * up;
+        const Ray ray(pixelWorldSpace, pixelWorldSpace - position);
+
+        // the first bounce of ray_color, done here so the hit also goes into the features
+        threadRandom.setBounce(maxDepth);
+        ++threadRays;
+        Stats::countRays(0);
+        HitRecord hitRecord;
+        if (!scene.hit(ray, 0.001, std::numeric_limits<float>::max(), hitRecord)) {
+            features.addMiss(pixelIndex);
+            return { 0., 0., 0. };
+        }
+        addFeature(pixelIndex, hitRecord);
+        return shade(ray, hitRecord, maxDepth);
+    }
+
+    // scatterPdf is the density with which the previous hit scattered r, see shade()
+    Vector3f ray_color(const Ray& r, int depth, float scatterPdf = 0) {
         HitRecord hitRecord;
 
         if (depth < 0) {
             return Vector3f(0, 0, 0);
         }
+        threadRandom.setBounce(depth);
+        ++threadRays;
+        Stats::countRays(unsigned(std::max(0, int(maxDepth) - depth)));
 
         if (scene.hit(r, 0.001, std::numeric_limits<float>::max(), hitRecord)) {
-            Ray scattered;
-            Vector3f attenuation;
-            if (hitRecord.material->scatter(r, hitRecord, attenuation, scattered)) {
-                return attenuation.cwiseProduct(ray_color(scattered, depth - 1));
-
-            } else {
-                return  hitRecord.material->emit();
-            }
+            return shade(r, hitRecord, depth, scatterPdf);
         }
 
         //Vector3f unit_direction = r.direction();
@@ -131,7 +391,147 @@ public:
         return { 0., 0., 0. };
     };
 
+    // With next event estimation every diffuse hit also samples a light, and emission found by a
+    // scattered ray is weighted by multiple importance sampling against that light sample.
+    // scatterPdf 0 marks camera rays and mirror like bounces, their emission counts in full.
+    Vector3f shade(const Ray& r, const HitRecord& hitRecord, int depth, float scatterPdf = 0) {
+        Ray scattered;
+        Vector3f attenuation;
+        const MaterialTable& materials = scene.materials;
+        if (materials.scatter(r, hitRecord, attenuation, scattered)) {
+            // the light sample is a path one bounce longer, it has to fit into the depth as well
+            if (!nextEventEstimation || depth < 1 || !materials.samplesLights(hitRecord.material)) {
+                return attenuation.cwiseProduct(ray_color(scattered, depth - 1));
+            }
+            const Vector3f direct = scene.sampleDirectLight(hitRecord);
+            return direct + attenuation.cwiseProduct(ray_color(scattered, depth - 1, materials.scatterPdf(hitRecord, scattered.dir)));
+
+        } else {
+            return scene.emissionWeight(r, float(hitRecord.t), scatterPdf) * materials.emit(hitRecord.material);
+        }
+    }
+
+    uint64_t getTracedRays() const {
+        return tracedRays;
+    }
+
+    // call scene.build() after changing the scene
+    Scene& getScene() { return scene; }
+
+    // Looks from position along direction, up only has to lie apart from the direction. The image
+    // plane keeps its size and lies focalLength in front of the camera.
+    void setCamera(const Vector3f& position, const Vector3f& direction, const Vector3f& up, float focalLength) {
+        const Vector3f forward = direction.normalized();
+        this->position = position;
+        this->focalLength = focalLength;
+        right = forward.cross(up).normalized();
+        this->up = right.cross(forward);
+        upper_left = position + focalLength * forward - worldWidth / 2 * right + worldHeight / 2 * this->up;
+        film.clear();
+    }
+
+    unsigned int getThreadCount() const { return threadPool.size(); }
+    unsigned int getWidth() const { return width; }
+    unsigned int getHeight() const { return height; }
+
 private:
+    // Calls f with std::integral_constant<unsigned int, samplesPerAxis>, so the per pixel sample grid
+    // stays a compile time constant.
+    template<typename F>
+    void withSamplesPerAxis(F&& f) {
+        switch (std::clamp(samplesPerAxis, 1u, maxSamplesPerAxis)) {
+            case 1: f(std::integral_constant<unsigned int, 1>()); break;
+            case 2: f(std::integral_constant<unsigned int, 2>()); break;
+            case 3: f(std::integral_constant<unsigned int, 3>()); break;
+            case 4: f(std::integral_constant<unsigned int, 4>()); break;
+            case 5: f(std::integral_constant<unsigned int, 5>()); break;
+            case 6: f(std::integral_constant<unsigned int, 6>()); break;
+            case 7: f(std::integral_constant<unsigned int, 7>()); break;
+            case 8: f(std::integral_constant<unsigned int, 8>()); break;
+        }
+    }
+
+    // The albedo, normal and camera distance of the first hit of a camera ray, whose direction is
+    // normalized so t is the distance.
+    void addFeature(unsigned int pixelIndex, const HitRecord& hitRecord) {
+        const Vector3f albedo = scene.materials.color(hitRecord.material).cwiseMax(0.f).cwiseMin(1.f);
+        features.add(pixelIndex, albedo, hitRecord.normal, float(hitRecord.t));
+    }
+
+    // Adds samples samples to every pixel of the listed tiles.
+    void sampleTiles(const std::vector<uint32_t>& tileIndices, uint32_t samples) {
+        threadPool.parallelFor((uint32_t)tileIndices.size(), [&](uint32_t index) {
+            const Tile& tile = tiles[tileIndices[index]];
+            const unsigned int tileWidth = std::min(tileSize, width - tile.x);
+            const unsigned int tileHeight = std::min(tileSize, height - tile.y);
+            for (unsigned int j = tile.y; j < tile.y + tileHeight; ++j) {
+                for (unsigned int i = tile.x; i < tile.x + tileWidth; ++i) {
+                    const unsigned int pixelIndex = (height - 1 - j) * width + i;
+                    for (uint32_t sample = 0; sample < samples; ++sample) {
+                        film.add(pixelIndex, samplePixel(i, j, pixelIndex, film.sampleCount(pixelIndex)));
+                    }
+                }
+            }
+            tracedRays += threadRays;
+            threadRays = 0;
+        });
+    }
+
+    unsigned int firstPixel(const Tile& tile) const {
+        return (height - 1 - tile.y) * width + tile.x;
+    }
+
+    // Noise estimate of the film pooled over a tile and taken relative to the square root of the
+    // brightness, so dark tiles are not held to the absolute error of bright ones. Pooling keeps
+    // pixels whose few samples all agree by chance from passing as converged.
+    float tileError(const Tile& tile) const {
+        const unsigned int tileWidth = std::min(tileSize, width - tile.x);
+        const unsigned int tileHeight = std::min(tileSize, height - tile.y);
+        float difference = 0;
+        float brightness = 0;
+        for (unsigned int j = tile.y; j < tile.y + tileHeight; ++j) {
+            for (unsigned int i = tile.x; i < tile.x + tileWidth; ++i) {
+                const unsigned int pixelIndex = (height - 1 - j) * width + i;
+                difference += film.halfDifference(pixelIndex);
+                brightness += film.average(pixelIndex).sum();
+            }
+        }
+        return difference / std::sqrt(std::max(brightness, 1e-4f) * (tileWidth * tileHeight));
+    }
+
+    // Tiles in Morton order, so the contiguous blocks the thread pool hands to each worker are
+    // compact regions of the screen.
+    void createTiles() {
+        const unsigned int tilesX = (width + tileSize - 1) / tileSize;
+        const unsigned int tilesY = (height + tileSize - 1) / tileSize;
+        std::vector<std::pair<uint64_t, Tile>> ordered;
+        ordered.reserve(tilesX * tilesY);
+        for (unsigned int y = 0; y < tilesY; ++y) {
+            for (unsigned int x = 0; x < tilesX; ++x) {
+                ordered.push_back({ mortonCode(x, y), { x * tileSize, y * tileSize } });
+            }
+        }
+        std::sort(ordered.begin(), ordered.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+        tiles.clear();
+        allTiles.clear();
+        for (const auto& entry : ordered) {
+            allTiles.push_back((uint32_t)tiles.size());
+            tiles.push_back(entry.second);
+        }
+    }
+
+    static uint64_t mortonCode(uint32_t x, uint32_t y) {
+        const auto spread = [](uint64_t value) {
+            value = (value | (value << 16)) & 0x0000FFFF0000FFFFull;
+            value = (value | (value << 8)) & 0x00FF00FF00FF00FFull;
+            value = (value | (value << 4)) & 0x0F0F0F0F0F0F0F0Full;
+            value = (value | (value << 2)) & 0x3333333333333333ull;
+            value = (value | (value << 1)) & 0x5555555555555555ull;
+            return value;
+        };
+        return spread(x) | (spread(y) << 1);
+    }
+
     Vector3f position;
     Vector3f up;
     Vector3f right;
@@ -144,9 +544,27 @@ private:
     Vector3f upper_left;
     Color* buffer;
     Scene scene;
-    std::random_device rd;
-    std::mt19937 gen;
-    std::normal_distribution<float> normalDistribution;
-    std::uniform_real_distribution<float> uniformDistribution;
+    std::vector<Tile> tiles;
+    std::vector<uint32_t> allTiles;
+    ThreadPool threadPool;
+    uint64_t seed;
+    uint64_t frame = 0;
+    Film film;
+    FeatureBuffers features;
+    Denoiser denoiser;
+    WavefrontIntegrator wavefront{ scene, threadPool };
+    RayQueue primaryRays;
+    std::vector<uint32_t> pathPixel;
+    std::vector<uint64_t> pathSample;
+    std::atomic<uint64_t> tracedRays{ 0 };
+    static inline thread_local uint64_t threadRays = 0;
+
+public:
+    Integrator integrator = Integrator::RECURSIVE;
+    // every pixel is sampled by a samplesPerAxis x samplesPerAxis grid, at most maxSamplesPerAxis
+    unsigned int samplesPerAxis = 5;
+    unsigned int maxDepth = 10;
+    // sample the emissive spheres directly at every diffuse hit
+    bool nextEventEstimation = true;
 
 };
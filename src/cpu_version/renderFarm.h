@@ -0,0 +1,569 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <sstream>
+#include <fstream>
+#include <filesystem>
+#include "cpu_version/film.h"
+#include "cpu_version/rayTracer.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
+
+// Render farm mode: a coordinator splits the samples of a frame into jobs, a rectangle of the image
+// and a range of sample indices each, and hands them to worker processes through pipes. Workers are
+// started through /bin/sh, so a command like "ssh node cpuRender" runs one on another machine, its
+// standard input and output carry the messages. Every sample is keyed by its pixel and index like
+// those of RayTracer::renderPass(), so the merged film holds the samples a single process would
+// take, however the jobs were spread.
+
+struct FarmJob {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+    uint32_t firstSample;
+    uint32_t samples;
+};
+
+// A message is this header followed by bytes of payload: a FarmJob for JOB, the traced ray count
+// and Film::write() of the job's film for RESULT, nothing for EXIT. Workers answer the jobs in the
+// order they got them.
+struct FarmMessageHeader {
+    enum Type : uint32_t {
+        JOB = 1, RESULT = 2, EXIT = 3
+    };
+
+    uint32_t type;
+    uint32_t jobIndex;
+    uint64_t bytes;
+};
+
+class FarmChannel {
+public:
+    FarmChannel(int input = -1, int output = -1) : input(input), output(output) {}
+
+    // The channel of a worker process is its standard input and output. stdout is pointed at stderr
+    // afterwards, so nothing the renderer prints ends up between the messages.
+    static FarmChannel workerStreams() {
+#ifdef _WIN32
+        return FarmChannel();
+#else
+        const int output = dup(STDOUT_FILENO);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+        return FarmChannel(STDIN_FILENO, output);
+#endif
+    }
+
+    bool send(uint32_t type, uint32_t jobIndex, const void* payload = nullptr, size_t bytes = 0) const {
+        const FarmMessageHeader header{ type, jobIndex, bytes };
+        return writeAll(&header, sizeof(header)) && writeAll(payload, bytes);
+    }
+
+    bool receive(FarmMessageHeader& header, std::string& payload) const {
+        if (!readAll(&header, sizeof(header)) || header.bytes > maxPayload) {
+            return false;
+        }
+        payload.resize(size_t(header.bytes));
+        return readAll(payload.data(), payload.size());
+    }
+
+    void close() {
+#ifndef _WIN32
+        if (input >= 0) ::close(input);
+        if (output >= 0 && output != input) ::close(output);
+#endif
+        input = output = -1;
+    }
+
+    // larger payloads are taken for a broken stream
+    static constexpr uint64_t maxPayload = uint64_t(1) << 32;
+
+    int input;
+    int output;
+
+private:
+    bool writeAll(const void* data, size_t bytes) const {
+#ifdef _WIN32
+        return false;
+#else
+        const char* next = static_cast<const char*>(data);
+        while (bytes > 0) {
+            const ssize_t written = write(output, next, bytes);
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) return false;
+            next += written;
+            bytes -= size_t(written);
+        }
+        return true;
+#endif
+    }
+
+    bool readAll(void* data, size_t bytes) const {
+#ifdef _WIN32
+        return false;
+#else
+        char* next = static_cast<char*>(data);
+        while (bytes > 0) {
+            const ssize_t got = read(input, next, bytes);
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) return false;
+            next += got;
+            bytes -= size_t(got);
+        }
+        return true;
+#endif
+    }
+};
+
+// Answers the jobs coming in on channel until the coordinator sends EXIT. Returns false for a
+// broken channel or a job outside the image.
+inline bool runFarmWorker(RayTracer& rayTracer, const FarmChannel& channel) {
+    FarmMessageHeader header;
+    std::string payload;
+    Film film;
+    while (channel.receive(header, payload)) {
+        if (header.type == FarmMessageHeader::EXIT) {
+            return true;
+        }
+        FarmJob job;
+        if (header.type != FarmMessageHeader::JOB || payload.size() != sizeof(FarmJob)) {
+            return false;
+        }
+        std::memcpy(&job, payload.data(), sizeof(job));
+        if (job.width == 0 || job.height == 0 || job.x >= rayTracer.getWidth() || job.y >= rayTracer.getHeight()
+            || job.width > rayTracer.getWidth() - job.x || job.height > rayTracer.getHeight() - job.y) {
+            return false;
+        }
+        film.resize(job.width, job.height);
+        const uint64_t raysBefore = rayTracer.getTracedRays();
+        rayTracer.sampleRegion(job.x, job.y, job.width, job.height, job.firstSample, job.samples, film);
+        const uint64_t rays = rayTracer.getTracedRays() - raysBefore;
+
+        std::ostringstream result;
+        result.write(reinterpret_cast<const char*>(&rays), sizeof(rays));
+        film.write(result);
+        const std::string bytes = result.str();
+        if (!channel.send(FarmMessageHeader::RESULT, header.jobIndex, bytes.data(), bytes.size())) {
+            return false;
+        }
+    }
+    return false;
+}
+
+// Start of a render farm checkpoint, followed by a byte per job, 1 for the merged ones, and
+// Film::write() of the merged film. fingerprint hashes everything that decides the samples, a
+// checkpoint of another scene or job layout is ignored.
+struct FarmCheckpointHeader {
+    static constexpr char magicValue[8] = { 'R', 'T', 'F', 'A', 'R', 'M', 0, 0 };
+    static constexpr uint32_t currentVersion = 1;
+    static constexpr uint32_t byteOrderValue = 0x01020304;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t fingerprint;
+    uint32_t width;
+    uint32_t height;
+    uint32_t jobCount;
+    uint32_t padding;
+};
+
+#ifndef _WIN32
+// set by the SIGINT and SIGTERM handlers of FarmCoordinator::render()
+inline volatile sig_atomic_t farmInterrupted = 0;
+
+inline void farmInterruptHandler(int) {
+    farmInterrupted = 1;
+}
+#endif
+
+class FarmCoordinator {
+public:
+    struct Settings {
+        // one worker per command, started as command --worker workerArguments
+        std::vector<std::string> workerCommands;
+        // the options that decide the image, the same for every worker
+        std::vector<std::string> workerArguments;
+        // the scene and mesh files the workers read, a checkpoint is not resumed once one of them
+        // changed its size or modification time
+        std::vector<std::string> inputFiles;
+        uint32_t samples = 25;
+        // samples per job, 0 puts all samples of a rectangle into one job
+        uint32_t jobSamples = 0;
+        unsigned int jobTileSize = 64;
+        // merged jobs are saved here every checkpointInterval seconds, 0 after every job, after the
+        // last job and when the render is interrupted, and picked up again by a render with the same
+        // settings
+        std::string checkpointPath;
+        double checkpointInterval = 10;
+    };
+
+    FarmCoordinator(unsigned int width, unsigned int height, const Settings& settings)
+        : width(width), height(height), settings(settings) {
+        createJobs();
+    }
+
+    // Renders every job into film, which has to be width x height. Jobs of a worker that fails are
+    // handed to the others, false is returned once none is left or on SIGINT or SIGTERM, after the
+    // merged jobs were saved to the checkpoint.
+    bool render(Film& film, std::string& error) {
+#ifdef _WIN32
+        error = "the render farm mode needs POSIX pipes and processes";
+        return false;
+#else
+        if (!loadCheckpoint(film)) {
+            film.clear();
+            std::fill(done.begin(), done.end(), 0);
+        }
+        resumed = uint32_t(std::count(done.begin(), done.end(), 1));
+        doneCount = resumed;
+        std::deque<uint32_t> pending;
+        for (uint32_t job = 0; job < jobs.size(); ++job) {
+            if (!done[job]) pending.push_back(job);
+        }
+
+        // a worker that went away makes writes fail instead of ending the coordinator
+        signal(SIGPIPE, SIG_IGN);
+        // without SA_RESTART an interruption wakes poll() up with EINTR
+        struct sigaction interruptAction = {};
+        interruptAction.sa_handler = farmInterruptHandler;
+        sigemptyset(&interruptAction.sa_mask);
+        struct sigaction previousInt, previousTerm;
+        farmInterrupted = 0;
+        sigaction(SIGINT, &interruptAction, &previousInt);
+        sigaction(SIGTERM, &interruptAction, &previousTerm);
+        const auto restoreSignals = [&]() {
+            sigaction(SIGINT, &previousInt, nullptr);
+            sigaction(SIGTERM, &previousTerm, nullptr);
+        };
+        workers.clear();
+        for (size_t index = 0; index < settings.workerCommands.size() && !pending.empty(); ++index) {
+            const std::string& command = settings.workerCommands[index];
+            Worker worker;
+            if (start(worker, command)) {
+                workers.push_back(std::move(worker));
+            }
+        }
+        const auto dispatch = [&](Worker& worker) {
+            // two jobs in flight, so a worker has the next one at hand when it sends a result
+            while (worker.alive && worker.jobs.size() < 2 && !pending.empty()) {
+                const uint32_t job = pending.front();
+                if (!worker.channel.send(FarmMessageHeader::JOB, job, &jobs[job], sizeof(FarmJob))) {
+                    fail(worker, pending);
+                    return;
+                }
+                pending.pop_front();
+                worker.jobs.push_back(job);
+            }
+        };
+
+        auto lastCheckpoint = std::chrono::steady_clock::now();
+        uint32_t checkpointedCount = doneCount;
+        std::vector<pollfd> descriptors;
+        std::vector<Worker*> polled;
+        while (doneCount < jobs.size()) {
+            if (farmInterrupted) {
+                error = "interrupted, " + std::to_string(doneCount) + " of " + std::to_string(jobs.size()) + " jobs are done";
+                stopWorkers();
+                finish(film);
+                restoreSignals();
+                return false;
+            }
+            descriptors.clear();
+            polled.clear();
+            for (Worker& worker : workers) {
+                dispatch(worker);
+                if (worker.alive && !worker.jobs.empty()) {
+                    descriptors.push_back({ worker.channel.input, POLLIN, 0 });
+                    polled.push_back(&worker);
+                }
+            }
+            if (descriptors.empty()) {
+                error = "every worker failed, " + std::to_string(jobs.size() - doneCount) + " jobs are left";
+                finish(film);
+                restoreSignals();
+                return false;
+            }
+            if (poll(descriptors.data(), nfds_t(descriptors.size()), -1) < 0) {
+                if (errno == EINTR) continue;
+                error = "poll failed";
+                finish(film);
+                restoreSignals();
+                return false;
+            }
+            for (size_t index = 0; index < descriptors.size(); ++index) {
+                if (descriptors[index].revents == 0) continue;
+                Worker& worker = *polled[index];
+                if (!receive(worker, film)) {
+                    fail(worker, pending);
+                }
+            }
+            if (!settings.checkpointPath.empty() && doneCount != checkpointedCount
+                && std::chrono::duration<double>(std::chrono::steady_clock::now() - lastCheckpoint).count() >= settings.checkpointInterval) {
+                writeCheckpoint(film);
+                lastCheckpoint = std::chrono::steady_clock::now();
+                checkpointedCount = doneCount;
+            }
+        }
+        finish(film);
+        restoreSignals();
+        return true;
+#endif
+    }
+
+    uint32_t jobCount() const { return uint32_t(jobs.size()); }
+    // jobs taken from the checkpoint instead of rendered
+    uint32_t resumedJobs() const { return resumed; }
+    unsigned int workerCount() const { return unsigned(settings.workerCommands.size()); }
+    uint64_t getTracedRays() const { return tracedRays; }
+
+    // Quotes text for /bin/sh.
+    static std::string shellQuote(const std::string& text) {
+        std::string quoted = "'";
+        for (char character : text) {
+            quoted += character == '\'' ? std::string("'\\''") : std::string(1, character);
+        }
+        return quoted + "'";
+    }
+
+    // The path of the running program, so local workers start the same binary.
+    static std::string currentExecutable(const char* argv0) {
+        std::error_code error;
+        const std::filesystem::path self = std::filesystem::read_symlink("/proc/self/exe", error);
+        return error ? std::filesystem::absolute(argv0).string() : self.string();
+    }
+
+private:
+    struct Worker {
+#ifndef _WIN32
+        pid_t pid = -1;
+#endif
+        FarmChannel channel;
+        std::deque<uint32_t> jobs;
+        bool alive = false;
+    };
+
+    // The rectangles in rows, all of them for the first samples before any gets the next ones, so
+    // an interrupted render has spread its samples evenly.
+    void createJobs() {
+        const uint32_t samples = std::max(settings.samples, 1u);
+        const uint32_t jobSamples = settings.jobSamples == 0 ? samples : std::min(settings.jobSamples, samples);
+        const unsigned int tileSize = std::max(settings.jobTileSize, 1u);
+        for (uint32_t firstSample = 0; firstSample < samples; firstSample += jobSamples) {
+            for (unsigned int y = 0; y < height; y += tileSize) {
+                for (unsigned int x = 0; x < width; x += tileSize) {
+                    jobs.push_back({ x, y, std::min(tileSize, width - x), std::min(tileSize, height - y), firstSample,
+                                     std::min(jobSamples, samples - firstSample) });
+                }
+            }
+        }
+        done.assign(jobs.size(), 0);
+    }
+
+#ifndef _WIN32
+    bool start(Worker& worker, const std::string& command) {
+        std::string commandLine = command + " --worker";
+        for (const std::string& argument : settings.workerArguments) {
+            commandLine += " " + shellQuote(argument);
+        }
+        int toWorker[2], fromWorker[2];
+        if (pipe(toWorker) != 0) {
+            return false;
+        }
+        if (pipe(fromWorker) != 0) {
+            ::close(toWorker[0]);
+            ::close(toWorker[1]);
+            return false;
+        }
+        // the workers started later must not hold the ends of this one
+        fcntl(toWorker[1], F_SETFD, FD_CLOEXEC);
+        fcntl(fromWorker[0], F_SETFD, FD_CLOEXEC);
+        const pid_t pid = fork();
+        if (pid == 0) {
+            dup2(toWorker[0], STDIN_FILENO);
+            dup2(fromWorker[1], STDOUT_FILENO);
+            ::close(toWorker[0]); ::close(toWorker[1]);
+            ::close(fromWorker[0]); ::close(fromWorker[1]);
+            // Ctrl-C in the terminal reaches the whole process group, only the coordinator should
+            // see it and stop the workers after saving the checkpoint
+            signal(SIGINT, SIG_IGN);
+            execl("/bin/sh", "sh", "-c", commandLine.c_str(), static_cast<char*>(nullptr));
+            _exit(127);
+        }
+        ::close(toWorker[0]);
+        ::close(fromWorker[1]);
+        if (pid < 0) {
+            ::close(toWorker[1]);
+            ::close(fromWorker[0]);
+            return false;
+        }
+        worker.pid = pid;
+        worker.channel = FarmChannel(fromWorker[0], toWorker[1]);
+        worker.alive = true;
+        return true;
+    }
+
+    // Merges the result of the oldest job of the worker into film.
+    bool receive(Worker& worker, Film& film) {
+        FarmMessageHeader header;
+        if (!worker.channel.receive(header, payload) || header.type != FarmMessageHeader::RESULT || header.jobIndex != worker.jobs.front()) {
+            return false;
+        }
+        const FarmJob& job = jobs[header.jobIndex];
+        const size_t pixels = size_t(job.width) * job.height;
+        uint64_t rays;
+        if (payload.size() != sizeof(rays) + pixels * (sizeof(uint32_t) + 6 * sizeof(float))) {
+            return false;
+        }
+        std::memcpy(&rays, payload.data(), sizeof(rays));
+        std::istringstream stream(payload.substr(sizeof(rays)));
+        jobFilm.resize(job.width, job.height);
+        if (!jobFilm.read(stream)) {
+            return false;
+        }
+        for (unsigned int row = 0; row < job.height; ++row) {
+            for (unsigned int column = 0; column < job.width; ++column) {
+                const unsigned int jobPixel = (job.height - 1 - row) * job.width + column;
+                const unsigned int pixel = (height - 1 - (job.y + row)) * width + job.x + column;
+                film.addSamples(pixel, jobFilm.sum(jobPixel), jobFilm.halfSum(jobPixel), jobFilm.sampleCount(jobPixel));
+            }
+        }
+        tracedRays += rays;
+        done[header.jobIndex] = 1;
+        ++doneCount;
+        worker.jobs.pop_front();
+        return true;
+    }
+
+    // hands the jobs of a worker that broke off back to the others
+    void fail(Worker& worker, std::deque<uint32_t>& pending) {
+        fprintf(stderr, "worker %d failed, %zu of its jobs go to the others\n", int(worker.pid), worker.jobs.size());
+        pending.insert(pending.begin(), worker.jobs.begin(), worker.jobs.end());
+        worker.jobs.clear();
+        worker.channel.close();
+        kill(worker.pid, SIGTERM);
+        waitpid(worker.pid, nullptr, 0);
+        worker.alive = false;
+    }
+
+    // ends the workers without waiting for the jobs they are rendering
+    void stopWorkers() {
+        for (Worker& worker : workers) {
+            if (worker.alive) {
+                worker.channel.close();
+                kill(worker.pid, SIGTERM);
+                waitpid(worker.pid, nullptr, 0);
+                worker.alive = false;
+            }
+        }
+    }
+
+    void finish(const Film& film) {
+        for (Worker& worker : workers) {
+            if (worker.alive) {
+                worker.channel.send(FarmMessageHeader::EXIT, 0);
+                worker.channel.close();
+                waitpid(worker.pid, nullptr, 0);
+                worker.alive = false;
+            }
+        }
+        if (!settings.checkpointPath.empty()) {
+            writeCheckpoint(film);
+        }
+    }
+#endif
+
+    // FNV-1a over the image size, the job layout, the worker arguments and the size and modification
+    // time of the input files
+    uint64_t fingerprint() const {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        const auto add = [&](const void* data, size_t bytes) {
+            for (size_t index = 0; index < bytes; ++index) {
+                hash = (hash ^ static_cast<const unsigned char*>(data)[index]) * 0x100000001b3ull;
+            }
+        };
+        const uint32_t layout[] = { width, height, settings.samples, settings.jobSamples, settings.jobTileSize };
+        add(layout, sizeof(layout));
+        for (const std::string& argument : settings.workerArguments) {
+            add(argument.c_str(), argument.size() + 1);
+        }
+        for (const std::string& path : settings.inputFiles) {
+            add(path.c_str(), path.size() + 1);
+            std::error_code error;
+            const uint64_t size = std::filesystem::file_size(path, error);
+            const int64_t time = error ? 0 : int64_t(std::filesystem::last_write_time(path, error).time_since_epoch().count());
+            const int64_t stamp[] = { error ? -1 : int64_t(size), time };
+            add(stamp, sizeof(stamp));
+        }
+        return hash;
+    }
+
+    bool loadCheckpoint(Film& film) {
+        if (settings.checkpointPath.empty()) {
+            return false;
+        }
+        std::ifstream file(settings.checkpointPath, std::ios::binary);
+        FarmCheckpointHeader header;
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+            || std::memcmp(header.magic, FarmCheckpointHeader::magicValue, sizeof(header.magic)) != 0
+            || header.version != FarmCheckpointHeader::currentVersion || header.byteOrder != FarmCheckpointHeader::byteOrderValue
+            || header.fingerprint != fingerprint() || header.width != width || header.height != height || header.jobCount != jobs.size()) {
+            return false;
+        }
+        return file.read(reinterpret_cast<char*>(done.data()), std::streamsize(done.size())) && film.read(file);
+    }
+
+    // written next to the checkpoint and renamed, so an interruption never leaves half of one
+    bool writeCheckpoint(const Film& film) const {
+        FarmCheckpointHeader header = {};
+        std::memcpy(header.magic, FarmCheckpointHeader::magicValue, sizeof(header.magic));
+        header.version = FarmCheckpointHeader::currentVersion;
+        header.byteOrder = FarmCheckpointHeader::byteOrderValue;
+        header.fingerprint = fingerprint();
+        header.width = width;
+        header.height = height;
+        header.jobCount = uint32_t(jobs.size());
+
+        const std::string temporaryPath = settings.checkpointPath + ".tmp";
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(done.data()), std::streamsize(done.size()));
+        film.write(file);
+        file.close();
+        if (!file) {
+            std::remove(temporaryPath.c_str());
+            return false;
+        }
+        std::error_code error;
+        std::filesystem::rename(temporaryPath, settings.checkpointPath, error);
+        return !error;
+    }
+
+    unsigned int width;
+    unsigned int height;
+    Settings settings;
+    std::vector<FarmJob> jobs;
+    std::vector<uint8_t> done;
+    uint32_t doneCount = 0;
+    uint32_t resumed = 0;
+    uint64_t tracedRays = 0;
+    std::vector<Worker> workers;
+    std::string payload;
+    Film jobFilm;
+};
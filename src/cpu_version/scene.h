@@ -1,116 +1,22 @@
 #pragma once
 #include <vector>
 #include <limits>
+#include <array>
 #include "Eigen/Dense"
 #include "utils.h"
+#include "cpu_version/ray.h"
+#include "cpu_version/material.h"
+#include "cpu_version/bvh.h"
+#include "cpu_version/mesh.h"
+#include "cpu_version/instance.h"
+#include "cpu_version/packet.h"
+#include "cpu_version/lights.h"
 
 using namespace Eigen;
 
-class Material;
-
-class Ray {
-public:
-    Ray() {}
-    Ray(const Vector3f& origin, const Vector3f& direction)
-        : orig(origin), dir(direction.normalized())
-    {};
-
-    Vector3f origin() const { return orig; };
-    Vector3f direction() const { return dir; };
-
-    Vector3f at(double t) const {
-        return orig + t * dir;
-    };
-
-public:
-    Vector3f orig;
-    Vector3f dir;
-};
-
-
-struct HitRecord {
-    Vector3f p;
-    Vector3f normal;
-    double t;
-    Material* material;
-};
-
-
-class Material {
-public:
-    virtual bool scatter(
-        const Ray& rayIn, const HitRecord& hitRecord, Vector3f& attenuation, Ray& scattered
-    ) const = 0;
-    virtual Vector3f emit() const = 0;
-};
-
-class Lambertian : public Material {
-public:
-    Lambertian(const Vector3f& a) : albedo(a) {}
-
-    virtual bool scatter(
-        const Ray& rayIn, const HitRecord& hitRecord, Vector3f& attenuation, Ray& scattered
-    )  const override {
-        auto scatter_direction = randomUnitVector(hitRecord.normal);
-        scattered = Ray(hitRecord.p, scatter_direction);
-        attenuation = 0.6*albedo;
-        return true;
-    };
-
-    virtual Vector3f emit() const override {
-        return { 0, 0, 0 };
-    }
-
-public:
-    Vector3f albedo;
-};
-
-
-class Metal: public Material {
-public:
-    Metal(const Vector3f& a, float fuzyy = 0) : albedo(a), fuzzy(fuzyy) {}
-
-    virtual bool scatter(
-        const Ray& rayIn, const HitRecord& hitRecord, Vector3f& attenuation, Ray& scattered
-    )  const override {
-        Vector3f reflected = reflect(rayIn.direction(), hitRecord.normal);
-        scattered.orig = hitRecord.p;
-        scattered.dir = reflected + fuzzy * randomUnitVector();
-        attenuation = albedo;
-        return (scattered.dir.dot(hitRecord.normal)  > 0);
-    };
-
-    virtual Vector3f emit() const override {
-        return { 0, 0, 0 };
-    }
-
-public:
-    Vector3f albedo;
-    float fuzzy;
-};
-
-
-class LightSource: public Material {
-public:
-    LightSource(const Vector3f& lightColor) : lightColor(lightColor) {}
-
-    virtual bool scatter(
-        const Ray& rayIn, const HitRecord& hitRecord, Vector3f& attenuation, Ray& scattered
-    )  const override {
-        return false;
-    };
-
-    virtual Vector3f emit() const override {
-        return lightColor;
-    }
-
-public:
-    Vector3f lightColor;
-};
-
 class Sphere {
 public:
-    Sphere(Vector3f center, float radius, Material* material) : center(center), radius(radius), material(material) {
+    Sphere(Vector3f center, float radius, MaterialId material) : center(center), radius(radius), material(material) {
     }
     inline bool hit(const Ray& r, HitRecord& rec) const {
         Vector3f oc = r.origin() - center;
@@ -131,7 +37,14 @@ public:
         return (point - center).normalized();
     }
 
-    Material* material;
+    AlignedBox3f bounds() const {
+        return { center - Vector3f::Constant(radius), center + Vector3f::Constant(radius) };
+    }
+
+    const Vector3f& getCenter() const { return center; }
+    float getRadius() const { return radius; }
+
+    MaterialId material;
 
 private:
     Vector3f center;
@@ -141,99 +54,441 @@ private:
 
 class Cube {
 public:
-    Cube(Vector3f center, Material* material) : center(center), material(material) {
-        rotation = Matrix3f::Identity();
-        //rotation(0, 2) = -1;
-        //rotate(0.3);
-    }
-
-    inline Vector3f normalAt(const Vector3f& point) const {
-        constexpr auto indexToAxis = [](unsigned int index) -> Vector3f {
-            switch (index) {
-                case 0: return { 1, 0, 0 };
-                case 1: return { 0, 1, 0 };
-                case 2: return { 0, 0, 1 };
-            }
-        };
-
-        unsigned int maxCoefIndex;
-        const float maxCoeff = point.array().cwiseAbs().maxCoeff(&maxCoefIndex);
-        const int sign = -std::signbit(maxCoeff) * 2 + 1;
-        return indexToAxis(maxCoefIndex) * sign;
-        //return indexToAxis(maxCoefIndex) * std::copysignf(1., maxCoeff);
+    Cube(Vector3f center, MaterialId material, const Matrix3f& rotation = Matrix3f::Identity(), float size = 1)
+        : material(material), center(center), rotation(rotation), halfSize(size / 2) {
     }
 
-    inline bool hit2(const Ray& ray, HitRecord& rec) const {
+    // slab test in the frame of the cube, the normal is the one of the face the ray enters through
+    inline bool hit(const Ray& ray, HitRecord& rec) const {
         const Vector3f originTransformed = rotation * (ray.orig - center);
-        const Vector3f directionTransformed = rotation * ray.dir;
-        const Vector3f sign = originTransformed.cwiseSign();
-
-        const float tOut = (0.5 - originTransformed.array() * -sign.array()).cwiseQuotient(-sign.array() * directionTransformed.array()).minCoeff();
-        const Vector3f pointOut = (originTransformed + directionTransformed * tOut);
-        const float LInfoNorm = pointOut.cwiseAbs().maxCoeff();
-        if (LInfoNorm != 0.5) {
+        const Vector3f inverseDirection = (rotation * ray.dir).cwiseInverse();
+        const Array3f t0 = (-halfSize - originTransformed.array()) * inverseDirection.array();
+        const Array3f t1 = (halfSize - originTransformed.array()) * inverseDirection.array();
+
+        unsigned int axis;
+        const float tNear = t0.min(t1).maxCoeff(&axis);
+        const float tFar = t0.max(t1).minCoeff();
+        if (!(tNear <= tFar)) {
             return false;
         }
-        const float tIn = (0.5 - pointOut.array() * sign.array()).cwiseQuotient(sign.array() * -directionTransformed.array()).minCoeff();
 
-        rec.t = tIn;
-        rec.p = ray.orig + tIn * ray.dir;
-        rec.normal = normalAt(rec.p);
+        Vector3f normal = Vector3f::Zero();
+        normal[axis] = inverseDirection[axis] < 0 ? 1.f : -1.f;
+        rec.t = tNear;
+        rec.p = ray.at(tNear);
+        rec.normal = rotation.transpose() * normal;
         return true;
-    }
-
-    inline bool hit(const Ray& ray, HitRecord& rec) const {
-        const Vector3f originTransformed = rotation*(ray.orig - center);
-        const Vector3f directionTransformed = rotation*ray.dir;
-        const Vector3f sign = originTransformed.cwiseSign();
-
-        const Vector3f t = (0.5 - originTransformed.array() * sign.array()).cwiseQuotient(sign.array() * directionTransformed.array());
-        for (unsigned int index = 0; index < 3; ++index) {
-            const Vector3f inPoint = originTransformed + directionTransformed * t(index);
-            if (inPoint.cwiseAbs().maxCoeff() == 0.5) {
-                rec.t = t(index);
-                rec.p = ray.orig + t(index) * ray.dir;
-                rec.normal = rotation.transpose() * normalAt(inPoint);
-                //std::cout << rec.normal(0) << " " << rec.normal(1) << " " << rec.normal(2) << " " << std::endl;
-                return true;
-            }
-        }
-
-        return false;
-
     };
 
     void rotate(float angle) {
         rotation *= (AngleAxisf(angle * pi, Vector3f::UnitX()) * AngleAxisf(angle * pi, Vector3f::UnitY())).toRotationMatrix();
     };
 
-    Material* material;
+    // bounding sphere of the cube, so the bounds stay valid however the cube is rotated
+    AlignedBox3f bounds() const {
+        const Vector3f halfDiagonal = Vector3f::Constant(1.7320508f * halfSize);
+        return { center - halfDiagonal, center + halfDiagonal };
+    }
+
+    const Vector3f& getCenter() const { return center; }
+    const Matrix3f& getRotation() const { return rotation; }
+    float getSize() const { return 2 * halfSize; }
+
+    MaterialId material;
 
 private:
     Vector3f center;
-    Matrix<float, 6, 3> normals;
-    Matrix<float, 6, 1> betas;
     Matrix3f rotation;
+    float halfSize;
 };
 
 
 class Scene {
 public:
+    enum class PrimitiveType : uint32_t {
+        SPHERE, CUBE, MESH, INSTANCE
+    };
+
+    struct PrimitiveReference {
+        PrimitiveType type;
+        uint32_t index;
+    };
+
+    // Bytes held by the parts of the scene, arenaUsed is the part of the arena the spheres and cubes use.
+    struct MemoryFootprint {
+        size_t arenaUsed;
+        size_t arenaReserved;
+        size_t bvh;
+        size_t meshes;
+        size_t instances;
+        size_t materials;
+
+        size_t total() const {
+            return arenaReserved + bvh + meshes + instances + materials;
+        }
+    };
+
     Scene() {}
 
-    void addSphere(Vector3f center, float radius, Material* material) {
-        spheres.push_back(Sphere(center, radius, material));
+    MaterialId addMaterial(const Lambertian& material) { return materials.add(material); }
+    MaterialId addMaterial(const Metal& material) { return materials.add(material); }
+    MaterialId addMaterial(const LightSource& material) { return materials.add(material); }
+
+    void addSphere(Vector3f center, float radius, MaterialId material) {
+        spheres.add(arena, center, radius, material);
+        bvh.clear();
+    }
+
+    // size is the edge length
+    void addCube(Vector3f center, MaterialId material, float size = 1) {
+        cubes.add(arena, center, size, Matrix3f::Identity(), material);
+        bvh.clear();
+    }
+
+    // Sizes the arena for the given number of spheres and cubes, so a scene of known size lives in
+    // a single block.
+    void reserve(uint32_t sphereCount, uint32_t cubeCount) {
+        const auto arrayBytes = [](uint32_t count) {
+            const size_t padded = (count + ArenaArray<float>::simdPadding - 1) / ArenaArray<float>::simdPadding * ArenaArray<float>::simdPadding;
+            return (padded * sizeof(float) + MemoryArena::alignment - 1) / MemoryArena::alignment * MemoryArena::alignment;
+        };
+        arena.reserve(5 * arrayBytes(sphereCount) + 14 * arrayBytes(cubeCount));
+        spheres.reserve(arena, sphereCount);
+        cubes.reserve(arena, cubeCount);
+    }
+
+    // Removes every object and material, the spheres and cubes go with a single release of the arena.
+    void clear() {
+        spheres.reset();
+        cubes.reset();
+        arena.release();
+        meshes.clear();
+        geometries.clear();
+        instances.clear();
+        materials.clear();
+        primitives.clear();
+        primitiveBounds.clear();
+        movedPrimitives.clear();
+        bvh.clear();
+    }
+
+    MemoryFootprint memoryFootprint() const {
+        MemoryFootprint footprint{ arena.bytesUsed(), arena.bytesReserved(), bvh.memoryBytes() + primitives.capacity() * sizeof(PrimitiveReference),
+                                   0, instances.capacity() * sizeof(MeshInstance), materials.memoryBytes() };
+        for (const std::vector<TriangleMesh>* list : { &meshes, &geometries }) {
+            for (const TriangleMesh& mesh : *list) {
+                footprint.meshes += sizeof(TriangleMesh) + mesh.memoryBytes();
+            }
+        }
+        return footprint;
+    }
+
+    AlignedBox3f bounds(const PrimitiveReference& primitive) const {
+        switch (primitive.type) {
+            case PrimitiveType::SPHERE: return sphere(primitive.index).bounds();
+            case PrimitiveType::CUBE: return cube(primitive.index).bounds();
+            case PrimitiveType::MESH: return meshes[primitive.index].bounds();
+            case PrimitiveType::INSTANCE: return instances[primitive.index].bounds(geometries[instances[primitive.index].geometry]);
+        }
+        return {};
+    }
+
+    bool hitInstance(uint32_t index, const Ray& r, float t_min, float t_max, HitRecord& hitRecord) const {
+        const MeshInstance& instance = instances[index];
+        return instance.hit(geometries[instance.geometry], r, t_min, t_max, hitRecord);
+    }
+
+    Sphere sphere(uint32_t index) const {
+        return { spheres.center(index), spheres.radius[index], spheres.material[index] };
     }
 
-    void addCube(Vector3f center, Material* material) {
-        cubes.push_back({ center, material });
+    Cube cube(uint32_t index) const {
+        return { cubes.center(index), cubes.material[index], cubes.getRotation(index), 2 * cubes.halfSize[index] };
+    }
+
+    void addMesh(const SimpleMesh& mesh, MaterialId material) {
+        meshes.emplace_back(mesh, material);
+        bvh.clear();
+    }
+
+    // takes a prepared mesh, for example one mapped from a MeshCache
+    void addMesh(TriangleMesh&& mesh) {
+        meshes.push_back(std::move(mesh));
+        bvh.clear();
+    }
+
+    // Prepares a mesh for instancing without placing it in the scene, returns the geometry index
+    // addInstance takes. The material comes from each instance.
+    uint32_t addGeometry(const SimpleMesh& mesh) {
+        geometries.emplace_back(mesh, MaterialId(0));
+        return uint32_t(geometries.size() - 1);
+    }
+
+    uint32_t addGeometry(TriangleMesh&& mesh) {
+        geometries.push_back(std::move(mesh));
+        return uint32_t(geometries.size() - 1);
+    }
+
+    uint32_t addInstance(uint32_t geometry, const Affine3f& transform, MaterialId material) {
+        instances.emplace_back(geometry, transform, material);
+        bvh.clear();
+        return uint32_t(instances.size() - 1);
+    }
+
+    // the bounds of a cube do not depend on its rotation, so rotating needs no BVH update
+    void rotateCube(uint32_t index, float angle) {
+        Cube rotated = cube(index);
+        rotated.rotate(angle);
+        cubes.setRotation(index, rotated.getRotation());
+    }
+
+    // Moving objects marks them for the next update(), objects that are never moved are never touched.
+    void moveSphere(uint32_t index, const Vector3f& center) {
+        spheres.centerX[index] = center.x(); spheres.centerY[index] = center.y(); spheres.centerZ[index] = center.z();
+        moved(PrimitiveType::SPHERE, index);
+    }
+
+    void moveCube(uint32_t index, const Vector3f& center) {
+        cubes.centerX[index] = center.x(); cubes.centerY[index] = center.y(); cubes.centerZ[index] = center.z();
+        moved(PrimitiveType::CUBE, index);
+    }
+
+    void setInstanceTransform(uint32_t index, const Affine3f& transform) {
+        instances[index] = MeshInstance(instances[index].geometry, transform, instances[index].material);
+        moved(PrimitiveType::INSTANCE, index);
+    }
+
+    // Has to be called after the last object was added, until then hit falls back to testing every object.
+    void build() {
+        primitives.clear();
+        primitiveBounds.clear();
+        movedPrimitives.clear();
+        for (uint32_t index = 0; index < spheres.size(); ++index) {
+            primitives.push_back({ PrimitiveType::SPHERE, index });
+        }
+        for (uint32_t index = 0; index < cubes.size(); ++index) {
+            primitives.push_back({ PrimitiveType::CUBE, index });
+        }
+        for (uint32_t index = 0; index < meshes.size(); ++index) {
+            primitives.push_back({ PrimitiveType::MESH, index });
+        }
+        for (uint32_t index = 0; index < instances.size(); ++index) {
+            primitives.push_back({ PrimitiveType::INSTANCE, index });
+        }
+        firstPrimitive = { 0, uint32_t(spheres.size()), uint32_t(spheres.size() + cubes.size()), uint32_t(spheres.size() + cubes.size() + meshes.size()) };
+        for (const PrimitiveReference& primitive : primitives) {
+            primitiveBounds.push_back(bounds(primitive));
+        }
+        bvh.build(primitiveBounds);
+        lights.build(spheres, materials);
+    }
+
+    // Brings the BVH up to date with the objects moved since the last build or update. Only the
+    // moved objects and the BVH nodes above them are refit, unless the refit tree got
+    // rebuildThreshold times as expensive to traverse as the freshly built one, then the whole
+    // BVH is rebuilt. Returns true if it was rebuilt.
+    bool update(ThreadPool* threadPool = nullptr) {
+        if (bvh.empty()) {
+            build();
+            return true;
+        }
+        if (movedPrimitives.empty()) {
+            return false;
+        }
+        for (uint32_t primitive : movedPrimitives) {
+            primitiveBounds[primitive] = bounds(primitives[primitive]);
+        }
+        bvh.refit(primitiveBounds, movedPrimitives, threadPool);
+        movedPrimitives.clear();
+        if (bvh.sahCost() > rebuildThreshold * bvh.builtSahCost()) {
+            bvh.build(primitiveBounds);
+            return true;
+        }
+        return false;
     }
 
     bool hit(const Ray& r, double t_min, double t_max, HitRecord& hitRecord) const {
+        if (bvh.empty()) {
+            return hitLinear(r, t_min, t_max, hitRecord);
+        }
+
+        HitRecord temp;
+        const auto hitPrimitive = [&](uint32_t primitiveIndex, float& tMax) {
+            const PrimitiveReference& primitive = primitives[primitiveIndex];
+            switch (primitive.type) {
+                case PrimitiveType::SPHERE:
+                    if (!sphere(primitive.index).hit(r, temp)) return false;
+                    temp.material = spheres.material[primitive.index];
+                    break;
+                case PrimitiveType::CUBE:
+                    if (!cube(primitive.index).hit(r, temp)) return false;
+                    temp.material = cubes.material[primitive.index];
+                    break;
+                case PrimitiveType::MESH:
+                    if (!meshes[primitive.index].hit(r, t_min, tMax, temp)) return false;
+                    break;
+                case PrimitiveType::INSTANCE:
+                    if (!hitInstance(primitive.index, r, t_min, tMax, temp)) return false;
+                    break;
+            }
+            if (temp.t <= t_min || temp.t >= tMax) {
+                return false;
+            }
+            tMax = temp.t;
+            hitRecord = temp;
+            return true;
+        };
+
+        return bvh.intersect(r.orig, r.dir, t_min, std::min<double>(t_max, std::numeric_limits<float>::max()), hitPrimitive);
+    }
+
+    // Closest hit of every active lane of the packet, hits[lane] is only written for lanes that hit.
+    // Returns the lanes that hit something.
+    unsigned int hitPacket(const RayPacket& packet, float t_min, HitRecord* hits) const {
+        constexpr uint32_t noHit = std::numeric_limits<uint32_t>::max();
+        std::array<uint32_t, RayPacket::width> closest;
+        closest.fill(noHit);
+        if (bvh.empty()) {
+            // without build() every lane is tested against every object, like hit() does
+            unsigned int hitLanes = 0;
+            for (unsigned int lane = 0; lane < RayPacket::width; ++lane) {
+                if (packet.active(lane) && hitLinear(packet.ray(lane), t_min, std::numeric_limits<float>::max(), hits[lane])) {
+                    hitLanes |= 1u << lane;
+                }
+            }
+            return hitLanes;
+        }
+
+        alignas(32) float laneMax[RayPacket::width];
+        for (unsigned int lane = 0; lane < RayPacket::width; ++lane) {
+            laneMax[lane] = packet.active(lane) ? std::numeric_limits<float>::max() : -std::numeric_limits<float>::infinity();
+        }
+        const PacketVectors rays(packet);
+        const SimdFloat tMin(t_min);
+        SimdFloat tMax = SimdFloat::load(laneMax);
+
+        intersectPacket(bvh, rays, tMin, tMax, [&](uint32_t first, uint32_t count, SimdFloat& tMax) {
+            Stats::count(Counter::PACKET_TESTS, count);
+            for (uint32_t index = first; index < first + count; ++index) {
+                const uint32_t primitiveIndex = bvh.primitiveIndices[index];
+                const PrimitiveReference& primitive = primitives[primitiveIndex];
+                unsigned int hitLanes = 0;
+                switch (primitive.type) {
+                    case PrimitiveType::SPHERE:
+                        hitLanes = hitSpherePacket(rays, spheres, primitive.index, tMin, tMax).bits();
+                        break;
+                    case PrimitiveType::CUBE:
+                        hitLanes = hitCubePacket(rays, cubes, primitive.index, tMin, tMax).bits();
+                        break;
+                    case PrimitiveType::MESH:
+                    case PrimitiveType::INSTANCE: {
+                        // meshes have their own BVH, they are traversed one ray at a time
+                        alignas(32) float distances[RayPacket::width];
+                        tMax.store(distances);
+                        for (unsigned int lane = 0; lane < RayPacket::width; ++lane) {
+                            if (!packet.active(lane)) {
+                                continue;
+                            }
+                            const bool hitMesh = primitive.type == PrimitiveType::MESH
+                                ? meshes[primitive.index].hit(packet.ray(lane), t_min, distances[lane], hits[lane])
+                                : hitInstance(primitive.index, packet.ray(lane), t_min, distances[lane], hits[lane]);
+                            if (hitMesh) {
+                                distances[lane] = float(hits[lane].t);
+                                hitLanes |= 1u << lane;
+                            }
+                        }
+                        tMax = SimdFloat::load(distances);
+                        break;
+                    }
+                }
+                for (unsigned int lane = 0; lane < RayPacket::width; ++lane) {
+                    if (hitLanes & (1u << lane)) {
+                        closest[lane] = primitiveIndex;
+                    }
+                }
+            }
+        });
+
+        unsigned int hitLanes = 0;
+        for (unsigned int lane = 0; lane < RayPacket::width; ++lane) {
+            if (closest[lane] == noHit) {
+                continue;
+            }
+            const PrimitiveReference& primitive = primitives[closest[lane]];
+            const Ray ray = packet.ray(lane);
+            switch (primitive.type) {
+                case PrimitiveType::SPHERE:
+                    sphere(primitive.index).hit(ray, hits[lane]);
+                    hits[lane].material = spheres.material[primitive.index];
+                    break;
+                case PrimitiveType::CUBE:
+                    cube(primitive.index).hit(ray, hits[lane]);
+                    hits[lane].material = cubes.material[primitive.index];
+                    break;
+                case PrimitiveType::MESH:
+                case PrimitiveType::INSTANCE:
+                    // the record was filled during traversal
+                    break;
+            }
+            hitLanes |= 1u << lane;
+        }
+        return hitLanes;
+    }
+
+    // Next event estimation at a hit of a material that samplesLights: the light of one sampled
+    // emissive sphere reaching the hit through a shadow ray, weighted against the chance that the
+    // direction scattered by the material finds the same light. Draws three numbers from threadRandom.
+    Vector3f sampleDirectLight(const HitRecord& hitRecord) const {
+        Ray shadowRay;
+        float distance;
+        Vector3f contribution;
+        if (!sampleLight(hitRecord, shadowRay, distance, contribution) || occluded(shadowRay, distance)) {
+            return Vector3f::Zero();
+        }
+        return contribution;
+    }
+
+    // First half of sampleDirectLight: the shadow ray toward a sampled light, the distance to the
+    // light and the contribution if nothing blocks the ray. Returns false if there is nothing to trace.
+    bool sampleLight(const HitRecord& hitRecord, Ray& shadowRay, float& distance, Vector3f& contribution) const {
+        if (lights.empty()) {
+            return false;
+        }
+        const float u0 = threadRandom.nextFloat(), u1 = threadRandom.nextFloat(), u2 = threadRandom.nextFloat();
+        LightSample sample;
+        if (!lights.sample(spheres, hitRecord.p, u0, u1, u2, sample)) {
+            return false;
+        }
+        const Vector3f reflected = materials.evaluate(hitRecord, sample.direction);
+        if (reflected.isZero()) {
+            return false;
+        }
+        const float weight = SphereLights::misWeight(sample.pdf, materials.scatterPdf(hitRecord, sample.direction));
+        contribution = (weight / sample.pdf) * reflected.cwiseProduct(materials.emit(sample.material));
+        shadowRay = Ray(hitRecord.p, sample.direction);
+        distance = sample.distance;
+        return true;
+    }
+
+    // true if anything lies on the normalized ray before the light at distance
+    bool occluded(const Ray& shadowRay, float distance) const {
+        Stats::count(Counter::SHADOW_RAYS);
+        HitRecord blocker;
+        return hit(shadowRay, 0.001, distance * (1 - 1e-3f), blocker);
+    }
+
+    // weight of the emission found by a ray scattered with density scatterPdf, 0 for camera rays and
+    // mirror like bounces that light sampling cannot produce
+    float emissionWeight(const Ray& ray, float t, float scatterPdf) const {
+        return scatterPdf > 0 ? SphereLights::misWeight(scatterPdf, lights.pdf(spheres, ray.orig, ray.dir, t)) : 1.f;
+    }
+
+    bool hitLinear(const Ray& r, double t_min, double t_max, HitRecord& hitRecord) const {
         float minDistance = std::numeric_limits<float>::max();
         bool hitSomething = false;
         HitRecord temp;
-        for (const Sphere& sphere : spheres) {
+        for (uint32_t index = 0; index < spheres.size(); ++index) {
+            const Sphere sphere = this->sphere(index);
             if (sphere.hit(r, temp) && temp.t < minDistance && t_min < temp.t && temp.t < t_max) {
                 minDistance = temp.t;
                 hitSomething = true;
@@ -242,7 +497,8 @@ public:
             }
         }
 
-        for (const Cube& cube: cubes) {
+        for (uint32_t index = 0; index < cubes.size(); ++index) {
+            const Cube cube = this->cube(index);
             if (cube.hit(r, temp) && temp.t < minDistance && t_min < temp.t && temp.t < t_max) {
                 minDistance = temp.t;
                 hitSomething = true;
@@ -251,11 +507,54 @@ public:
             }
         }
 
+        for (const TriangleMesh& mesh : meshes) {
+            if (mesh.hit(r, t_min, minDistance, temp) && temp.t < t_max) {
+                minDistance = temp.t;
+                hitSomething = true;
+                hitRecord = temp;
+            }
+        }
+
+        for (uint32_t index = 0; index < instances.size(); ++index) {
+            if (hitInstance(index, r, t_min, minDistance, temp) && temp.t < t_max) {
+                minDistance = temp.t;
+                hitSomething = true;
+                hitRecord = temp;
+            }
+        }
+
         return hitSomething;
     };
 
 
 public:
-    std::vector<Sphere> spheres;
-    std::vector<Cube> cubes;
+    MaterialTable materials;
+    // owns the memory of spheres and cubes
+    MemoryArena arena;
+    SphereArrays spheres;
+    CubeArrays cubes;
+    std::vector<TriangleMesh> meshes;
+    // meshes shared by the instances, in object space
+    std::vector<TriangleMesh> geometries;
+    std::vector<MeshInstance> instances;
+    std::vector<PrimitiveReference> primitives;
+    BVH bvh;
+    // emissive spheres for light sampling, collected by build()
+    SphereLights lights;
+
+private:
+    // objects moved after the BVH was built, before that there is nothing to update
+    void moved(PrimitiveType type, uint32_t index) {
+        if (!bvh.empty()) {
+            movedPrimitives.push_back(firstPrimitive[uint32_t(type)] + index);
+        }
+    }
+
+    // the refit BVH may cost this much more than a fresh one before update() rebuilds it
+    static constexpr float rebuildThreshold = 1.5f;
+
+    std::vector<AlignedBox3f> primitiveBounds;
+    std::vector<uint32_t> movedPrimitives;
+    // index of the first primitive of every PrimitiveType
+    std::array<uint32_t, 4> firstPrimitive{};
 };
\ No newline at end of file
@@ -0,0 +1,313 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <filesystem>
+#include "Eigen/Dense"
+#include "sceneDescription.h"
+#include "cpu_version/threadPool.h"
+#include "cpu_version/mappedFile.h"
+#include "cpu_version/meshCache.h"
+
+using namespace Eigen;
+
+// Compiled form of a scene file, mapped as a whole when a render starts. The header holds the
+// camera and render settings, after it follow the sections, each starting at a multiple of
+// MeshCacheHeader::sectionAlignment:
+//   materials  materialCount SceneCacheMaterials
+//   spheres    sphereCount SceneCacheSpheres
+//   cubes      cubeCount SceneCacheCubes
+//   meshes     meshCount SceneCacheMeshes, each locating a complete mesh cache further down
+//   instances  instanceCount SceneCacheInstances with their final transforms
+// The embedded mesh caches carry their BVHs, so no mesh is parsed, preprocessed or built when the
+// scene is opened. Only the small top level BVH over the objects is built by the renderer.
+struct SceneCacheHeader {
+    static constexpr char magicValue[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', 0 };
+    static constexpr uint32_t currentVersion = 1;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    float cameraPosition[3];
+    float cameraDirection[3];
+    float cameraUp[3];
+    float focalLength;
+    uint32_t width;
+    uint32_t height;
+    uint32_t samplesPerPixel;
+    uint32_t maxDepth;
+    uint32_t passes;
+    // 0 recursive, 1 wavefront
+    uint32_t integrator;
+    uint64_t seed;
+    uint64_t materialCount;
+    uint64_t sphereCount;
+    uint64_t cubeCount;
+    uint64_t meshCount;
+    uint64_t instanceCount;
+    uint64_t materialsOffset;
+    uint64_t spheresOffset;
+    uint64_t cubesOffset;
+    uint64_t meshesOffset;
+    uint64_t instancesOffset;
+    uint64_t fileSize;
+};
+
+struct SceneCacheMaterial {
+    uint32_t type;
+    float color[3];
+    float fuzz;
+};
+
+struct SceneCacheSphere {
+    float center[3];
+    float radius;
+    uint32_t material;
+};
+
+struct SceneCacheCube {
+    float center[3];
+    float size;
+    uint32_t material;
+};
+
+struct SceneCacheMesh {
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct SceneCacheInstance {
+    uint32_t mesh;
+    uint32_t material;
+    // the 3x4 affine matrix, column major
+    float transform[12];
+};
+
+// A scene description with every mesh file mapped, what both renderers build their scenes from.
+// meshes[index] holds description.meshFiles[index], and the transforms of fitted instances are
+// resolved, so no instance is marked fit anymore.
+struct LoadedScene {
+    // Maps a compiled .rtscene file, or reads a scene file and maps the cache of every mesh it
+    // names, importing and caching the meshes that have no up to date FILE.rtmesh yet.
+    bool load(const std::string& path, std::string& error, ThreadPool* threadPool = nullptr) {
+        description = SceneDescription();
+        meshes.clear();
+        if (std::filesystem::path(path).extension() == ".rtscene") {
+            if (!openCache(path)) {
+                error = path + " is not a valid compiled scene";
+                return false;
+            }
+            return true;
+        }
+        if (!description.load(path, error)) {
+            return false;
+        }
+        meshes.resize(description.meshFiles.size());
+        for (size_t mesh = 0; mesh < meshes.size(); ++mesh) {
+            const std::string& file = description.meshFiles[mesh];
+            const bool isCache = std::filesystem::path(file).extension() == ".rtmesh";
+            if (!(isCache ? meshes[mesh].open(file) : meshes[mesh].openOrCreate(file, file + ".rtmesh", threadPool))) {
+                error = "could not load " + file;
+                return false;
+            }
+        }
+        for (SceneDescription::MeshInstance& instance : description.meshInstances) {
+            if (instance.fit) {
+                instance.transform = SceneDescription::resolveTransform(instance, bounds(meshes[instance.mesh]));
+                instance.fit = false;
+            }
+        }
+        return true;
+    }
+
+    static AlignedBox3f bounds(const MeshCache& mesh) {
+        AlignedBox3f box;
+        const float* positions = mesh.positions();
+        for (size_t vertex = 0; vertex < mesh.vertexCount(); ++vertex) {
+            box.extend(Vector3f{ positions[vertex * 3], positions[vertex * 3 + 1], positions[vertex * 3 + 2] });
+        }
+        return box;
+    }
+
+    SceneDescription description;
+    std::vector<MeshCache> meshes;
+
+private:
+    bool openCache(const std::string& path) {
+        auto mapping = std::make_shared<MappedFile>();
+        if (!mapping->open(path) || mapping->size() < sizeof(SceneCacheHeader)) {
+            return false;
+        }
+        const std::byte* data = mapping->data();
+        const SceneCacheHeader& header = *reinterpret_cast<const SceneCacheHeader*>(data);
+        const uint64_t fileSize = mapping->size();
+        const auto fits = [&](uint64_t offset, uint64_t count, uint64_t elementSize) {
+            return offset % MeshCacheHeader::sectionAlignment == 0 && offset <= fileSize && count <= (fileSize - offset) / elementSize;
+        };
+        if (std::memcmp(header.magic, SceneCacheHeader::magicValue, sizeof(header.magic)) != 0
+            || header.version != SceneCacheHeader::currentVersion || header.byteOrder != MeshCacheHeader::byteOrderValue
+            || header.fileSize != fileSize || header.integrator > 1
+            || !fits(header.materialsOffset, header.materialCount, sizeof(SceneCacheMaterial))
+            || !fits(header.spheresOffset, header.sphereCount, sizeof(SceneCacheSphere))
+            || !fits(header.cubesOffset, header.cubeCount, sizeof(SceneCacheCube))
+            || !fits(header.meshesOffset, header.meshCount, sizeof(SceneCacheMesh))
+            || !fits(header.instancesOffset, header.instanceCount, sizeof(SceneCacheInstance))) {
+            return false;
+        }
+
+        SceneDescription::Camera& camera = description.camera;
+        camera.position = Map<const Vector3f>(header.cameraPosition);
+        camera.direction = Map<const Vector3f>(header.cameraDirection);
+        camera.up = Map<const Vector3f>(header.cameraUp);
+        camera.focalLength = header.focalLength;
+        SceneDescription::RenderSettings& settings = description.settings;
+        settings.width = header.width;
+        settings.height = header.height;
+        settings.samplesPerPixel = header.samplesPerPixel;
+        settings.maxDepth = header.maxDepth;
+        settings.passes = header.passes;
+        settings.seed = header.seed;
+        settings.integrator = header.integrator == 1 ? "wavefront" : "recursive";
+
+        const auto* materials = reinterpret_cast<const SceneCacheMaterial*>(data + header.materialsOffset);
+        for (uint64_t index = 0; index < header.materialCount; ++index) {
+            if (materials[index].type > uint32_t(SceneDescription::MaterialType::LIGHT)) {
+                return false;
+            }
+            description.materials.push_back({ "", SceneDescription::MaterialType(materials[index].type),
+                                              Map<const Vector3f>(materials[index].color), materials[index].fuzz });
+        }
+        const auto* spheres = reinterpret_cast<const SceneCacheSphere*>(data + header.spheresOffset);
+        for (uint64_t index = 0; index < header.sphereCount; ++index) {
+            description.spheres.push_back({ Map<const Vector3f>(spheres[index].center), spheres[index].radius, spheres[index].material });
+        }
+        const auto* cubes = reinterpret_cast<const SceneCacheCube*>(data + header.cubesOffset);
+        for (uint64_t index = 0; index < header.cubeCount; ++index) {
+            description.cubes.push_back({ Map<const Vector3f>(cubes[index].center), cubes[index].size, cubes[index].material });
+        }
+        const auto* meshTable = reinterpret_cast<const SceneCacheMesh*>(data + header.meshesOffset);
+        meshes.resize(header.meshCount);
+        for (uint64_t index = 0; index < header.meshCount; ++index) {
+            if (!meshes[index].open(mapping, meshTable[index].offset, meshTable[index].size)) {
+                return false;
+            }
+            description.meshFiles.push_back(path + "#" + std::to_string(index));
+        }
+        const auto* instances = reinterpret_cast<const SceneCacheInstance*>(data + header.instancesOffset);
+        for (uint64_t index = 0; index < header.instanceCount; ++index) {
+            SceneDescription::MeshInstance instance{ instances[index].mesh, instances[index].material, false, Affine3f::Identity() };
+            instance.transform.matrix().topRows<3>() = Map<const Matrix<float, 3, 4>>(instances[index].transform);
+            description.meshInstances.push_back(instance);
+        }
+
+        const auto validMaterial = [&](uint32_t material) { return material < header.materialCount; };
+        for (const auto& sphere : description.spheres) {
+            if (!validMaterial(sphere.material)) return false;
+        }
+        for (const auto& cube : description.cubes) {
+            if (!validMaterial(cube.material) || !(cube.size > 0)) return false;
+        }
+        for (const auto& instance : description.meshInstances) {
+            if (!validMaterial(instance.material) || instance.mesh >= header.meshCount) return false;
+        }
+        return true;
+    }
+};
+
+// Writes scene as a compiled scene, the mesh caches it maps are copied into the file.
+inline bool writeSceneCache(const std::string& path, const LoadedScene& scene) {
+    const SceneDescription& description = scene.description;
+    const auto align = [](uint64_t offset) {
+        return (offset + MeshCacheHeader::sectionAlignment - 1) / MeshCacheHeader::sectionAlignment * MeshCacheHeader::sectionAlignment;
+    };
+
+    SceneCacheHeader header = {};
+    std::memcpy(header.magic, SceneCacheHeader::magicValue, sizeof(header.magic));
+    header.version = SceneCacheHeader::currentVersion;
+    header.byteOrder = MeshCacheHeader::byteOrderValue;
+    Map<Vector3f>(header.cameraPosition) = description.camera.position;
+    Map<Vector3f>(header.cameraDirection) = description.camera.direction;
+    Map<Vector3f>(header.cameraUp) = description.camera.up;
+    header.focalLength = description.camera.focalLength;
+    header.width = description.settings.width;
+    header.height = description.settings.height;
+    header.samplesPerPixel = description.settings.samplesPerPixel;
+    header.maxDepth = description.settings.maxDepth;
+    header.passes = description.settings.passes;
+    header.integrator = description.settings.integrator == "wavefront" ? 1 : 0;
+    header.seed = description.settings.seed;
+    header.materialCount = description.materials.size();
+    header.sphereCount = description.spheres.size();
+    header.cubeCount = description.cubes.size();
+    header.meshCount = scene.meshes.size();
+    header.instanceCount = description.meshInstances.size();
+    header.materialsOffset = align(sizeof(SceneCacheHeader));
+    header.spheresOffset = align(header.materialsOffset + header.materialCount * sizeof(SceneCacheMaterial));
+    header.cubesOffset = align(header.spheresOffset + header.sphereCount * sizeof(SceneCacheSphere));
+    header.meshesOffset = align(header.cubesOffset + header.cubeCount * sizeof(SceneCacheCube));
+    header.instancesOffset = align(header.meshesOffset + header.meshCount * sizeof(SceneCacheMesh));
+    uint64_t end = header.instancesOffset + header.instanceCount * sizeof(SceneCacheInstance);
+
+    std::vector<SceneCacheMesh> meshTable(scene.meshes.size());
+    for (size_t mesh = 0; mesh < meshTable.size(); ++mesh) {
+        meshTable[mesh] = { align(end), scene.meshes[mesh].fileSize() };
+        end = meshTable[mesh].offset + meshTable[mesh].size;
+    }
+    header.fileSize = end;
+
+    std::vector<SceneCacheMaterial> materials;
+    for (const SceneDescription::Material& material : description.materials) {
+        materials.push_back({ uint32_t(material.type), { material.color.x(), material.color.y(), material.color.z() }, material.fuzz });
+    }
+    std::vector<SceneCacheSphere> spheres;
+    for (const SceneDescription::Sphere& sphere : description.spheres) {
+        spheres.push_back({ { sphere.center.x(), sphere.center.y(), sphere.center.z() }, sphere.radius, sphere.material });
+    }
+    std::vector<SceneCacheCube> cubes;
+    for (const SceneDescription::Cube& cube : description.cubes) {
+        cubes.push_back({ { cube.center.x(), cube.center.y(), cube.center.z() }, cube.size, cube.material });
+    }
+    std::vector<SceneCacheInstance> instances;
+    for (const SceneDescription::MeshInstance& instance : description.meshInstances) {
+        SceneCacheInstance stored{ instance.mesh, instance.material, {} };
+        Map<Matrix<float, 3, 4>>(stored.transform) = SceneDescription::resolveTransform(instance, LoadedScene::bounds(scene.meshes[instance.mesh])).matrix().topRows<3>();
+        instances.push_back(stored);
+    }
+
+    // written to a temporary file first, so a reader never maps a half written scene
+    const std::string temporaryPath = path + ".tmp";
+    std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        return false;
+    }
+    uint64_t position = 0;
+    const auto write = [&](uint64_t offset, const void* data, size_t bytes) {
+        static const char zeros[MeshCacheHeader::sectionAlignment] = {};
+        file.write(zeros, std::streamsize(offset - position));
+        file.write(static_cast<const char*>(data), std::streamsize(bytes));
+        position = offset + bytes;
+    };
+
+    write(0, &header, sizeof(header));
+    write(header.materialsOffset, materials.data(), materials.size() * sizeof(SceneCacheMaterial));
+    write(header.spheresOffset, spheres.data(), spheres.size() * sizeof(SceneCacheSphere));
+    write(header.cubesOffset, cubes.data(), cubes.size() * sizeof(SceneCacheCube));
+    write(header.meshesOffset, meshTable.data(), meshTable.size() * sizeof(SceneCacheMesh));
+    write(header.instancesOffset, instances.data(), instances.size() * sizeof(SceneCacheInstance));
+    for (size_t mesh = 0; mesh < meshTable.size(); ++mesh) {
+        write(meshTable[mesh].offset, scene.meshes[mesh].data(), size_t(meshTable[mesh].size));
+    }
+    file.close();
+    if (!file) {
+        std::remove(temporaryPath.c_str());
+        return false;
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, path, error);
+    return !error;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "Eigen/Dense"
+#include "cpu_version/scene.h"
+#include "cpu_version/sceneCache.h"
+
+using namespace Eigen;
+
+// Replaces the objects of scene with those of a loaded scene and builds it. Every mesh file becomes
+// one geometry shared by its instances.
+inline void buildScene(Scene& scene, const LoadedScene& loaded) {
+    const SceneDescription& description = loaded.description;
+    scene.clear();
+    scene.reserve(uint32_t(description.spheres.size()), uint32_t(description.cubes.size()));
+    std::vector<MaterialId> materials;
+    for (const SceneDescription::Material& material : description.materials) {
+        switch (material.type) {
+            case SceneDescription::MaterialType::LAMBERTIAN: materials.push_back(scene.addMaterial(Lambertian(material.color))); break;
+            case SceneDescription::MaterialType::METAL: materials.push_back(scene.addMaterial(Metal(material.color, material.fuzz))); break;
+            case SceneDescription::MaterialType::LIGHT: materials.push_back(scene.addMaterial(LightSource(material.color))); break;
+        }
+    }
+    for (const SceneDescription::Sphere& sphere : description.spheres) {
+        scene.addSphere(sphere.center, sphere.radius, materials[sphere.material]);
+    }
+    for (const SceneDescription::Cube& cube : description.cubes) {
+        scene.addCube(cube.center, materials[cube.material], cube.size);
+    }
+    std::vector<uint32_t> geometries;
+    for (const MeshCache& mesh : loaded.meshes) {
+        geometries.push_back(scene.addGeometry(mesh.triangleMesh(0)));
+    }
+    for (const SceneDescription::MeshInstance& instance : description.meshInstances) {
+        scene.addInstance(geometries[instance.mesh], instance.transform, materials[instance.material]);
+    }
+    scene.build();
+}
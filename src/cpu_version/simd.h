@@ -0,0 +1,140 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+// Minimal float vector used by the packet kernels: 8 lanes with AVX, 4 lanes with SSE and a plain
+// 4 lane array everywhere else. SimdMask holds the result of a lane wise comparison.
+
+#if defined(__AVX__)
+
+struct SimdMask {
+    __m256 v;
+    SimdMask operator&(SimdMask other) const { return { _mm256_and_ps(v, other.v) }; }
+    SimdMask operator|(SimdMask other) const { return { _mm256_or_ps(v, other.v) }; }
+    SimdMask andNot(SimdMask other) const { return { _mm256_andnot_ps(other.v, v) }; }
+    unsigned int bits() const { return (unsigned int)_mm256_movemask_ps(v); }
+    bool any() const { return bits() != 0; }
+};
+
+struct SimdFloat {
+    static constexpr unsigned int width = 8;
+    __m256 v;
+
+    SimdFloat() = default;
+    SimdFloat(__m256 v) : v(v) {}
+    SimdFloat(float value) : v(_mm256_set1_ps(value)) {}
+    static SimdFloat load(const float* values) { return { _mm256_load_ps(values) }; }
+    void store(float* values) const { _mm256_store_ps(values, v); }
+
+    SimdFloat operator+(SimdFloat other) const { return { _mm256_add_ps(v, other.v) }; }
+    SimdFloat operator-(SimdFloat other) const { return { _mm256_sub_ps(v, other.v) }; }
+    SimdFloat operator*(SimdFloat other) const { return { _mm256_mul_ps(v, other.v) }; }
+    SimdFloat operator/(SimdFloat other) const { return { _mm256_div_ps(v, other.v) }; }
+    SimdMask operator<(SimdFloat other) const { return { _mm256_cmp_ps(v, other.v, _CMP_LT_OQ) }; }
+    SimdMask operator<=(SimdFloat other) const { return { _mm256_cmp_ps(v, other.v, _CMP_LE_OQ) }; }
+    SimdMask operator>(SimdFloat other) const { return { _mm256_cmp_ps(v, other.v, _CMP_GT_OQ) }; }
+    SimdMask operator>=(SimdFloat other) const { return { _mm256_cmp_ps(v, other.v, _CMP_GE_OQ) }; }
+
+    friend SimdFloat min(SimdFloat a, SimdFloat b) { return { _mm256_min_ps(a.v, b.v) }; }
+    friend SimdFloat max(SimdFloat a, SimdFloat b) { return { _mm256_max_ps(a.v, b.v) }; }
+    friend SimdFloat sqrt(SimdFloat a) { return { _mm256_sqrt_ps(a.v) }; }
+    // lanes of a where the mask is set, lanes of b elsewhere
+    friend SimdFloat select(SimdMask mask, SimdFloat a, SimdFloat b) { return { _mm256_blendv_ps(b.v, a.v, mask.v) }; }
+};
+
+#elif defined(__SSE2__) || defined(_M_X64)
+
+struct SimdMask {
+    __m128 v;
+    SimdMask operator&(SimdMask other) const { return { _mm_and_ps(v, other.v) }; }
+    SimdMask operator|(SimdMask other) const { return { _mm_or_ps(v, other.v) }; }
+    SimdMask andNot(SimdMask other) const { return { _mm_andnot_ps(other.v, v) }; }
+    unsigned int bits() const { return (unsigned int)_mm_movemask_ps(v); }
+    bool any() const { return bits() != 0; }
+};
+
+struct SimdFloat {
+    static constexpr unsigned int width = 4;
+    __m128 v;
+
+    SimdFloat() = default;
+    SimdFloat(__m128 v) : v(v) {}
+    SimdFloat(float value) : v(_mm_set1_ps(value)) {}
+    static SimdFloat load(const float* values) { return { _mm_load_ps(values) }; }
+    void store(float* values) const { _mm_store_ps(values, v); }
+
+    SimdFloat operator+(SimdFloat other) const { return { _mm_add_ps(v, other.v) }; }
+    SimdFloat operator-(SimdFloat other) const { return { _mm_sub_ps(v, other.v) }; }
+    SimdFloat operator*(SimdFloat other) const { return { _mm_mul_ps(v, other.v) }; }
+    SimdFloat operator/(SimdFloat other) const { return { _mm_div_ps(v, other.v) }; }
+    SimdMask operator<(SimdFloat other) const { return { _mm_cmplt_ps(v, other.v) }; }
+    SimdMask operator<=(SimdFloat other) const { return { _mm_cmple_ps(v, other.v) }; }
+    SimdMask operator>(SimdFloat other) const { return { _mm_cmpgt_ps(v, other.v) }; }
+    SimdMask operator>=(SimdFloat other) const { return { _mm_cmpge_ps(v, other.v) }; }
+
+    friend SimdFloat min(SimdFloat a, SimdFloat b) { return { _mm_min_ps(a.v, b.v) }; }
+    friend SimdFloat max(SimdFloat a, SimdFloat b) { return { _mm_max_ps(a.v, b.v) }; }
+    friend SimdFloat sqrt(SimdFloat a) { return { _mm_sqrt_ps(a.v) }; }
+    friend SimdFloat select(SimdMask mask, SimdFloat a, SimdFloat b) { return { _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)) }; }
+};
+
+#else
+
+struct SimdMask {
+    bool v[4];
+    SimdMask operator&(SimdMask other) const { return { v[0] && other.v[0], v[1] && other.v[1], v[2] && other.v[2], v[3] && other.v[3] }; }
+    SimdMask operator|(SimdMask other) const { return { v[0] || other.v[0], v[1] || other.v[1], v[2] || other.v[2], v[3] || other.v[3] }; }
+    SimdMask andNot(SimdMask other) const { return { v[0] && !other.v[0], v[1] && !other.v[1], v[2] && !other.v[2], v[3] && !other.v[3] }; }
+    unsigned int bits() const { return v[0] | (v[1] << 1) | (v[2] << 2) | (v[3] << 3); }
+    bool any() const { return bits() != 0; }
+};
+
+struct SimdFloat {
+    static constexpr unsigned int width = 4;
+    float v[4];
+
+    SimdFloat() = default;
+    SimdFloat(float value) : v{ value, value, value, value } {}
+    static SimdFloat load(const float* values) { SimdFloat result; std::copy(values, values + width, result.v); return result; }
+    void store(float* values) const { std::copy(v, v + width, values); }
+
+    template<typename Operation>
+    SimdFloat apply(SimdFloat other, Operation&& operation) const {
+        SimdFloat result;
+        for (unsigned int lane = 0; lane < width; ++lane) result.v[lane] = operation(v[lane], other.v[lane]);
+        return result;
+    }
+    template<typename Operation>
+    SimdMask compare(SimdFloat other, Operation&& operation) const {
+        SimdMask result;
+        for (unsigned int lane = 0; lane < width; ++lane) result.v[lane] = operation(v[lane], other.v[lane]);
+        return result;
+    }
+
+    SimdFloat operator+(SimdFloat other) const { return apply(other, [](float a, float b) { return a + b; }); }
+    SimdFloat operator-(SimdFloat other) const { return apply(other, [](float a, float b) { return a - b; }); }
+    SimdFloat operator*(SimdFloat other) const { return apply(other, [](float a, float b) { return a * b; }); }
+    SimdFloat operator/(SimdFloat other) const { return apply(other, [](float a, float b) { return a / b; }); }
+    SimdMask operator<(SimdFloat other) const { return compare(other, [](float a, float b) { return a < b; }); }
+    SimdMask operator<=(SimdFloat other) const { return compare(other, [](float a, float b) { return a <= b; }); }
+    SimdMask operator>(SimdFloat other) const { return compare(other, [](float a, float b) { return a > b; }); }
+    SimdMask operator>=(SimdFloat other) const { return compare(other, [](float a, float b) { return a >= b; }); }
+
+    // same NaN behaviour as minps/maxps: the second operand is returned if either is NaN
+    friend SimdFloat min(SimdFloat a, SimdFloat b) { return a.apply(b, [](float x, float y) { return x < y ? x : y; }); }
+    friend SimdFloat max(SimdFloat a, SimdFloat b) { return a.apply(b, [](float x, float y) { return x > y ? x : y; }); }
+    friend SimdFloat sqrt(SimdFloat a) { return a.apply(a, [](float x, float) { return std::sqrt(x); }); }
+    friend SimdFloat select(SimdMask mask, SimdFloat a, SimdFloat b) {
+        SimdFloat result;
+        for (unsigned int lane = 0; lane < width; ++lane) result.v[lane] = mask.v[lane] ? a.v[lane] : b.v[lane];
+        return result;
+    }
+};
+
+#endif
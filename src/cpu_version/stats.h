@@ -0,0 +1,279 @@
+#pragma once
+#include <array>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <algorithm>
+
+// Per frame performance counters. Every thread counts into its own thread local slot, endFrame()
+// sums the slots of all threads into one Frame and clears them. Counting, the bounce histogram and
+// the phase timers only exist when compiled with RAY_TRACING_STATS (cmake -DENABLE_STATS=ON),
+// otherwise they are empty inline functions and only the frame times are kept.
+#ifdef RAY_TRACING_STATS
+constexpr bool statsEnabled = true;
+#else
+constexpr bool statsEnabled = false;
+#endif
+
+enum class Counter : uint32_t {
+    CAMERA_RAYS, SECONDARY_RAYS, SHADOW_RAYS,
+    // nodes popped and primitives tested by single ray traversals
+    BVH_NODES, PRIMITIVE_TESTS, TRIANGLE_TESTS,
+    // the same for ray packets, counted once per packet
+    PACKET_NODES, PACKET_TESTS,
+    COUNT
+};
+
+enum class Phase : uint32_t {
+    RENDER, SCENE_UPDATE, RESOLVE, DENOISE,
+    // stages of the wavefront integrator
+    INTERSECT, SORT, SCATTER, SHADOWS, EMIT, COMPACT,
+    PRESENT,
+    COUNT
+};
+
+class Stats {
+public:
+    static constexpr size_t counterCount = size_t(Counter::COUNT);
+    static constexpr size_t phaseCount = size_t(Phase::COUNT);
+    // rays of deeper bounces go into the last bucket
+    static constexpr unsigned int maxBounces = 16;
+    // oldest frames are dropped beyond this
+    static constexpr size_t historyLimit = 1 << 16;
+
+    struct Values {
+        std::array<uint64_t, counterCount> counters{};
+        // rays traced per bounce, 0 are the camera rays
+        std::array<uint64_t, maxBounces> bounces{};
+        std::array<uint64_t, phaseCount> phaseNanoseconds{};
+
+        void add(const Values& other) {
+            for (size_t index = 0; index < counterCount; ++index) counters[index] += other.counters[index];
+            for (size_t index = 0; index < maxBounces; ++index) bounces[index] += other.bounces[index];
+            for (size_t index = 0; index < phaseCount; ++index) phaseNanoseconds[index] += other.phaseNanoseconds[index];
+        }
+
+        uint64_t operator[](Counter counter) const { return counters[size_t(counter)]; }
+        double phaseSeconds(Phase phase) const { return phaseNanoseconds[size_t(phase)] * 1e-9; }
+    };
+
+    struct Frame : Values {
+        uint64_t index = 0;
+        // wall time from beginFrame(), or the previous endFrame(), to endFrame()
+        double seconds = 0;
+    };
+
+    static Stats& global() {
+        static Stats stats;
+        return stats;
+    }
+
+    static void count(Counter counter, uint64_t amount = 1) {
+        if constexpr (statsEnabled) {
+            local().counters[size_t(counter)] += amount;
+        }
+    }
+
+    // amount rays traced at bounce, the camera rays being bounce 0
+    static void countRays(unsigned int bounce, uint64_t amount = 1) {
+        if constexpr (statsEnabled) {
+            Values& values = local();
+            values.counters[size_t(bounce == 0 ? Counter::CAMERA_RAYS : Counter::SECONDARY_RAYS)] += amount;
+            values.bounces[std::min(bounce, maxBounces - 1)] += amount;
+        }
+    }
+
+    // Adds the time until the end of the scope to phase, on the thread that opened it.
+    class ScopedPhase {
+    public:
+        explicit ScopedPhase(Phase phase) : phase(phase) {
+            if constexpr (statsEnabled) {
+                start = std::chrono::steady_clock::now();
+            }
+        }
+
+        ~ScopedPhase() {
+            if constexpr (statsEnabled) {
+                const auto elapsed = std::chrono::steady_clock::now() - start;
+                local().phaseNanoseconds[size_t(phase)] += uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+            }
+        }
+
+        ScopedPhase(const ScopedPhase&) = delete;
+        ScopedPhase& operator=(const ScopedPhase&) = delete;
+
+    private:
+        Phase phase;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    void beginFrame() {
+        std::lock_guard<std::mutex> lock(mutex);
+        frameStart = std::chrono::steady_clock::now();
+    }
+
+    // Sums and clears the counts of every thread. Must not overlap with work that counts, call it
+    // between the parallelFor jobs of two frames.
+    Frame endFrame() {
+        std::lock_guard<std::mutex> lock(mutex);
+        const auto now = std::chrono::steady_clock::now();
+        Frame frame;
+        frame.index = frameCount++;
+        frame.seconds = std::chrono::duration<double>(now - frameStart).count();
+        frameStart = now;
+        for (Slot* slot : slots) {
+            frame.add(slot->values);
+            slot->values = Values();
+        }
+        frame.add(retired);
+        retired = Values();
+
+        history.push_back(frame);
+        if (history.size() > historyLimit) {
+            history.pop_front();
+        }
+        totals.add(frame);
+        totalSeconds += frame.seconds;
+        return frame;
+    }
+
+    const std::deque<Frame>& frames() const { return history; }
+    // sums over every frame ended so far, also those dropped from frames()
+    const Values& total() const { return totals; }
+    double totalFrameSeconds() const { return totalSeconds; }
+
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (Slot* slot : slots) {
+            slot->values = Values();
+        }
+        retired = Values();
+        history.clear();
+        totals = Values();
+        totalSeconds = 0;
+        frameCount = 0;
+        frameStart = std::chrono::steady_clock::now();
+    }
+
+    static const char* name(Counter counter) {
+        static const char* names[counterCount] = {
+            "cameraRays", "secondaryRays", "shadowRays", "bvhNodes", "primitiveTests", "triangleTests", "packetNodes", "packetTests"
+        };
+        return names[size_t(counter)];
+    }
+
+    static const char* name(Phase phase) {
+        static const char* names[phaseCount] = {
+            "render", "sceneUpdate", "resolve", "denoise", "intersect", "sort", "scatter", "shadows", "emit", "compact", "present"
+        };
+        return names[size_t(phase)];
+    }
+
+    // One object per frame with its counters, bounce histogram and phase times in seconds,
+    // followed by the totals.
+    bool writeJson(const std::string& path) const {
+        std::ofstream file(path);
+        if (!file.is_open()) {
+            return false;
+        }
+        const auto writeValues = [&](const Values& values) {
+            for (size_t counter = 0; counter < counterCount; ++counter) {
+                file << ", \"" << name(Counter(counter)) << "\": " << values.counters[counter];
+            }
+            file << ", \"bounces\": [";
+            for (unsigned int bounce = 0; bounce < maxBounces; ++bounce) {
+                file << (bounce == 0 ? "" : ", ") << values.bounces[bounce];
+            }
+            file << "], \"phases\": {";
+            for (size_t phase = 0; phase < phaseCount; ++phase) {
+                file << (phase == 0 ? "" : ", ") << "\"" << name(Phase(phase)) << "\": " << values.phaseSeconds(Phase(phase));
+            }
+            file << "}";
+        };
+
+        file << "{\n  \"statsEnabled\": " << (statsEnabled ? "true" : "false") << ",\n  \"frames\": [\n";
+        for (size_t index = 0; index < history.size(); ++index) {
+            const Frame& frame = history[index];
+            file << "    { \"frame\": " << frame.index << ", \"seconds\": " << frame.seconds;
+            writeValues(frame);
+            file << " }" << (index + 1 < history.size() ? "," : "") << "\n";
+        }
+        file << "  ],\n  \"total\": { \"frames\": " << frameCount << ", \"seconds\": " << totalSeconds;
+        writeValues(totals);
+        file << " }\n}\n";
+        return bool(file);
+    }
+
+    // One row per frame, phase times in seconds.
+    bool writeCsv(const std::string& path) const {
+        std::ofstream file(path);
+        if (!file.is_open()) {
+            return false;
+        }
+        file << "frame,seconds";
+        for (size_t counter = 0; counter < counterCount; ++counter) {
+            file << "," << name(Counter(counter));
+        }
+        for (unsigned int bounce = 0; bounce < maxBounces; ++bounce) {
+            file << ",bounce" << bounce;
+        }
+        for (size_t phase = 0; phase < phaseCount; ++phase) {
+            file << "," << name(Phase(phase));
+        }
+        file << "\n";
+        for (const Frame& frame : history) {
+            file << frame.index << "," << frame.seconds;
+            for (uint64_t value : frame.counters) file << "," << value;
+            for (uint64_t value : frame.bounces) file << "," << value;
+            for (size_t phase = 0; phase < phaseCount; ++phase) file << "," << frame.phaseSeconds(Phase(phase));
+            file << "\n";
+        }
+        return bool(file);
+    }
+
+    // picks the format from the extension, .csv or anything else for JSON
+    bool write(const std::string& path) const {
+        const std::string csv = ".csv";
+        const bool isCsv = path.size() >= csv.size() && path.compare(path.size() - csv.size(), csv.size(), csv) == 0;
+        return isCsv ? writeCsv(path) : writeJson(path);
+    }
+
+private:
+    // counts of one thread, registered on first use and folded into retired when the thread exits
+    struct Slot {
+        Values values;
+        Slot() { global().attach(this); }
+        ~Slot() { global().detach(this); }
+    };
+
+    Stats() : frameStart(std::chrono::steady_clock::now()) {}
+
+    static Values& local() {
+        thread_local Slot slot;
+        return slot.values;
+    }
+
+    void attach(Slot* slot) {
+        std::lock_guard<std::mutex> lock(mutex);
+        slots.push_back(slot);
+    }
+
+    void detach(Slot* slot) {
+        std::lock_guard<std::mutex> lock(mutex);
+        retired.add(slot->values);
+        slots.erase(std::remove(slots.begin(), slots.end(), slot), slots.end());
+    }
+
+    std::mutex mutex;
+    std::vector<Slot*> slots;
+    Values retired;
+    std::deque<Frame> history;
+    Values totals;
+    double totalSeconds = 0;
+    uint64_t frameCount = 0;
+    std::chrono::steady_clock::time_point frameStart;
+};
@@ -0,0 +1,182 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <cstdint>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+// keeps windows.h from defining min and max macros, without leaking NOMINMAX to the includers
+#ifndef NOMINMAX
+#define NOMINMAX
+#include <windows.h>
+#undef NOMINMAX
+#else
+#include <windows.h>
+#endif
+#endif
+
+// Fixed set of worker threads that run parallelFor jobs. Every worker owns a deque of task indices:
+// it works through its own deque from the front and, once that is empty, steals from the back of
+// the other deques, so neighbouring tasks tend to stay on the same worker.
+class ThreadPool {
+public:
+    // threadCount 0 uses every hardware thread. With pinThreads worker i runs on core firstCore + i.
+    explicit ThreadPool(unsigned int threadCount = 0, bool pinThreads = false, unsigned int firstCore = 0) {
+        if (threadCount == 0) {
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        }
+        queues.reserve(threadCount);
+        for (unsigned int index = 0; index < threadCount; ++index) {
+            queues.push_back(std::make_unique<WorkQueue>());
+        }
+        workers.reserve(threadCount);
+        for (unsigned int index = 0; index < threadCount; ++index) {
+            workers.emplace_back([this, index]() { workerLoop(index); });
+            if (pinThreads) {
+                pin(workers.back(), firstCore + index);
+            }
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(jobMutex);
+            stopping = true;
+        }
+        jobStarted.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Runs task(index) for every index in [0, count) and returns once all of them finished.
+    // Each worker starts on a contiguous block of indices, so callers should order tasks by locality.
+    void parallelFor(uint32_t count, const std::function<void(uint32_t)>& task) {
+        if (count == 0) {
+            return;
+        }
+
+        const uint32_t workerCount = (uint32_t)workers.size();
+        for (uint32_t worker = 0; worker < workerCount; ++worker) {
+            std::lock_guard<std::mutex> lock(queues[worker]->mutex);
+            const uint32_t first = uint32_t(uint64_t(count) * worker / workerCount);
+            const uint32_t last = uint32_t(uint64_t(count) * (worker + 1) / workerCount);
+            for (uint32_t index = first; index < last; ++index) {
+                queues[worker]->tasks.push_back(index);
+            }
+        }
+
+        std::unique_lock<std::mutex> lock(jobMutex);
+        currentTask = &task;
+        remaining = count;
+        ++generation;
+        jobStarted.notify_all();
+        // wait for the workers to leave the job too, so none of them can pick up tasks of the next
+        // call while still holding this task
+        jobFinished.wait(lock, [this]() { return remaining == 0 && active == 0; });
+        currentTask = nullptr;
+    }
+
+    unsigned int size() const {
+        return (unsigned int)workers.size();
+    }
+
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<uint32_t> tasks;
+    };
+
+    void workerLoop(unsigned int self) {
+        uint64_t seenGeneration = 0;
+        while (true) {
+            const std::function<void(uint32_t)>* task;
+            {
+                std::unique_lock<std::mutex> lock(jobMutex);
+                jobStarted.wait(lock, [&]() { return stopping || generation != seenGeneration; });
+                if (stopping) {
+                    return;
+                }
+                seenGeneration = generation;
+                task = currentTask;
+                if (task == nullptr) {
+                    continue;
+                }
+                ++active;
+            }
+
+            uint32_t finished = 0;
+            uint32_t index;
+            while (popOwn(self, index) || steal(self, index)) {
+                (*task)(index);
+                ++finished;
+            }
+
+            std::lock_guard<std::mutex> lock(jobMutex);
+            remaining -= finished;
+            --active;
+            if (remaining == 0 && active == 0) {
+                jobFinished.notify_all();
+            }
+        }
+    }
+
+    bool popOwn(unsigned int self, uint32_t& index) {
+        WorkQueue& queue = *queues[self];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            return false;
+        }
+        index = queue.tasks.front();
+        queue.tasks.pop_front();
+        return true;
+    }
+
+    bool steal(unsigned int self, uint32_t& index) {
+        const unsigned int workerCount = (unsigned int)queues.size();
+        for (unsigned int offset = 1; offset < workerCount; ++offset) {
+            WorkQueue& victim = *queues[(self + offset) % workerCount];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                index = victim.tasks.back();
+                victim.tasks.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void pin(std::thread& thread, unsigned int core) {
+        const unsigned int coreCount = std::max(1u, std::thread::hardware_concurrency());
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(core % coreCount, &set);
+        pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &set);
+#elif defined(_WIN32)
+        SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << (core % coreCount));
+#endif
+    }
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex jobMutex;
+    std::condition_variable jobStarted;
+    std::condition_variable jobFinished;
+    const std::function<void(uint32_t)>* currentTask = nullptr;
+    uint32_t remaining = 0;
+    unsigned int active = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+};
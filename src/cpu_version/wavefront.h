@@ -0,0 +1,271 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include "Eigen/Dense"
+#include "utils.h"
+#include "cpu_version/scene.h"
+#include "cpu_version/threadPool.h"
+
+using namespace Eigen;
+
+// Rays of one bounce as structure of arrays. path is the index of the camera path the ray belongs
+// to, the throughput is the product of all attenuations along that path so far. scatterPdf is the
+// density with which the last hit scattered the ray, 0 for camera rays and mirror like bounces.
+struct RayQueue {
+    std::vector<float> originX, originY, originZ;
+    std::vector<float> directionX, directionY, directionZ;
+    std::vector<float> throughputR, throughputG, throughputB;
+    std::vector<float> scatterPdf;
+    std::vector<uint32_t> path;
+
+    void resize(size_t count) {
+        for (std::vector<float>* component : { &originX, &originY, &originZ, &directionX, &directionY, &directionZ,
+                                               &throughputR, &throughputG, &throughputB, &scatterPdf }) {
+            component->resize(count);
+        }
+        path.resize(count);
+    }
+
+    size_t size() const {
+        return path.size();
+    }
+
+    Ray ray(size_t index) const {
+        // scattered directions are not always normalized, keep them exactly as the material produced them
+        Ray ray;
+        ray.orig = { originX[index], originY[index], originZ[index] };
+        ray.dir = { directionX[index], directionY[index], directionZ[index] };
+        return ray;
+    }
+
+    void set(size_t index, const Ray& ray, const Vector3f& throughput, uint32_t pathIndex, float pdf = 0) {
+        originX[index] = ray.orig.x(); originY[index] = ray.orig.y(); originZ[index] = ray.orig.z();
+        directionX[index] = ray.dir.x(); directionY[index] = ray.dir.y(); directionZ[index] = ray.dir.z();
+        throughputR[index] = throughput.x(); throughputG[index] = throughput.y(); throughputB[index] = throughput.z();
+        scatterPdf[index] = pdf;
+        path[index] = pathIndex;
+    }
+};
+
+// Closest hits of a RayQueue, one entry per ray.
+struct HitQueue {
+    static constexpr MaterialId noHit = std::numeric_limits<MaterialId>::max();
+
+    std::vector<float> t;
+    std::vector<float> pointX, pointY, pointZ;
+    std::vector<float> normalX, normalY, normalZ;
+    // noHit for rays that left the scene
+    std::vector<MaterialId> material;
+
+    void resize(size_t count) {
+        for (std::vector<float>* component : { &t, &pointX, &pointY, &pointZ, &normalX, &normalY, &normalZ }) {
+            component->resize(count);
+        }
+        material.resize(count);
+    }
+
+    HitRecord record(size_t index) const {
+        HitRecord record;
+        record.t = t[index];
+        record.p = { pointX[index], pointY[index], pointZ[index] };
+        record.normal = { normalX[index], normalY[index], normalZ[index] };
+        record.material = material[index];
+        return record;
+    }
+};
+
+// Path tracer that advances every path of a batch by one bounce at a time. Each bounce runs as
+// separate stages over the whole queue: intersection, grouping of the hits by material, scattering
+// together with the light samples of next event estimation, their shadow rays and emission, so
+// every stage runs one kind of work over contiguous data instead of the whole
+// recursion per ray. Random streams are keyed the same way as RayTracer::ray_color, so both integrators
+// produce the same image for the same seed.
+class WavefrontIntegrator {
+public:
+    static constexpr uint32_t chunkSize = 1024;
+
+    WavefrontIntegrator(const Scene& scene, ThreadPool& threadPool) : scene(scene), threadPool(threadPool) {}
+
+    // Traces the camera rays in primary, path i of the queue belongs to pixel pathPixel[i] and
+    // uses sample pathSample[i] of the random stream. Returns the radiance of every path.
+    const std::vector<Vector3f>& trace(RayQueue& primary, const std::vector<uint32_t>& pathPixel,
+                                       const std::vector<uint64_t>& pathSample, uint64_t seed, int maxDepth,
+                                       bool nextEventEstimation = true) {
+        radiance.assign(primary.size(), Vector3f::Zero());
+        std::swap(current, primary);
+        rays = 0;
+
+        for (int depth = maxDepth; depth >= 0 && current.size() > 0; --depth) {
+            rays += current.size();
+            Stats::countRays(unsigned(maxDepth - depth), current.size());
+            intersect();
+            if (depth == maxDepth) {
+                firstHits = hits;
+            }
+            sortByMaterial();
+            scatter(pathPixel, pathSample, seed, depth, nextEventEstimation);
+            traceShadows();
+            emit();
+            compact();
+        }
+
+        std::swap(current, primary);
+        return radiance;
+    }
+
+    // rays intersected by the last call to trace
+    uint64_t tracedRays() const {
+        return rays;
+    }
+
+    // hits of the camera rays of the last call to trace, indexed like the primary queue
+    const HitQueue& primaryHits() const {
+        return firstHits;
+    }
+
+private:
+    template<typename Stage>
+    void forChunks(size_t count, Stage&& stage) {
+        const uint32_t chunkCount = uint32_t((count + chunkSize - 1) / chunkSize);
+        threadPool.parallelFor(chunkCount, [&](uint32_t chunk) {
+            const size_t first = size_t(chunk) * chunkSize;
+            stage(first, std::min(first + chunkSize, count));
+        });
+    }
+
+    void intersect() {
+        const Stats::ScopedPhase phase(Phase::INTERSECT);
+        hits.resize(current.size());
+        forChunks(current.size(), [this](size_t first, size_t last) {
+            HitRecord record;
+            for (size_t index = first; index < last; ++index) {
+                if (scene.hit(current.ray(index), 0.001, std::numeric_limits<float>::max(), record)) {
+                    hits.t[index] = float(record.t);
+                    hits.pointX[index] = record.p.x(); hits.pointY[index] = record.p.y(); hits.pointZ[index] = record.p.z();
+                    hits.normalX[index] = record.normal.x(); hits.normalY[index] = record.normal.y(); hits.normalZ[index] = record.normal.z();
+                    hits.material[index] = record.material;
+                } else {
+                    hits.material[index] = HitQueue::noHit;
+                }
+            }
+        });
+    }
+
+    // Drops the rays that left the scene and orders the rest by material type and then material, so
+    // the scatter stage runs long stretches of the same branch of MaterialTable::scatter.
+    void sortByMaterial() {
+        const Stats::ScopedPhase phase(Phase::SORT);
+        order.clear();
+        for (uint32_t index = 0; index < current.size(); ++index) {
+            if (hits.material[index] != HitQueue::noHit) {
+                order.push_back(index);
+            }
+        }
+        const MaterialTable& materials = scene.materials;
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            const MaterialType typeA = materials.type(hits.material[a]);
+            const MaterialType typeB = materials.type(hits.material[b]);
+            return typeA != typeB ? typeA < typeB : hits.material[a] < hits.material[b];
+        });
+    }
+
+    // Same order of random numbers as RayTracer::shade: the scattered direction, then the light sample.
+    void scatter(const std::vector<uint32_t>& pathPixel, const std::vector<uint64_t>& pathSample, uint64_t seed, int depth,
+                 bool nextEventEstimation) {
+        const Stats::ScopedPhase phase(Phase::SCATTER);
+        const MaterialTable& materials = scene.materials;
+        next.resize(order.size());
+        scattered.resize(order.size());
+        shadows.resize(order.size());
+        shadowDistance.resize(order.size());
+        forChunks(order.size(), [&](size_t first, size_t last) {
+            Ray ray;
+            Ray shadowRay;
+            Vector3f attenuation;
+            Vector3f contribution;
+            for (size_t slot = first; slot < last; ++slot) {
+                const uint32_t index = order[slot];
+                const uint32_t path = current.path[index];
+                const HitRecord record = hits.record(index);
+                threadRandom = RandomStream(seed, pathPixel[path], pathSample[path]);
+                threadRandom.setBounce(depth);
+                scattered[slot] = materials.scatter(current.ray(index), record, attenuation, ray);
+                // a distance of 0 marks slots without a shadow ray
+                shadowDistance[slot] = 0;
+                if (!scattered[slot]) {
+                    continue;
+                }
+                const Vector3f throughput{ current.throughputR[index], current.throughputG[index], current.throughputB[index] };
+                const bool samplesLight = nextEventEstimation && depth >= 1 && materials.samplesLights(record.material);
+                next.set(slot, ray, throughput.cwiseProduct(attenuation), path, samplesLight ? materials.scatterPdf(record, ray.dir) : 0.f);
+                if (samplesLight && scene.sampleLight(record, shadowRay, shadowDistance[slot], contribution)) {
+                    shadows.set(slot, shadowRay, throughput.cwiseProduct(contribution), path);
+                } else {
+                    shadowDistance[slot] = 0;
+                }
+            }
+        });
+    }
+
+    // Light samples that reach their light add to the radiance of their path.
+    void traceShadows() {
+        const Stats::ScopedPhase phase(Phase::SHADOWS);
+        forChunks(order.size(), [this](size_t first, size_t last) {
+            for (size_t slot = first; slot < last; ++slot) {
+                if (shadowDistance[slot] > 0 && !scene.occluded(shadows.ray(slot), shadowDistance[slot])) {
+                    radiance[shadows.path[slot]] += Vector3f{ shadows.throughputR[slot], shadows.throughputG[slot], shadows.throughputB[slot] };
+                }
+            }
+        });
+    }
+
+    // Paths that were not scattered end on this hit and pick up its emission, weighted against the
+    // light sample of the previous hit.
+    void emit() {
+        const Stats::ScopedPhase phase(Phase::EMIT);
+        forChunks(order.size(), [this](size_t first, size_t last) {
+            for (size_t slot = first; slot < last; ++slot) {
+                if (scattered[slot]) {
+                    continue;
+                }
+                const uint32_t index = order[slot];
+                const Vector3f throughput{ current.throughputR[index], current.throughputG[index], current.throughputB[index] };
+                const float weight = scene.emissionWeight(current.ray(index), hits.t[index], current.scatterPdf[index]);
+                radiance[current.path[index]] += weight * throughput.cwiseProduct(scene.materials.emit(hits.material[index]));
+            }
+        });
+    }
+
+    void compact() {
+        const Stats::ScopedPhase phase(Phase::COMPACT);
+        size_t alive = 0;
+        for (size_t slot = 0; slot < order.size(); ++slot) {
+            if (!scattered[slot]) {
+                continue;
+            }
+            if (alive != slot) {
+                next.set(alive, next.ray(slot), { next.throughputR[slot], next.throughputG[slot], next.throughputB[slot] }, next.path[slot],
+                         next.scatterPdf[slot]);
+            }
+            ++alive;
+        }
+        next.resize(alive);
+        std::swap(current, next);
+    }
+
+    const Scene& scene;
+    ThreadPool& threadPool;
+    RayQueue current;
+    RayQueue next;
+    HitQueue hits;
+    HitQueue firstHits;
+    // light sample of every scattered slot, shadowDistance is 0 where there is none
+    RayQueue shadows;
+    std::vector<float> shadowDistance;
+    std::vector<uint32_t> order;
+    std::vector<char> scattered;
+    std::vector<Vector3f> radiance;
+    uint64_t rays = 0;
+};
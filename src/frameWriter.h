@@ -0,0 +1,143 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include "imageWriter.h"
+
+// Writes the frames of an animation on background threads while the next ones render. Frames go
+// through a fixed set of RGB float buffers: acquire() hands out a free one, submit() queues it to
+// be written under a file name, after which it is free again. With every buffer queued acquire()
+// blocks, so a slow encoder or disk stalls the renderer instead of piling up frames in memory.
+class FrameWriter {
+public:
+    FrameWriter(unsigned int width, unsigned int height, unsigned int bufferCount = 3, unsigned int threadCount = 2)
+        : width(width), height(height) {
+        buffers.resize(std::max(bufferCount, 1u));
+        for (std::vector<float>& buffer : buffers) {
+            buffer.assign(size_t(width) * height * 3, 0.f);
+            freeBuffers.push_back(buffer.data());
+        }
+        for (unsigned int index = 0; index < std::max(threadCount, 1u); ++index) {
+            writers.emplace_back([this]() { writerLoop(); });
+        }
+    }
+
+    ~FrameWriter() {
+        finish();
+    }
+
+    FrameWriter(const FrameWriter&) = delete;
+    FrameWriter& operator=(const FrameWriter&) = delete;
+
+    // a buffer of width x height packed RGB floats, in the format writeImage() takes
+    float* acquire() {
+        const auto start = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(mutex);
+        bufferFreed.wait(lock, [this]() { return !freeBuffers.empty(); });
+        float* buffer = freeBuffers.front();
+        freeBuffers.pop_front();
+        waited += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return buffer;
+    }
+
+    void submit(float* buffer, const std::string& path) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queued.push_back({ buffer, path });
+        }
+        frameQueued.notify_one();
+    }
+
+    // Waits until every queued frame is written and stops the threads, returns false if a frame
+    // could not be written.
+    bool finish() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        frameQueued.notify_all();
+        for (std::thread& writer : writers) {
+            writer.join();
+        }
+        writers.clear();
+        return failed.empty();
+    }
+
+    // seconds acquire() waited for a free buffer, the time the renderer lost to writing
+    double waitSeconds() const { return waited; }
+    // seconds the threads spent encoding and writing, summed over the threads
+    double writeSeconds() const { return writing; }
+    const std::vector<std::string>& failedFrames() const { return failed; }
+
+private:
+    struct Frame {
+        float* pixels;
+        std::string path;
+    };
+
+    void writerLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            frameQueued.wait(lock, [this]() { return stopping || !queued.empty(); });
+            if (queued.empty()) {
+                return;
+            }
+            const Frame frame = queued.front();
+            queued.pop_front();
+            lock.unlock();
+            const auto start = std::chrono::steady_clock::now();
+            const bool written = writeImage(frame.path, frame.pixels, width, height);
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            lock.lock();
+            writing += seconds;
+            if (!written) {
+                failed.push_back(frame.path);
+            }
+            freeBuffers.push_back(frame.pixels);
+            bufferFreed.notify_one();
+        }
+    }
+
+    unsigned int width;
+    unsigned int height;
+    std::vector<std::vector<float>> buffers;
+    std::deque<float*> freeBuffers;
+    std::deque<Frame> queued;
+    std::vector<std::thread> writers;
+    std::vector<std::string> failed;
+    std::mutex mutex;
+    std::condition_variable bufferFreed;
+    std::condition_variable frameQueued;
+    bool stopping = false;
+    double waited = 0;
+    double writing = 0;
+};
+
+// The file of frame number frame: a %d or %0Nd in pattern is replaced by the number, without one
+// the number goes in front of the extension as _0000.
+inline std::string framePath(const std::string& pattern, unsigned int frame) {
+    const auto number = [frame](unsigned int digits) {
+        std::string text = std::to_string(frame);
+        return std::string(digits > text.size() ? digits - text.size() : 0, '0') + text;
+    };
+    const size_t percent = pattern.find('%');
+    if (percent != std::string::npos) {
+        size_t end = percent + 1;
+        while (end < pattern.size() && pattern[end] >= '0' && pattern[end] <= '9') {
+            ++end;
+        }
+        if (end < pattern.size() && pattern[end] == 'd') {
+            const unsigned int digits = end > percent + 1 ? unsigned(std::stoul(pattern.substr(percent + 1, end - percent - 1))) : 0;
+            return pattern.substr(0, percent) + number(digits) + pattern.substr(end + 1);
+        }
+    }
+    const size_t dot = pattern.rfind('.');
+    const size_t slash = pattern.find_last_of("/\\");
+    const size_t split = dot == std::string::npos || (slash != std::string::npos && dot < slash) ? pattern.size() : dot;
+    return pattern.substr(0, split) + "_" + number(4) + pattern.substr(split);
+}
@@ -1,9 +1,10 @@
 #pragma once
 #include "Eigen/Dense"
 #include <array>
-#include "glad/glad.h"
+#include <cmath>
+#include <cstring>
+#include <iostream>
 #include <functional>
-#include "GLFW/glfw3.h"
 
 class Camera {
 public:
@@ -23,7 +24,7 @@ public:
 		worldWidth = width * (1 / sqrt(width * height));
 		worldHeight = height * (1 / sqrt(width * height));
 		setWorldStep(worldWidth / width);
-		setUpperLeft(Vector3f{ -worldWidth / 2, worldHeight / 2, -focalLength } + getCameraPosition());
+		setUpperLeft(Eigen::Vector3f{ -worldWidth / 2, worldHeight / 2, -focalLength } + getCameraPosition());
 
 	}
 
@@ -91,6 +92,18 @@ public:
 		setUpperLeft((-worldWidth / 2 * getRightDirection()) + (worldHeight / 2 * getUpDirection()) + getCameraDirection() * focalLength + getCameraPosition());
 	}
 
+	// up only has to lie apart from the direction, the image plane keeps its size
+	void lookAt(Eigen::Vector3f&& position, Eigen::Vector3f&& direction, Eigen::Vector3f&& up, float focalLength) {
+		this->focalLength = focalLength;
+		const Eigen::Vector3f forward = direction.normalized();
+		const Eigen::Vector3f right = forward.cross(up).normalized();
+		setCameraPosition(std::move(position));
+		setCameraDirection(Eigen::Vector3f(forward));
+		setRightDirection(Eigen::Vector3f(right));
+		setUpDirection(right.cross(forward));
+		setUpperLeft((-worldWidth / 2 * getRightDirection()) + (worldHeight / 2 * getUpDirection()) + getCameraDirection() * focalLength + getCameraPosition());
+	}
+
 	void move(Direction direction) {
 		switch (direction)
 		{
@@ -112,6 +125,8 @@ public:
 		setUpperLeft((-worldWidth / 2 * getRightDirection()) + (worldHeight / 2 * getUpDirection()) + getCameraDirection() * focalLength + getCameraPosition());
 	}
 
+	// cameraBuffer of RayTracing.glsl in std430: five vec3 at 16 byte strides, position, direction,
+	// upper left corner, up and right, with worldStep in the padding after right
 	constexpr static unsigned int dataSize = 21;
 
 	float data[dataSize];
@@ -0,0 +1,43 @@
+#pragma once
+#include <vector>
+#include <string>
+#include "utils.h"
+#include "SimpleMesh.h"
+#include "gpu_version/shape.h"
+
+// Scene of the interactive renderer, shared with the CPU backend of its compute shader.
+inline void addDefaultShapes(std::vector<Shape>& shapes) {
+	shapes.push_back(Box({ -1, 12, -2 }, { 10, 1, 1 }, Light{ { 1.5, 1.5, 1.5 } }));
+	//shapes.push_back(Circle({ 3, 4.5, -2 }, 1.5, Light{ { 1, 1, 1 } }));
+
+	shapes.push_back(Circle({ 1, 3, -10 }, 1, Lambertian{ { 0, 1, 0 } }));
+	shapes.push_back(Circle({ -1.5, 1.5, -4 }, 0.5, Metal{ { 1, 1, 1} }));
+	shapes.push_back(Circle({ 0, 1, -4 }, 0.5, Lambertian{ { 0.8, 0.8, 0} }));
+
+	shapes.push_back(Circle({ 1.5, 1, -3 }, 1.1, Lambertian{ {  1, 0, 0  } }));
+	shapes.push_back(Box({ 0, -50, 0}, {100, 1, 1}, Lambertian{ { 0.3, 0.9, 0.7 } }));
+	shapes.push_back(Box({ 3, 2, -4.5 }, { 1, 2, 1 }, Lambertian{ { 0, 1, 1 } }));
+	shapes.push_back(Circle({ -2, 1, -1 }, 0.5, Lambertian{ { 0.5, 1, 1} }));
+	shapes.push_back(Box({ -2, 1, -6 }, { 0.5, 0.5, 1 }, Lambertian{ { 1, 0, 0.5} }));
+}
+
+// Adds the triangles of an .off mesh, scaled and placed like the bunny of the interactive renderer.
+// Degenerate triangles are skipped, they have no plane to intersect.
+inline bool addMeshTriangles(std::vector<SimpleTriangle>& triangles, const std::string& path) {
+	SimpleMesh mesh;
+	if (!mesh.loadMesh(path)) {
+		return false;
+	}
+	mesh.normalize();
+	mesh.resize();
+	mesh.transform(0.5f * Eigen::AngleAxisf(-float(pi) / 2, Eigen::Vector3f{ 1, 0, 0 }).toRotationMatrix(), { 0.5, 0.7, -2 });
+	for (const SimpleMesh::Triangle& triangle : mesh.getTriangles()) {
+		Eigen::Vector3f v0 = mesh.getVertices()[triangle.idx0].position.head(3);
+		Eigen::Vector3f v1 = mesh.getVertices()[triangle.idx1].position.head(3);
+		Eigen::Vector3f v2 = mesh.getVertices()[triangle.idx2].position.head(3);
+		if ((v1 - v0).cross(v2 - v0).squaredNorm() > 0) {
+			triangles.push_back(SimpleTriangle(std::move(v0), std::move(v1), std::move(v2)));
+		}
+	}
+	return true;
+}
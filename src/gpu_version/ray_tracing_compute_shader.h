@@ -4,6 +4,7 @@
 #include "glad/glad.h"
 #include "gpu_version/camera.h"
 #include "gpu_version/shape.h"
+#include "gpu_version/shaderBVH.h"
 #include <vector>
 
 class RayTracingComputeShader {
@@ -29,6 +30,12 @@ public:
 		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(SimpleTriangle) * triangles.size(), triangles.data(), GL_DYNAMIC_DRAW);
 		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, triangleBuffer);
 		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0); // unbind
+
+		glGenBuffers(1, &bvhBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, bvhBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(ShaderBVHNode) * bvh.nodes.size(), bvh.nodes.data(), GL_DYNAMIC_DRAW);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, bvhBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0); // unbind
 	}
 
 	void updateCameraBuffer() {
@@ -41,27 +48,33 @@ public:
 		glDispatchCompute(x, y, z);
 	}
 
+	// Uploads shapes and triangles in the order of a freshly built BVH, together with its nodes.
 	void updateShapeBuffer() {
 		glUseProgram(programID);
+		bvh.build(shapes, triangles);
 		glBindBuffer(GL_SHADER_STORAGE_BUFFER, shapesBuffer);
-		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Shape) * shapes.size(), shapes.data(), GL_DYNAMIC_DRAW);
-		int location = glGetUniformLocation(programID, "shapeCount");
-		glUniform1ui(location, unsigned int(shapes.size()));
-
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Shape) * bvh.orderedShapes.size(), bvh.orderedShapes.data(), GL_DYNAMIC_DRAW);
 
 		glBindBuffer(GL_SHADER_STORAGE_BUFFER, triangleBuffer);
-		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(SimpleTriangle) * triangles.size(), triangles.data(), GL_DYNAMIC_DRAW);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(SimpleTriangle) * bvh.orderedTriangles.size(), bvh.orderedTriangles.data(), GL_DYNAMIC_DRAW);
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, bvhBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(ShaderBVHNode) * bvh.nodes.size(), bvh.nodes.data(), GL_DYNAMIC_DRAW);
 
-		location = glGetUniformLocation(programID, "triangleCount");
-		glUniform1ui(location, unsigned int(triangles.size()));
+		int location = glGetUniformLocation(programID, "shapeRoot");
+		glUniform1ui(location, bvh.shapeRoot);
+		location = glGetUniformLocation(programID, "nodeCount");
+		glUniform1ui(location, bvh.nodeCount());
 	}
 
 	std::vector<Shape> shapes;
 	std::vector<SimpleTriangle> triangles;
+	ShaderBVH bvh;
 
 private:
 	Camera& camera;
 	unsigned int triangleBuffer;
 	unsigned int shapesBuffer;
 	unsigned int cameraPositionBuffer;
+	unsigned int bvhBuffer;
 };
\ No newline at end of file
@@ -0,0 +1,45 @@
+#pragma once
+#include <vector>
+#include "Eigen/Dense"
+#include "gpu_version/shape.h"
+#include "gpu_version/camera.h"
+#include "cpu_version/sceneCache.h"
+
+// Adds the objects of a loaded scene as shapes and triangles of the compute shader. The shader
+// shades every triangle as red Lambertian, so the materials of mesh instances are not used, and
+// its metals reflect without fuzz.
+inline void addSceneShapes(std::vector<Shape>& shapes, std::vector<SimpleTriangle>& triangles, const LoadedScene& loaded) {
+	const SceneDescription& description = loaded.description;
+	std::vector<Material> materials;
+	for (const SceneDescription::Material& material : description.materials) {
+		Eigen::Vector3f color = material.color;
+		switch (material.type) {
+		case SceneDescription::MaterialType::LAMBERTIAN: materials.push_back(Lambertian{ std::move(color) }); break;
+		case SceneDescription::MaterialType::METAL: materials.push_back(Metal{ std::move(color) }); break;
+		case SceneDescription::MaterialType::LIGHT: materials.push_back(Light{ std::move(color) }); break;
+		}
+	}
+	for (const SceneDescription::Sphere& sphere : description.spheres) {
+		shapes.push_back(Circle(Eigen::Vector3f(sphere.center), sphere.radius, materials[sphere.material]));
+	}
+	for (const SceneDescription::Cube& cube : description.cubes) {
+		shapes.push_back(Box(Eigen::Vector3f(cube.center), Eigen::Vector3f::Constant(cube.size), materials[cube.material]));
+	}
+	for (const SceneDescription::MeshInstance& instance : description.meshInstances) {
+		const MeshCache& mesh = loaded.meshes[instance.mesh];
+		const float* positions = mesh.positions();
+		const uint32_t* indices = mesh.indices();
+		const auto vertex = [&](uint32_t index) -> Eigen::Vector3f {
+			return instance.transform * Eigen::Vector3f(positions[index * 3], positions[index * 3 + 1], positions[index * 3 + 2]);
+		};
+		for (size_t triangle = 0; triangle < mesh.triangleCount(); ++triangle) {
+			Eigen::Vector3f v0 = vertex(indices[triangle * 3]);
+			Eigen::Vector3f v1 = vertex(indices[triangle * 3 + 1]);
+			Eigen::Vector3f v2 = vertex(indices[triangle * 3 + 2]);
+			// degenerate triangles have no plane to intersect
+			if ((v1 - v0).cross(v2 - v0).squaredNorm() > 0) {
+				triangles.push_back(SimpleTriangle(std::move(v0), std::move(v1), std::move(v2)));
+			}
+		}
+	}
+}
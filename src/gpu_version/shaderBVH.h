@@ -0,0 +1,160 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <Eigen/Dense>
+#include "gpu_version/shape.h"
+#include "cpu_version/bvh.h"
+#include "cpu_version/stats.h"
+
+// Node of the BVH RayTracing.glsl traverses, laid out like BVHNode in its std430 bvhBuffer. Nodes
+// are in depth first order and traversed without a stack: an interior node that is hit continues
+// with the next node, its left child, one that is missed jumps to skipFirst, the first node after
+// its subtree. After a leaf the traversal always continues with the next node.
+struct ShaderBVHNode {
+	Eigen::Vector3f boundsMin;
+	// interior node: index of the first node after its subtree, leaf: index of the first primitive
+	uint32_t skipFirst;
+	Eigen::Vector3f boundsMax;
+	// number of primitives in a leaf, 0 for interior nodes
+	uint32_t count;
+
+	bool isLeaf() const { return count > 0; }
+};
+
+static_assert(sizeof(ShaderBVHNode) == 32 && offsetof(ShaderBVHNode, skipFirst) == 12 && offsetof(ShaderBVHNode, boundsMax) == 16
+	&& offsetof(ShaderBVHNode, count) == 28, "ShaderBVHNode has to match the std430 layout of BVHNode in RayTracing.glsl");
+
+// Builds one node buffer holding a tree over the triangles, nodes [0, shapeRoot), followed by a
+// tree over the shapes, nodes [shapeRoot, nodes.size()). The primitives are copied in leaf order,
+// so every leaf refers to a contiguous range of orderedTriangles or orderedShapes, and those are
+// uploaded in place of the original vectors. Primitives the shader can never hit, shapes of other
+// types and degenerate triangles, are left out. The trees come from the binned SAH builder of the
+// CPU renderer.
+class ShaderBVH {
+public:
+	void build(const std::vector<Shape>& shapes, const std::vector<SimpleTriangle>& triangles) {
+		nodes.clear();
+		append(triangles, orderedTriangles);
+		shapeRoot = uint32_t(nodes.size());
+		append(shapes, orderedShapes);
+	}
+
+	uint32_t nodeCount() const {
+		return uint32_t(nodes.size());
+	}
+
+	// Same traversal as RayTracing.glsl over nodes [begin, end). hitLeaf(first, count, tMax) tests
+	// the primitives [first, first + count) of the ordered vector and shrinks tMax to their closest hit.
+	template<typename HitLeaf>
+	static void traverse(const ShaderBVHNode* nodes, uint32_t begin, uint32_t end, const Eigen::Vector3f& origin,
+	                     const Eigen::Vector3f& direction, float tMax, HitLeaf&& hitLeaf) {
+		const Eigen::Vector3f inverseDirection = direction.cwiseInverse();
+		uint32_t visited = 0;
+		uint32_t index = begin;
+		while (index < end) {
+			const ShaderBVHNode& node = nodes[index];
+			++visited;
+			const bool hit = hitBounds(node, origin, inverseDirection, tMax);
+			if (!node.isLeaf()) {
+				index = hit ? index + 1 : node.skipFirst;
+				continue;
+			}
+			if (hit) {
+				hitLeaf(node.skipFirst, node.count, tMax);
+			}
+			++index;
+		}
+		Stats::count(Counter::BVH_NODES, visited);
+	}
+
+	static bool hitBounds(const ShaderBVHNode& node, const Eigen::Vector3f& origin, const Eigen::Vector3f& inverseDirection, float tMax) {
+		const Eigen::Array3f t0 = (node.boundsMin - origin).array() * inverseDirection.array();
+		const Eigen::Array3f t1 = (node.boundsMax - origin).array() * inverseDirection.array();
+		const float tEnter = std::max(t0.min(t1).maxCoeff(), 0.f);
+		const float tExit = std::min(t0.max(t1).minCoeff(), tMax);
+		return tEnter <= tExit;
+	}
+
+	// spheres and boxes as RayTracing.glsl tests them, empty for the shapes it never hits
+	static Eigen::AlignedBox3f bounds(const Shape& shape) {
+		const Eigen::Vector3f center = shape.transformation.block<3, 1>(0, 3);
+		const float scale = shape.transformation(0, 0);
+		if (shape.type == 0) {
+			return { center - Eigen::Vector3f::Constant(scale), center + Eigen::Vector3f::Constant(scale) };
+		}
+		if (shape.type == 1) {
+			// hitBox accepts points up to 0.5001 from the center of the unit cube
+			return { center - Eigen::Vector3f::Constant(0.5001f * scale), center + Eigen::Vector3f::Constant(0.5001f * scale) };
+		}
+		return Eigen::AlignedBox3f();
+	}
+
+	static Eigen::AlignedBox3f bounds(const SimpleTriangle& triangle) {
+		Eigen::AlignedBox3f box;
+		for (const Eigen::Vector3f& vertex : triangle.vertices()) {
+			box.extend(vertex);
+		}
+		if (!box.min().allFinite() || !box.max().allFinite()) {
+			return Eigen::AlignedBox3f();
+		}
+		// the corners are recovered from the inverse of the dual edges, leave room for its rounding
+		const float padding = 1e-4f * std::max(box.sizes().maxCoeff(), 1e-3f);
+		return { box.min() - Eigen::Vector3f::Constant(padding), box.max() + Eigen::Vector3f::Constant(padding) };
+	}
+
+	std::vector<ShaderBVHNode> nodes;
+	uint32_t shapeRoot = 0;
+	std::vector<Shape> orderedShapes;
+	std::vector<SimpleTriangle> orderedTriangles;
+
+private:
+	template<typename Primitive>
+	void append(const std::vector<Primitive>& primitives, std::vector<Primitive>& ordered) {
+		ordered.clear();
+		if (primitives.empty()) {
+			return;
+		}
+		primitiveBounds.clear();
+		kept.clear();
+		for (uint32_t index = 0; index < primitives.size(); ++index) {
+			const Eigen::AlignedBox3f box = bounds(primitives[index]);
+			if (!box.isEmpty()) {
+				primitiveBounds.push_back(box);
+				kept.push_back(index);
+			}
+		}
+		if (kept.empty()) {
+			return;
+		}
+		builder.build(primitiveBounds);
+		for (uint32_t index : builder.primitiveIndices) {
+			ordered.push_back(primitives[kept[index]]);
+		}
+
+		// going from the back, the end of a subtree is the end of its right child, which comes last
+		const uint32_t offset = uint32_t(nodes.size());
+		const uint32_t count = uint32_t(builder.nodes.size());
+		subtreeEnd.resize(count);
+		for (uint32_t index = count; index-- > 0;) {
+			const BVHNode& node = builder.nodes[index];
+			subtreeEnd[index] = node.isLeaf() ? index + 1 : subtreeEnd[node.leftFirst];
+		}
+		for (uint32_t index = 0; index < count; ++index) {
+			const BVHNode& node = builder.nodes[index];
+			ShaderBVHNode shaderNode;
+			shaderNode.boundsMin = node.bounds.min();
+			shaderNode.boundsMax = node.bounds.max();
+			shaderNode.skipFirst = node.isLeaf() ? node.leftFirst : offset + subtreeEnd[index];
+			shaderNode.count = node.count;
+			nodes.push_back(shaderNode);
+		}
+	}
+
+	BVH builder;
+	std::vector<Eigen::AlignedBox3f> primitiveBounds;
+	std::vector<uint32_t> kept;
+	std::vector<uint32_t> subtreeEnd;
+};
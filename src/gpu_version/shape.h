@@ -1,5 +1,7 @@
 #pragma once
 #include <variant>
+#include <array>
+#include <cstddef>
 #include <Eigen/Dense>
 
 class Material {
@@ -43,11 +45,11 @@ public:
 
 class Shape {
 protected:
-	Shape(unsigned int type, Material& material):
+	Shape(unsigned int type, const Material& material):
 		transformation(Eigen::Matrix4f::Identity()), type(type), material(material){
 	}
 public:
-	Eigen::Matrix<float,4,4,ColMajor> transformation;
+	Eigen::Matrix<float,4,4,Eigen::ColMajor> transformation;
 	unsigned int type;
 	float data[11]{};
 	Material material;
@@ -55,7 +57,7 @@ public:
 
 class Circle : public Shape {
 public:
-	Circle(Eigen::Vector3f&& translation, float radius, Material& material): Shape(0, material) {
+	Circle(Eigen::Vector3f&& translation, float radius, const Material& material): Shape(0, material) {
 		transformation.block<3, 1>(0, 3) = translation;
 		transformation(0, 0) = radius;
 	}
@@ -63,7 +65,7 @@ public:
 
 class Box : public Shape {
 public:
-	Box(Eigen::Vector3f&& translation, Eigen::Vector3f&& sides, Material& material) : Shape(1, material) {
+	Box(Eigen::Vector3f&& translation, Eigen::Vector3f&& sides, const Material& material) : Shape(1, material) {
 		transformation.block<3, 3>(0, 0).diagonal() = sides;
 		transformation.block<3, 1>(0, 3) = translation;
 	}
@@ -71,7 +73,7 @@ public:
 
 class Triangle : public Shape {
 public:
-	Triangle(Eigen::Vector3f&& p1, Eigen::Vector3f&& p2, Eigen::Vector3f&& p3, Material& material) : Shape(2, material) {
+	Triangle(Eigen::Vector3f&& p1, Eigen::Vector3f&& p2, Eigen::Vector3f&& p3, const Material& material) : Shape(2, material) {
 		transformation.col(0).head(3) = p1;
 		transformation.col(1).head(3) = p2;
 		transformation.col(2).head(3) = p3;
@@ -90,20 +92,40 @@ public:
 		this->a = a;
 		this->beta = beta;
 
-		Vector3f m1 = v1 - ((v1.dot(v2) / v2.dot(v2)) * v2);
+		Eigen::Vector3f m1 = v1 - ((v1.dot(v2) / v2.dot(v2)) * v2);
 		m1 = m1 / m1.dot(v1);
 
-		Vector3f m2 = v2 - ((v1.dot(v2) / v1.dot(v1)) * v1);
+		Eigen::Vector3f m2 = v2 - ((v1.dot(v2) / v1.dot(v1)) * v1);
 		m2 = m2 / m2.dot(v2);
 
 		this->m1.head(3) = m1;
 		this->m2.head(3) = m2;
 
 	}
+
+	// corners recovered from the normal and the dual edge vectors m1 and m2, which map the edges to
+	// the unit vectors, for building the BVH
+	std::array<Eigen::Vector3f, 3> vertices() const {
+		Eigen::Matrix3f dual;
+		dual.row(0) = m1.head<3>();
+		dual.row(1) = m2.head<3>();
+		dual.row(2) = a;
+		const Eigen::Matrix3f edges = dual.inverse();
+		const Eigen::Vector3f p1 = position.head<3>();
+		return { p1, p1 + edges.col(0), p1 + edges.col(1) };
+	}
 private:
 	Eigen::Vector4f position;
 	Eigen::Vector3f a;
 	float beta;
 	Eigen::Vector4f m1;
 	Eigen::Vector4f m2;
-};
\ No newline at end of file
+};
+
+// The shaders read these as std430 arrays (Shape, Material and Triangle in RayTracing.glsl), which
+// is what glBufferData uploads, so the C++ layout has to match the std430 one byte for byte.
+static_assert(sizeof(Material) == 32 && offsetof(Material, type) == 12 && offsetof(Material, data) == 16,
+	"Material has to match the std430 layout of Material in RayTracing.glsl");
+static_assert(sizeof(Shape) == 144 && offsetof(Shape, type) == 64 && offsetof(Shape, data) == 68 && offsetof(Shape, material) == 112,
+	"Shape has to match the std430 layout of Shape in RayTracing.glsl");
+static_assert(sizeof(SimpleTriangle) == 64, "SimpleTriangle has to match the std430 layout of Triangle in RayTracing.glsl");
@@ -0,0 +1,139 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#if __has_include("stb_image_write.h")
+#include "stb_image_write.h"
+#define IMAGE_WRITER_HAS_PNG
+#endif
+
+#ifdef IMAGE_WRITER_HAS_PNG
+constexpr bool pngSupported = true;
+#else
+constexpr bool pngSupported = false;
+#endif
+// extension of the default output, PNG needs stb_image_write.h while EXR is always written
+constexpr const char* defaultImageExtension = pngSupported ? ".png" : ".exr";
+
+// Writers for the RGB float images of the CPU renderer. Pixels are stored bottom row first and hold
+// the square root encoded values the renderer displays, PFM and EXR files get the linear values back.
+
+inline bool endsWith(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+inline float toLinear(float value) {
+    return value * value;
+}
+
+inline bool writePNG(const std::string& filename, const float* rgb, unsigned int width, unsigned int height) {
+#ifdef IMAGE_WRITER_HAS_PNG
+    std::vector<unsigned char> bytes(size_t(width) * height * 3);
+    for (size_t index = 0; index < bytes.size(); ++index) {
+        bytes[index] = (unsigned char)(std::clamp(rgb[index], 0.f, 1.f) * 255.f + 0.5f);
+    }
+    stbi_flip_vertically_on_write(1);
+    return stbi_write_png(filename.c_str(), width, height, 3, bytes.data(), width * 3) != 0;
+#else
+    (void)filename;
+    (void)rgb;
+    (void)width;
+    (void)height;
+    return false;
+#endif
+}
+
+inline bool writePFM(const std::string& filename, const float* rgb, unsigned int width, unsigned int height) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) return false;
+
+    // PFM stores rows bottom to top like the buffer, a negative scale marks little endian data
+    file << "PF\n" << width << " " << height << "\n-1.0\n";
+    std::vector<float> row(size_t(width) * 3);
+    for (unsigned int y = 0; y < height; ++y) {
+        std::transform(rgb + size_t(y) * width * 3, rgb + size_t(y + 1) * width * 3, row.begin(), toLinear);
+        file.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+    }
+    return file.good();
+}
+
+// Uncompressed scanline OpenEXR with 32 bit float B, G and R channels.
+inline bool writeEXR(const std::string& filename, const float* rgb, unsigned int width, unsigned int height) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) return false;
+
+    const auto writeValue = [&file](auto value) {
+        file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+    const auto writeAttribute = [&](const char* name, const char* type, int32_t size) {
+        file.write(name, std::strlen(name) + 1);
+        file.write(type, std::strlen(type) + 1);
+        writeValue(size);
+    };
+
+    writeValue(uint32_t(20000630));
+    writeValue(uint32_t(2));
+
+    writeAttribute("channels", "chlist", 3 * 18 + 1);
+    for (const char* channel : { "B", "G", "R" }) {
+        file.write(channel, 2);
+        writeValue(int32_t(2));   // FLOAT
+        writeValue(uint32_t(0));  // pLinear and reserved
+        writeValue(int32_t(1));
+        writeValue(int32_t(1));
+    }
+    file.put(0);
+    writeAttribute("compression", "compression", 1);
+    file.put(0);
+    for (const char* window : { "dataWindow", "displayWindow" }) {
+        writeAttribute(window, "box2i", 16);
+        writeValue(int32_t(0)); writeValue(int32_t(0));
+        writeValue(int32_t(width - 1)); writeValue(int32_t(height - 1));
+    }
+    writeAttribute("lineOrder", "lineOrder", 1);
+    file.put(0);
+    writeAttribute("pixelAspectRatio", "float", 4);
+    writeValue(1.f);
+    writeAttribute("screenWindowCenter", "v2f", 8);
+    writeValue(0.f); writeValue(0.f);
+    writeAttribute("screenWindowWidth", "float", 4);
+    writeValue(1.f);
+    file.put(0);
+
+    const uint64_t lineSize = 8 + uint64_t(width) * 3 * sizeof(float);
+    const uint64_t firstLine = uint64_t(file.tellp()) + uint64_t(height) * sizeof(uint64_t);
+    for (unsigned int y = 0; y < height; ++y) {
+        writeValue(firstLine + y * lineSize);
+    }
+
+    std::vector<float> line(size_t(width) * 3);
+    for (unsigned int y = 0; y < height; ++y) {
+        // EXR lines go top to bottom
+        const float* row = rgb + size_t(height - 1 - y) * width * 3;
+        for (unsigned int x = 0; x < width; ++x) {
+            for (unsigned int channel = 0; channel < 3; ++channel) {
+                line[size_t(channel) * width + x] = toLinear(row[x * 3 + (2 - channel)]);
+            }
+        }
+        writeValue(int32_t(y));
+        writeValue(int32_t(line.size() * sizeof(float)));
+        file.write(reinterpret_cast<const char*>(line.data()), line.size() * sizeof(float));
+    }
+    return file.good();
+}
+
+// Picks the format from the file extension: .png, .pfm or .exr
+// whether writeImage() knows the format of filename, .png only with stb_image_write.h
+inline bool canWriteImage(const std::string& filename) {
+    return endsWith(filename, ".pfm") || endsWith(filename, ".exr") || (pngSupported && endsWith(filename, ".png"));
+}
+
+inline bool writeImage(const std::string& filename, const float* rgb, unsigned int width, unsigned int height) {
+    if (endsWith(filename, ".pfm")) return writePFM(filename, rgb, width, height);
+    if (endsWith(filename, ".exr")) return writeEXR(filename, rgb, width, height);
+    if (endsWith(filename, ".png")) return writePNG(filename, rgb, width, height);
+    return false;
+}
@@ -14,7 +14,10 @@
 #include "gpu_version/camera.h"
 #include <vector>
 #include <gpu_version/shape.h>
+#include "gpu_version/defaultScene.h"
+#include "gpu_version/sceneLoader.h"
 #include "SimpleMesh.h"
+#include "cpu_version/stats.h"
 
 void GLAPIENTRY
 MessageCallback(GLenum source,
@@ -45,8 +48,23 @@ static Camera* globalCamera;
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 
-int main()
+int main(int argc, char** argv)
 {
+    // --stats FILE writes the frame times on exit, .csv or JSON otherwise, --scene FILE shows the
+    // objects and camera of a scene file or compiled .rtscene instead of the default scene
+    std::string statsPath;
+    std::string scenePath;
+    for (int index = 1; index + 1 < argc; ++index) {
+        const std::string argument = argv[index];
+        if (argument == "--stats") statsPath = argv[++index];
+        else if (argument == "--scene") scenePath = argv[++index];
+    }
+    LoadedScene scene;
+    std::string sceneError;
+    if (!scenePath.empty() && !scene.load(scenePath, sceneError)) {
+        std::cerr << sceneError << std::endl;
+        exit(EXIT_FAILURE);
+    }
 
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
@@ -92,34 +110,16 @@ int main()
     auto programIds = LoadShaders();
     RayTracingComputeShader computeShader{camera, programIds.ray_tracing};
     int timeLocation = glGetUniformLocation(programIds.ray_tracing, "time");
-    computeShader.shapes.push_back(Box({ -1, 12, -2 }, { 10, 1, 1 }, Light{ { 1.5, 1.5, 1.5 } }));
-    //computeShader.shapes.push_back(Circle({ 3, 4.5, -2 }, 1.5, Light{ { 1, 1, 1 } }));
-
-    computeShader.shapes.push_back(Circle({ 1, 3, -10 }, 1, Lambertian{ { 0, 1, 0 } }));
-    computeShader.shapes.push_back(Circle({ -1.5, 1.5, -4 }, 0.5, Metal{ { 1, 1, 1} }));
-    computeShader.shapes.push_back(Circle({ 0, 1, -4 }, 0.5, Lambertian{ { 0.8, 0.8, 0} }));
-
-    computeShader.shapes.push_back(Circle({ 1.5, 1, -3 }, 1.1, Lambertian{ {  1, 0, 0  } }));
-    computeShader.shapes.push_back(Box({ 0, -50, 0}, {100, 1, 1}, Lambertian{ { 0.3, 0.9, 0.7 } }));
-    computeShader.shapes.push_back(Box({ 3, 2, -4.5 }, { 1, 2, 1 }, Lambertian{ { 0, 1, 1 } }));
-    computeShader.shapes.push_back(Circle({ -2, 1, -1 }, 0.5, Lambertian{ { 0.5, 1, 1} }));
-    computeShader.shapes.push_back(Box({ -2, 1, -6 }, { 0.5, 0.5, 1 }, Lambertian{ { 1, 0, 0.5} }));
-
-    //SimpleMesh mesh;
-    //mesh.loadMesh("../src/meshes/Bunny-LowPoly.off");
-    //mesh.normalize();
-    //mesh.resize();
-    //mesh.transform(0.5 *Eigen::AngleAxisf(-pi / 2, Vector3f{ 1, 0, 0 }).toRotationMatrix(), {0.5, 0.7, -2});
-    //for (unsigned int index = 0; index < mesh.getTriangles().size(); ++index) {
-    //    auto& triangle = mesh.getTriangles()[index];
-    //    auto& v0 = mesh.getVertices()[triangle.idx0].position.head(3);
-    //    auto& v1 = mesh.getVertices()[triangle.idx1].position.head(3);
-    //    auto& v2 = mesh.getVertices()[triangle.idx2].position.head(3);
-    //    //std::cout << v0 << std::endl << "---" << std::endl;
-    //    //std::cout << v1 << std::endl << "---" << std::endl;
-    //    //std::cout << v2 << std::endl << "---" << std::endl;
-    //    computeShader.triangles.push_back(SimpleTriangle(v0, v1, v2));
-    //}
+    if (!scenePath.empty()) {
+        addSceneShapes(computeShader.shapes, computeShader.triangles, scene);
+        const SceneDescription::Camera& sceneCamera = scene.description.camera;
+        camera.lookAt(Eigen::Vector3f(sceneCamera.position), Eigen::Vector3f(sceneCamera.direction), Eigen::Vector3f(sceneCamera.up), sceneCamera.focalLength);
+    } else {
+        addDefaultShapes(computeShader.shapes);
+        if (!addMeshTriangles(computeShader.triangles, "../src/meshes/Bunny-LowPoly.off")) {
+            std::cerr << "Could not load the bunny, rendering the shapes only" << std::endl;
+        }
+    }
 
     computeShader.updateShapeBuffer();
     unsigned int pixelBuffer;
@@ -132,6 +132,10 @@ int main()
 
     glUseProgram(programIds.converter);
     int number_of_samples_location = glGetUniformLocation(programIds.converter, "n_samples");
+    Stats& stats = Stats::global();
+    stats.beginFrame();
+    double titleSeconds = 0;
+    unsigned int titleFrames = 0;
     while (!glfwWindowShouldClose(window))
     {
         //std::cout << number_of_samples << std::endl;
@@ -140,22 +144,43 @@ int main()
         glUseProgram(programIds.ray_tracing);
         glUniform1f(timeLocation, time/10000);
 
-        computeShader.updateCameraBuffer();
-
-        computeShader.compute(width, height, 1);
-        glMemoryBarrier(GL_ALL_BARRIER_BITS);
-        glUseProgram(programIds.converter);
-        glUniform1ui(number_of_samples_location, number_of_samples);
-        glDispatchCompute((GLuint)width, (GLuint)height, 1);
-        glMemoryBarrier(GL_ALL_BARRIER_BITS);
+        // the phases time the submission on the CPU, the GPU work only shows in the frame time
+        // once the swap waits for it
+        {
+            const Stats::ScopedPhase phase(Phase::RENDER);
+            computeShader.updateCameraBuffer();
+            computeShader.compute(width, height, 1);
+            glMemoryBarrier(GL_ALL_BARRIER_BITS);
+        }
+        {
+            const Stats::ScopedPhase phase(Phase::RESOLVE);
+            glUseProgram(programIds.converter);
+            glUniform1ui(number_of_samples_location, number_of_samples);
+            glDispatchCompute((GLuint)width, (GLuint)height, 1);
+            glMemoryBarrier(GL_ALL_BARRIER_BITS);
+        }
         ++number_of_samples;
-        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
-        glfwPollEvents();
-        glfwSwapBuffers(window);
-        auto t2 = std::chrono::high_resolution_clock::now();
-        std:chrono::duration<double, std::milli> ms_double = t2 - t1;
-
-        std::cout << ms_double.count() << "ms" << std::endl;
+        {
+            const Stats::ScopedPhase phase(Phase::PRESENT);
+            glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+            glfwPollEvents();
+            glfwSwapBuffers(window);
+        }
+        const Stats::Frame frame = stats.endFrame();
+
+        // the average frame time goes to the title instead of a line per frame on the console
+        titleSeconds += frame.seconds;
+        ++titleFrames;
+        if (titleSeconds >= 0.5) {
+            const std::string title = "Ray tracing - " + std::to_string(titleSeconds / titleFrames * 1e3) + " ms, "
+                + std::to_string(number_of_samples) + " samples";
+            glfwSetWindowTitle(window, title.c_str());
+            titleSeconds = 0;
+            titleFrames = 0;
+        }
+    }
+    if (!statsPath.empty() && !stats.write(statsPath)) {
+        std::cerr << "Could not write " << statsPath << std::endl;
     }
     return 0;
 }
@@ -0,0 +1,278 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <algorithm>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include "Eigen/Dense"
+#include "Eigen/Geometry"
+#include "utils.h"
+
+// Renderer independent description of a scene, read from a text file with one statement per line.
+// Everything after # is a comment, positions and colors are three numbers:
+//   camera position X Y Z [direction X Y Z] [up X Y Z] [focal F]
+//   render [width N] [height N] [spp N] [depth N] [seed N] [passes N] [integrator recursive|wavefront]
+//   material NAME lambertian R G B | metal R G B [FUZZ] | light R G B
+//   sphere X Y Z RADIUS MATERIAL
+//   cube X Y Z SIZE MATERIAL
+//   mesh PATH MATERIAL [fit] [scale S] [rotate X Y Z DEGREES] [translate X Y Z]
+// Materials have to be declared before they are used. Mesh paths are relative to the scene file,
+// fit first scales the mesh into a unit cube around the origin, the other transforms are applied
+// in the order they are written. Every statement that names a file adds an instance of it, the
+// file itself is loaded once.
+struct SceneDescription {
+    enum class MaterialType : uint32_t {
+        LAMBERTIAN, METAL, LIGHT
+    };
+
+    struct Camera {
+        Eigen::Vector3f position{ 1, 0, 6 };
+        Eigen::Vector3f direction{ 0, 0, -1 };
+        Eigen::Vector3f up{ 0, 1, 0 };
+        float focalLength = 1;
+    };
+
+    // the settings of the renderer's command line, which still override them
+    struct RenderSettings {
+        unsigned int width = 1080;
+        unsigned int height = 720;
+        unsigned int samplesPerPixel = 25;
+        unsigned int maxDepth = 10;
+        unsigned int passes = 0;
+        uint64_t seed = 0;
+        std::string integrator = "recursive";
+    };
+
+    struct Material {
+        std::string name;
+        MaterialType type;
+        Eigen::Vector3f color;
+        float fuzz;
+    };
+
+    struct Sphere {
+        Eigen::Vector3f center;
+        float radius;
+        uint32_t material;
+    };
+
+    struct Cube {
+        Eigen::Vector3f center;
+        float size;
+        uint32_t material;
+    };
+
+    struct MeshInstance {
+        // index into meshFiles
+        uint32_t mesh;
+        uint32_t material;
+        // scale into the unit cube before transform, needs the bounds of the mesh
+        bool fit;
+        Eigen::Affine3f transform;
+    };
+
+    // Reads a scene file, returns false and a message naming the line for unreadable files and
+    // malformed statements.
+    bool load(const std::string& path, std::string& error) {
+        *this = SceneDescription();
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            error = "could not open " + path;
+            return false;
+        }
+        const std::filesystem::path directory = std::filesystem::path(path).parent_path();
+        std::string line;
+        for (unsigned int lineNumber = 1; std::getline(file, line); ++lineNumber) {
+            const size_t comment = line.find('#');
+            if (comment != std::string::npos) {
+                line.erase(comment);
+            }
+            std::istringstream tokens(line);
+            std::string statement;
+            if (!(tokens >> statement)) {
+                continue;
+            }
+            std::string message;
+            if (!parseStatement(statement, tokens, directory, message)) {
+                error = path + ":" + std::to_string(lineNumber) + ": " + message;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // index of the material called name, materials.size() if there is none
+    uint32_t findMaterial(const std::string& name) const {
+        for (uint32_t index = 0; index < materials.size(); ++index) {
+            if (materials[index].name == name) {
+                return index;
+            }
+        }
+        return uint32_t(materials.size());
+    }
+
+    // The transform of a fitted instance once the bounds of its mesh are known, the plain transform
+    // for the others.
+    static Eigen::Affine3f resolveTransform(const MeshInstance& instance, const Eigen::AlignedBox3f& meshBounds) {
+        if (!instance.fit || meshBounds.isEmpty()) {
+            return instance.transform;
+        }
+        const float size = std::max(meshBounds.sizes().maxCoeff(), 1e-6f);
+        return instance.transform * Eigen::Scaling(1.f / size) * Eigen::Translation3f(-meshBounds.center());
+    }
+
+    Camera camera;
+    RenderSettings settings;
+    std::vector<Material> materials;
+    std::vector<Sphere> spheres;
+    std::vector<Cube> cubes;
+    std::vector<std::string> meshFiles;
+    std::vector<MeshInstance> meshInstances;
+
+private:
+    static bool read(std::istream& tokens, Eigen::Vector3f& vector) {
+        return bool(tokens >> vector.x() >> vector.y() >> vector.z());
+    }
+
+    bool readMaterial(std::istream& tokens, uint32_t& material, std::string& message) const {
+        std::string name;
+        if (!(tokens >> name)) {
+            message = "missing material";
+            return false;
+        }
+        material = findMaterial(name);
+        if (material == materials.size()) {
+            message = "unknown material " + name;
+            return false;
+        }
+        return true;
+    }
+
+    bool parseStatement(const std::string& statement, std::istream& tokens, const std::filesystem::path& directory, std::string& message) {
+        std::string key;
+        if (statement == "camera") {
+            while (tokens >> key) {
+                const bool valid = key == "position" ? read(tokens, camera.position)
+                    : key == "direction" ? read(tokens, camera.direction)
+                    : key == "up" ? read(tokens, camera.up)
+                    : key == "focal" ? bool(tokens >> camera.focalLength)
+                    : false;
+                if (!valid) {
+                    message = "bad camera setting " + key;
+                    return false;
+                }
+            }
+            if (camera.direction.cross(camera.up).isZero() || !(camera.focalLength > 0)) {
+                message = "the camera needs a focal length above 0 and an up direction apart from its direction";
+                return false;
+            }
+            return true;
+        }
+        if (statement == "render") {
+            while (tokens >> key) {
+                const bool valid = key == "width" ? bool(tokens >> settings.width)
+                    : key == "height" ? bool(tokens >> settings.height)
+                    : key == "spp" ? bool(tokens >> settings.samplesPerPixel)
+                    : key == "depth" ? bool(tokens >> settings.maxDepth)
+                    : key == "passes" ? bool(tokens >> settings.passes)
+                    : key == "seed" ? bool(tokens >> settings.seed)
+                    : key == "integrator" ? (tokens >> settings.integrator) && (settings.integrator == "recursive" || settings.integrator == "wavefront")
+                    : false;
+                if (!valid) {
+                    message = "bad render setting " + key;
+                    return false;
+                }
+            }
+            return true;
+        }
+        if (statement == "material") {
+            Material material{ "", MaterialType::LAMBERTIAN, Eigen::Vector3f::Zero(), 0 };
+            std::string type;
+            if (!(tokens >> material.name >> type) || !read(tokens, material.color)) {
+                message = "expected material NAME TYPE R G B";
+                return false;
+            }
+            if (findMaterial(material.name) != materials.size()) {
+                message = "material " + material.name + " is defined twice";
+                return false;
+            }
+            if (type == "lambertian") {
+                material.type = MaterialType::LAMBERTIAN;
+            } else if (type == "metal") {
+                material.type = MaterialType::METAL;
+                if (!(tokens >> material.fuzz)) {
+                    material.fuzz = 0;
+                }
+            } else if (type == "light") {
+                material.type = MaterialType::LIGHT;
+            } else {
+                message = "unknown material type " + type;
+                return false;
+            }
+            materials.push_back(material);
+            return true;
+        }
+        if (statement == "sphere") {
+            Sphere sphere;
+            if (!read(tokens, sphere.center) || !(tokens >> sphere.radius) || !(sphere.radius > 0)) {
+                message = "expected sphere X Y Z RADIUS MATERIAL";
+                return false;
+            }
+            if (!readMaterial(tokens, sphere.material, message)) {
+                return false;
+            }
+            spheres.push_back(sphere);
+            return true;
+        }
+        if (statement == "cube") {
+            Cube cube;
+            if (!read(tokens, cube.center) || !(tokens >> cube.size) || !(cube.size > 0)) {
+                message = "expected cube X Y Z SIZE MATERIAL";
+                return false;
+            }
+            if (!readMaterial(tokens, cube.material, message)) {
+                return false;
+            }
+            cubes.push_back(cube);
+            return true;
+        }
+        if (statement == "mesh") {
+            std::string file;
+            if (!(tokens >> file)) {
+                message = "expected mesh PATH MATERIAL";
+                return false;
+            }
+            MeshInstance instance{ 0, 0, false, Eigen::Affine3f::Identity() };
+            if (!readMaterial(tokens, instance.material, message)) {
+                return false;
+            }
+            while (tokens >> key) {
+                Eigen::Vector3f vector;
+                float value;
+                if (key == "fit") {
+                    instance.fit = true;
+                } else if (key == "scale" && (tokens >> value)) {
+                    instance.transform = Eigen::Scaling(value) * instance.transform;
+                } else if (key == "rotate" && read(tokens, vector) && (tokens >> value) && !vector.isZero()) {
+                    instance.transform = Eigen::AngleAxisf(value * float(pi) / 180, vector.normalized()) * instance.transform;
+                } else if (key == "translate" && read(tokens, vector)) {
+                    instance.transform = Eigen::Translation3f(vector) * instance.transform;
+                } else {
+                    message = "bad mesh transform " + key;
+                    return false;
+                }
+            }
+            const std::string path = (directory / file).lexically_normal().string();
+            instance.mesh = uint32_t(std::find(meshFiles.begin(), meshFiles.end(), path) - meshFiles.begin());
+            if (instance.mesh == meshFiles.size()) {
+                meshFiles.push_back(path);
+            }
+            meshInstances.push_back(instance);
+            return true;
+        }
+        message = "unknown statement " + statement;
+        return false;
+    }
+};
@@ -0,0 +1,71 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string>
+#include <chrono>
+#include "cpu_version/sceneCache.h"
+
+// Compiles a scene file into a .rtscene file the renderers map instead of reading the scene and its
+// meshes, for batch jobs that would otherwise spend their start up parsing and building BVHs.
+
+static void printUsage(const char* program) {
+    fprintf(stderr,
+        "usage: %s [options] SCENE OUTPUT.rtscene\n"
+        "  --threads N            worker threads importing meshes, 0 uses every core (default 0)\n",
+        program);
+}
+
+int main(int argc, char** argv) {
+    unsigned int threads = 0;
+    std::string scenePath;
+    std::string output;
+
+    for (int index = 1; index < argc; ++index) {
+        const std::string argument = argv[index];
+        if (argument == "--threads" && index + 1 < argc) threads = std::stoul(argv[++index]);
+        else if (argument.rfind("--", 0) != 0 && scenePath.empty()) scenePath = argument;
+        else if (argument.rfind("--", 0) != 0 && output.empty()) output = argument;
+        else {
+            printUsage(argv[0]);
+            return argument == "--help" ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (scenePath.empty() || output.empty()) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const auto loadStart = std::chrono::high_resolution_clock::now();
+    ThreadPool threadPool{ threads };
+    LoadedScene scene;
+    std::string error;
+    if (!scene.load(scenePath, error, &threadPool)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return EXIT_FAILURE;
+    }
+    const auto writeStart = std::chrono::high_resolution_clock::now();
+    if (!writeSceneCache(output, scene)) {
+        fprintf(stderr, "Could not write %s\n", output.c_str());
+        return EXIT_FAILURE;
+    }
+    const auto writeEnd = std::chrono::high_resolution_clock::now();
+
+    // opened again, so the output is known to be valid and the mapped start up can be compared
+    LoadedScene compiled;
+    if (!compiled.load(output, error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return EXIT_FAILURE;
+    }
+    const auto openEnd = std::chrono::high_resolution_clock::now();
+
+    size_t triangles = 0;
+    for (const MeshCache& mesh : compiled.meshes) {
+        triangles += mesh.triangleCount();
+    }
+    const SceneDescription& description = compiled.description;
+    printf("%zu materials, %zu spheres, %zu cubes, %zu meshes with %zu triangles, %zu instances\n", description.materials.size(),
+        description.spheres.size(), description.cubes.size(), compiled.meshes.size(), triangles, description.meshInstances.size());
+    printf("load scene   %.3f ms\n", std::chrono::duration<double>(writeStart - loadStart).count() * 1e3);
+    printf("write        %.3f ms\n", std::chrono::duration<double>(writeEnd - writeStart).count() * 1e3);
+    printf("open output  %.3f ms\n", std::chrono::duration<double>(openEnd - writeEnd).count() * 1e3);
+    return EXIT_SUCCESS;
+}
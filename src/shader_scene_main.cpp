@@ -0,0 +1,151 @@
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stdlib.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include "cpu_version/computeShaderBackend.h"
+#include "gpu_version/defaultScene.h"
+#include "gpu_version/sceneLoader.h"
+#include "imageWriter.h"
+
+// Renders the scene of the interactive renderer with the CPU backend of its compute shaders, for
+// machines without an OpenGL 4.3 context.
+
+static void printUsage(const char* program) {
+    printf(
+        "usage: %s [options]\n"
+        "  --width N              image width (default 1080)\n"
+        "  --height N             image height (default 720)\n"
+        "  --passes N             dispatches of %u samples per pixel each (default 1)\n"
+        "  --threads N            worker threads, 0 uses every core (default 0)\n"
+        "  --pin                  pin every worker thread to its own core\n"
+        "  --seed N               random seed (default 0)\n"
+        "  --scene FILE           render a scene file or compiled .rtscene, its settings are the defaults of the other options\n"
+        "  --mesh FILE            add the triangles of an .off mesh where the interactive renderer shows the bunny\n"
+        "  --stats FILE           write per pass counters and timings, .csv or JSON otherwise\n"
+        "  --output FILE          .png, .pfm or .exr (default shader_scene.png, shader_scene.exr if built without stb_image_write.h),\n"
+        "                         a PNG holds the values the interactive renderer shows, without gamma\n",
+        program, ComputeShaderBackend::workGroupSize);
+}
+
+int main(int argc, char** argv) {
+    unsigned int width = 1080;
+    unsigned int height = 720;
+    unsigned int passes = 1;
+    unsigned int threads = 0;
+    bool pin = false;
+    uint64_t seed = 0;
+    std::string output = std::string("shader_scene") + defaultImageExtension;
+    std::string statsPath;
+    std::string meshPath;
+    std::string scenePath;
+
+    // the settings of a scene file are read first, so the options after it can override them
+    LoadedScene scene;
+    double sceneSeconds = 0;
+    for (int index = 1; index + 1 < argc; ++index) {
+        if (std::string(argv[index]) == "--scene") scenePath = argv[++index];
+    }
+    if (!scenePath.empty()) {
+        const auto loadStart = std::chrono::high_resolution_clock::now();
+        std::string error;
+        if (!scene.load(scenePath, error)) {
+            fprintf(stderr, "%s\n", error.c_str());
+            return EXIT_FAILURE;
+        }
+        sceneSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - loadStart).count();
+        const SceneDescription::RenderSettings& settings = scene.description.settings;
+        width = settings.width;
+        height = settings.height;
+        seed = settings.seed;
+        passes = std::max(settings.passes, 1u);
+    }
+
+    for (int index = 1; index < argc; ++index) {
+        const std::string argument = argv[index];
+        const bool hasValue = index + 1 < argc;
+        if (argument == "--width" && hasValue) width = std::stoul(argv[++index]);
+        else if (argument == "--height" && hasValue) height = std::stoul(argv[++index]);
+        else if (argument == "--passes" && hasValue) passes = std::stoul(argv[++index]);
+        else if (argument == "--threads" && hasValue) threads = std::stoul(argv[++index]);
+        else if (argument == "--pin") pin = true;
+        else if (argument == "--seed" && hasValue) seed = std::stoull(argv[++index]);
+        else if (argument == "--stats" && hasValue) statsPath = argv[++index];
+        else if (argument == "--scene" && hasValue) ++index;
+        else if (argument == "--mesh" && hasValue) meshPath = argv[++index];
+        else if (argument == "--output" && hasValue) output = argv[++index];
+        else {
+            printUsage(argv[0]);
+            return argument == "--help" ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (width == 0 || height == 0 || passes == 0) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (!canWriteImage(output)) {
+        fprintf(stderr, "Cannot write %s, the formats are .pfm, .exr and, with stb_image_write.h, .png\n", output.c_str());
+        return EXIT_FAILURE;
+    }
+
+    Camera camera{ width, height };
+    ComputeShaderBackend backend{ camera, width, height, seed, threads, pin };
+    if (!scenePath.empty()) {
+        addSceneShapes(backend.shapes, backend.triangles, scene);
+        const SceneDescription::Camera& sceneCamera = scene.description.camera;
+        camera.lookAt(Eigen::Vector3f(sceneCamera.position), Eigen::Vector3f(sceneCamera.direction), Eigen::Vector3f(sceneCamera.up), sceneCamera.focalLength);
+        backend.updateCameraBuffer();
+        printf("scene        %s loaded in %.3f ms\n", scenePath.c_str(), sceneSeconds * 1e3);
+    } else {
+        addDefaultShapes(backend.shapes);
+    }
+    if (!meshPath.empty() && !addMeshTriangles(backend.triangles, meshPath)) {
+        fprintf(stderr, "Could not load %s\n", meshPath.c_str());
+        return EXIT_FAILURE;
+    }
+    const auto buildStart = std::chrono::high_resolution_clock::now();
+    backend.updateShapeBuffer();
+    const double buildSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - buildStart).count();
+
+    Stats& stats = Stats::global();
+    stats.reset();
+    stats.beginFrame();
+    const auto start = std::chrono::high_resolution_clock::now();
+    for (unsigned int pass = 0; pass < passes; ++pass) {
+        backend.compute();
+        stats.endFrame();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+    std::vector<float> pixels(size_t(width) * height * 3);
+    backend.resolve(pixels.data());
+    // The window of the interactive renderer shows the linear values without gamma, a PNG gets
+    // them unchanged so it looks the same. The PFM and EXR writers square their input, they get
+    // square roots so the files keep the linear values too.
+    if (!endsWith(output, ".png")) {
+        for (float& value : pixels) {
+            value = std::sqrt(value);
+        }
+    }
+
+    printf("%ux%u, %u passes of %u spp, %zu shapes, %zu triangles\n", width, height, passes, ComputeShaderBackend::workGroupSize,
+        backend.shapes.size(), backend.triangles.size());
+    printf("bvh build    %.3f ms, %u nodes\n", buildSeconds * 1e3, backend.getBVH().nodeCount());
+    printf("wall time    %.3f s\n", seconds);
+    printf("time/pass    %.3f ms\n", seconds / passes * 1e3);
+    printf("rays/sec     %.3f M\n", backend.getTracedRays() / seconds / 1e6);
+
+    if (!statsPath.empty() && !stats.write(statsPath)) {
+        fprintf(stderr, "Could not write %s\n", statsPath.c_str());
+        return EXIT_FAILURE;
+    }
+    if (!writeImage(output, pixels.data(), width, height)) {
+        fprintf(stderr, "Could not write %s\n", output.c_str());
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -96,14 +96,30 @@ struct Shape {
 	Material material;
 };
 
-uniform uint shapeCount;
-uniform uint triangleCount;
-
 layout(std430, binding = 0) buffer shapeBuffer
 {
 	Shape shapes[];
 };
 
+// ShaderBVHNode. Depth first order: a hit interior node continues with the next node, a missed one
+// jumps to skipFirst, the first node after its subtree. Leaves hold skipFirst..skipFirst + count - 1
+// and continue with the next node.
+struct BVHNode {
+	vec3 boundsMin;
+	uint skipFirst;
+	vec3 boundsMax;
+	uint count;
+};
+
+layout(std430, binding = 4) buffer bvhBuffer
+{
+	BVHNode nodes[];
+};
+
+// nodes [0, shapeRoot) are the tree over the triangles, [shapeRoot, nodeCount) the one over the shapes
+uniform uint shapeRoot;
+uniform uint nodeCount;
+
 struct Ray {
 	vec3 origin;
 	vec3 direction;
@@ -203,16 +219,39 @@ vec3 normalAt(in Shape shape, in vec3 p) {
 	return vec3(1);
 }
 
+bool hitBounds(in BVHNode node, in Ray ray, in vec3 inverseDirection, float tMax) {
+	vec3 t0 = (node.boundsMin - ray.origin) * inverseDirection;
+	vec3 t1 = (node.boundsMax - ray.origin) * inverseDirection;
+	vec3 tNear = min(t0, t1);
+	vec3 tFar = max(t0, t1);
+	float tEnter = max(max(tNear.x, tNear.y), max(tNear.z, 0));
+	float tExit = min(min(tFar.x, tFar.y), min(tFar.z, tMax));
+	return tEnter <= tExit;
+}
+
 void getClosestShapeIndex(in Ray ray, out float distance, out int index) {
 
 	distance = inf;
 	index = -1;
-	for (int i = 0; i < shapeCount; ++i) {
-		float t = hit(shapes[i], ray);
-		if (t < 1000 && t > 0.0001 && t < distance) {
-			distance = t;
-			index = i;
+	vec3 inverseDirection = 1 / ray.direction;
+	uint node = shapeRoot;
+	while (node < nodeCount) {
+		bool hitNode = hitBounds(nodes[node], ray, inverseDirection, min(distance, 1000));
+		if (nodes[node].count == 0) {
+			node = hitNode ? node + 1 : nodes[node].skipFirst;
+			continue;
+		}
+		if (hitNode) {
+			uint first = nodes[node].skipFirst;
+			for (uint i = first; i < first + nodes[node].count; ++i) {
+				float t = hit(shapes[i], ray);
+				if (t < 1000 && t > 0.0001 && t < distance) {
+					distance = t;
+					index = int(i);
+				}
+			}
 		}
+		++node;
 	}
 
 }
@@ -220,13 +259,25 @@ void getClosestShapeIndex(in Ray ray, out float distance, out int index) {
 void getClosestTriangleIndex(in Ray ray, out float distance, out int index) {
 	distance = inf;
 	index = -1;
-
-	for (int i = 0; i < triangleCount; ++i) {
-		float t = hitTriangle(triangles[i], ray);
-		if (t < 1000 && t > 0.0001 && t < distance) {
-			distance = t;
-			index = i;
+	vec3 inverseDirection = 1 / ray.direction;
+	uint node = 0;
+	while (node < shapeRoot) {
+		bool hitNode = hitBounds(nodes[node], ray, inverseDirection, min(distance, 1000));
+		if (nodes[node].count == 0) {
+			node = hitNode ? node + 1 : nodes[node].skipFirst;
+			continue;
+		}
+		if (hitNode) {
+			uint first = nodes[node].skipFirst;
+			for (uint i = first; i < first + nodes[node].count; ++i) {
+				float t = hitTriangle(triangles[i], ray);
+				if (t < 1000 && t > 0.0001 && t < distance) {
+					distance = t;
+					index = int(i);
+				}
+			}
 		}
+		++node;
 	}
 }
 
@@ -1,15 +1,49 @@
 #pragma once
 #include "Eigen/Dense"
 #include "Eigen/Geometry" 
-#include <random>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
 
 using namespace Eigen;
 
-std::random_device rd;
-std::mt19937 gen = std::mt19937(rd());
 #define pi 3.14159265358979323846
-static std::normal_distribution<float> normalDistribution{ 0, 1 };
-static std::uniform_real_distribution<float> uniformDistribution{ 0, pi };
+
+// Counter based random numbers: every value is a hash of a key and a counter, so streams share no
+// state and a stream keyed by (seed, pixel, sample) gives the same numbers on every thread and run.
+// The counter is split into the bounce (high 32 bits) and the dimension within that bounce.
+class RandomStream {
+public:
+    RandomStream(uint64_t seed = 0, uint64_t pixel = 0, uint64_t sample = 0)
+        : key(mix(mix(mix(seed) ^ pixel) ^ sample)), counter(0) {}
+
+    void setBounce(uint32_t bounce) {
+        counter = uint64_t(bounce) << 32;
+    }
+
+    uint32_t nextUInt() {
+        return uint32_t(mix(key + 0x9E3779B97F4A7C15ull * ++counter) >> 32);
+    }
+
+    // uniform in [0, 1)
+    float nextFloat() {
+        return (nextUInt() >> 8) * (1.f / 16777216.f);
+    }
+
+private:
+    // SplitMix64 finalizer
+    static uint64_t mix(uint64_t x) {
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+        return x ^ (x >> 31);
+    }
+
+    uint64_t key;
+    uint64_t counter;
+};
+
+// Stream used by randomUnitVector, renderers re-key it for every pixel sample.
+inline thread_local RandomStream threadRandom;
 
 template<typename T, unsigned int n, unsigned m>
 std::ostream& operator<<(std::ostream& out, const Matrix<T, n, m>& other)
@@ -35,14 +69,10 @@ std::istream& operator>>(std::istream& in, Matrix<T, n, m>& other)
 }
 
 inline Vector3f randomUnitVector() {
-    //float teta = ((float)rand() / RAND_MAX) * pi;
-    //float phi = ((float)rand() / RAND_MAX)  * pi;
-
-    // speed boost
-    //float teta = uniformDistribution(gen);
-    //float phi = uniformDistribution(gen);
-    //return { sin(teta) * cos(phi), sin(teta) * sin(phi), cos(phi) };
-    return Vector3f{ normalDistribution(gen), normalDistribution(gen), normalDistribution(gen) }.normalized();
+    const float z = 1 - 2 * threadRandom.nextFloat();
+    const float phi = 2 * float(pi) * threadRandom.nextFloat();
+    const float r = std::sqrt(std::max(0.f, 1 - z * z));
+    return { r * std::cos(phi), r * std::sin(phi), z };
 }
 
 inline Vector3f randomUnitVector(const Vector3f& normal) {